@@ -26,7 +26,6 @@ int main(void) {
     renderer.Init();
     
     while (!window.shouldClose()) {
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
         window.calculateDeltaTime(deltaTime, lastFrame);
 
         ImGui_ImplOpenGL3_NewFrame();
@@ -6,6 +6,7 @@
 #include <cstring>
 #include <fstream>
 #include <sstream>
+#include <random>
 
 Renderer::Renderer() {
     camera = std::make_unique<Camera>(
@@ -61,22 +62,52 @@ void Renderer::Init() {
     tree->SetLeafSize(leafSize);
     tree->SetLeafDensity(leafDensity);
     tree->SetMinLeafDepth(minLeafDepth);
+    tree->SetLeafBudget(leafBudget);
     tree->SetDivergenceAngle1(treeDivergenceAngle1);
     tree->SetDivergenceAngle2(treeDivergenceAngle2);
+    tree->SetSplineTessellation(splineTessellation);
+    tree->SetSplineAngleTolerance(splineAngleTolerance);
+    tree->SetSplineRadiusTolerance(splineRadiusTolerance);
+    tree->SetBranchMesher(branchMesher == 1 ? BranchMesher::Implicit : BranchMesher::Rings);
+    tree->SetImplicitMeshSettings(implicitSettings);
+    tree->SetPipeModelRadii(pipeModelRadii);
+    tree->SetPipeExponent(pipeExponent);
+    tree->SetBakeOcclusion(bakeOcclusion);
+    tree->SetOcclusionSettings(occlusionSettings);
     
-    // Load leaf texture (black background, white leaf silhouette)
-    tree->LoadLeafTexture("../src/res/leaves.jpg");
+    // Leaf textures for every species share one array (black background,
+    // white leaf silhouette), the tree picks its layer
+    leafTextures.AddLayer("../src/res/leaves.jpg");
+    leafTextures.AddLayer("../src/res/leaf.jpg");
+    leafTextures.Upload();
+    tree->SetLeafTextures(&leafTextures, leafSpecies);
     
     ApplyCurrentRules();
     tree->Generate(treeIterations);
     
     treeShader = new Shader("../src/res/shaders/tree.shader");
     leafShader = new Shader("../src/res/shaders/leaf.shader");
+    leafCullShader = new Shader("../src/res/shaders/leaf_cull.shader", { "o_Instance" });
+    leafCountShader = new Shader("../src/res/shaders/leaf_count.shader");
+    leafCommandShader = new Shader("../src/res/shaders/leaf_command.shader", { "o_Command" });
+    tree->SetLeafGpuCullShaders(leafCullShader, leafCountShader, leafCommandShader);
+    leafUpsampleShader = new Shader("../src/res/shaders/leaf_upsample.shader");
+    leafHalfResPass.Init();
+    leafHalfResPass.SetShader(leafUpsampleShader);
+    forest.Init();
+    hizReduceShader = new Shader("../src/res/shaders/hiz_reduce.shader");
+    occlusion.Init();
+    occlusion.SetShader(hizReduceShader);
+    shadowMap.Init();
+    impostorShader = new Shader("../src/res/shaders/impostor.shader");
+    forest.SetImpostorShader(impostorShader);
+    forestStreamer.SetImpostorShader(impostorShader);
     
     std::cout << "Renderer initialized successfully" << std::endl;
 }
 
 void Renderer::Render() {
+    // The frame's only clear, the sky pass relies on the far-plane depth
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
     
     static float lastTime = 0.0f;
@@ -90,6 +121,7 @@ void Renderer::Render() {
     }
     
     sky->Update(deltaTime);
+    TreeImpostor::BeginFrame();
     
     // Check if tree needs regeneration
     if (treeNeedsRegeneration) {
@@ -99,8 +131,18 @@ void Renderer::Render() {
         tree->SetLeafSize(leafSize);
         tree->SetLeafDensity(leafDensity);
         tree->SetMinLeafDepth(minLeafDepth);
+        tree->SetLeafBudget(leafBudget);
         tree->SetDivergenceAngle1(treeDivergenceAngle1);  
         tree->SetDivergenceAngle2(treeDivergenceAngle2);  
+        tree->SetSplineTessellation(splineTessellation);
+        tree->SetSplineAngleTolerance(splineAngleTolerance);
+        tree->SetSplineRadiusTolerance(splineRadiusTolerance);
+        tree->SetBranchMesher(branchMesher == 1 ? BranchMesher::Implicit : BranchMesher::Rings);
+        tree->SetImplicitMeshSettings(implicitSettings);
+        tree->SetPipeModelRadii(pipeModelRadii);
+        tree->SetPipeExponent(pipeExponent);
+        tree->SetBakeOcclusion(bakeOcclusion);
+        tree->SetOcclusionSettings(occlusionSettings);
         ApplyCurrentRules();
         tree->Generate(treeIterations);
         treeNeedsRegeneration = false;
@@ -113,24 +155,134 @@ void Renderer::Render() {
     glm::vec3 sunColor = glm::vec3(1.0f, 1.0f, 1.0f);
     glm::vec3 cameraPosition = camera->getCameraPos();
 
-    // Render sky
-    sky->Render(*skyShader, view, projection, sunDirection);    
+    // Wind runs in the vertex shaders, only the clock advances here
+    tree->SetWind(windSettings, (float)glfwGetTime());
     
-    // Render tree branches
-    if (treeShader) {
-        tree->Render(*treeShader, view, projection);
+    // Depth from an earlier frame's occluders, if one has come back by now
+    bool forestVisible = renderForest || forestStreamer.IsRunning();
+    const HiZOcclusion* occluders = occlusionCulling && forestVisible ? &occlusion : nullptr;
+    occlusion.Update();
+    tree->SetOcclusion(occluders);
+    forest.SetOcclusion(occluders);
+    forestStreamer.SetOcclusion(occluders);
+    
+    // The cached shadow map alpha tests with the current species
+    tree->SetLeafTextures(&leafTextures, leafSpecies);
+    if (treeShadows && treeShader && leafShader) {
+        shadowMap.Update(*tree, *treeShader, *leafShader, tree->GetSunDirection(), renderLeaves);
+        tree->SetShadowMap(&shadowMap);
+    } else {
+        tree->SetShadowMap(nullptr);
+    }
+    
+    BuildPassList();
+    for (RenderPass pass : passes) {
+        RunPass(pass, view, projection, sunDirection, cameraPosition);
     }
+}
+
+void Renderer::BuildPassList() {
+    passes.clear();
+    passes.push_back(RenderPass::Branches);
     
-    // Render leaves
-    if (leafShader && renderLeaves) {
-        tree->RenderLeaves(*leafShader, view, projection);
+    // The sky goes behind everything that writes depth, so the scattering
+    // and cloud shader only runs on pixels nothing else covered. Blended
+    // leaves, and half-res ones composited with soft edges, mix with what
+    // is behind them and need the sky there first.
+    bool leavesBlend = renderLeaves && (!leafAlphaToCoverage || halfResLeaves);
+    if (leavesBlend) {
+        passes.push_back(RenderPass::Sky);
+    }
+    passes.push_back(RenderPass::Leaves);
+    passes.push_back(RenderPass::Forest);
+    if (!leavesBlend) {
+        passes.push_back(RenderPass::Sky);
+    }
+    
+    passes.push_back(RenderPass::Occluders);
+}
+
+void Renderer::RunPass(RenderPass pass, const glm::mat4& view, const glm::mat4& projection,
+                       const glm::vec3& sunDirection, const glm::vec3& cameraPosition) {
+    // Forest prototypes share the edited tree's per-frame state
+    auto preparePrototype = [&](Tree& prototype) {
+        prototype.SetWind(windSettings, (float)glfwGetTime());
+        prototype.SetLeafAlphaToCoverage(leafAlphaToCoverage);
+        prototype.SetCanopyShadowing(canopyShadowing);
+    };
+    
+    switch (pass) {
+    case RenderPass::Branches:
+        if (treeShader) {
+            tree->Render(*treeShader, view, projection);
+        }
+        break;
+        
+    case RenderPass::Leaves:
+        if (leafShader && renderLeaves) {
+            tree->SetLeafCullSettings(leafCullSettings);
+            tree->SetLeafAlphaToCoverage(leafAlphaToCoverage);
+            tree->SetCanopyShadowing(canopyShadowing);
+            if (halfResLeaves && leafHalfResPass.Begin()) {
+                tree->RenderLeaves(*leafShader, view, projection);
+                leafHalfResPass.End(projection);
+            } else {
+                tree->RenderLeaves(*leafShader, view, projection);
+            }
+        }
+        break;
+        
+    case RenderPass::Forest:
+        // Render the forest around the edited tree
+        if (renderForest && treeShader && leafShader) {
+            if (forestNeedsBuild) {
+                BuildForest();
+                forestNeedsBuild = false;
+            }
+            forest.ForEachPrototype(preparePrototype);
+            forest.SetSettings(forestSettings);
+            forest.Render(*treeShader, *leafShader, view, projection, renderLeaves);
+        }
+        
+        // Streamed forest tiles around the camera
+        if (forestStreamer.IsRunning() && treeShader && leafShader) {
+            forestStreamer.Update(cameraPosition);
+            forestStreamer.ForEachPrototype(preparePrototype);
+            forestStreamer.SetForestSettings(forestSettings);
+            forestStreamer.Render(*treeShader, *leafShader, view, projection, renderLeaves);
+        }
+        break;
+        
+    case RenderPass::Sky:
+        sky->Render(*skyShader, view, projection, sunDirection);
+        break;
+        
+    case RenderPass::Occluders:
+        // Near trees into the Hi-Z target, read back in the background for later frames
+        if (occlusionCulling && (renderForest || forestStreamer.IsRunning()) &&
+            treeShader && leafShader && occlusion.Begin(view, projection)) {
+            tree->Render(*treeShader, view, projection);
+            forest.RenderOccluders(*treeShader, *leafShader, view, projection);
+            forestStreamer.RenderOccluders(*treeShader, *leafShader, view, projection);
+            occlusion.End();
+        }
+        break;
     }
 }
 
 void Renderer::Clean() {
     if (tree) {
         tree->Clean();
+        tree->SetLeafGpuCullShaders(nullptr, nullptr, nullptr);
     }
+    forestStreamer.Stop();
+    forest.Clean();
+    // After every tree has returned its ranges
+    GeometryHeap::Get().Clean();
+    leafTextures.Clean();
+    leafHalfResPass.Clean();
+    occlusion.Clean();
+    shadowMap.Clean();
     
     if (skyShader) {
         delete skyShader;
@@ -146,6 +298,36 @@ void Renderer::Clean() {
         delete leafShader;
         leafShader = nullptr;
     }
+    
+    if (leafCullShader) {
+        delete leafCullShader;
+        leafCullShader = nullptr;
+    }
+    
+    if (leafCountShader) {
+        delete leafCountShader;
+        leafCountShader = nullptr;
+    }
+    
+    if (leafCommandShader) {
+        delete leafCommandShader;
+        leafCommandShader = nullptr;
+    }
+    
+    if (leafUpsampleShader) {
+        delete leafUpsampleShader;
+        leafUpsampleShader = nullptr;
+    }
+    
+    if (hizReduceShader) {
+        delete hizReduceShader;
+        hizReduceShader = nullptr;
+    }
+    
+    if (impostorShader) {
+        delete impostorShader;
+        impostorShader = nullptr;
+    }
 }
 
 void Renderer::ApplyCurrentRules() {
@@ -316,6 +498,130 @@ void Renderer::ApplyPreset(const TreePreset& preset) {
     treeNeedsRegeneration = true;
 }
 
+ForestPrototypeBuilder Renderer::MakePrototypeBuilder() const {
+    // One species per preset, or the edited tree when there are none. The
+    // builder may run on streaming workers, so it captures copies only.
+    std::vector<TreePreset> species = presets;
+    if (species.empty()) {
+        TreePreset current;
+        current.axiom = axiomInputBuffer;
+        current.iterations = treeIterations;
+        current.branchAngle = treeBranchAngle;
+        current.lengthScale = treeLengthScale;
+        current.radiusScale = treeRadiusScale;
+        current.leafSize = leafSize;
+        current.leafDensity = leafDensity;
+        current.divergenceAngle1 = treeDivergenceAngle1;
+        current.divergenceAngle2 = treeDivergenceAngle2;
+        current.minLeafDepth = minLeafDepth;
+        current.tropism = tree->GetTropism();
+        for (int r = 0; r < MAX_RULES; r++) {
+            if (ruleEnabled[r] && strlen(ruleReplacements[r]) > 0) {
+                current.rules.push_back({ ruleSymbols[r], std::string(ruleReplacements[r]) });
+            }
+        }
+        species.push_back(current);
+    }
+    
+    float angleRandomness = tree->GetAngleRandomness();
+    float lengthRandomness = tree->GetLengthRandomness();
+    float branchProbability = tree->GetBranchProbability();
+    int leafBudget = this->leafBudget;
+    bool splineTessellation = this->splineTessellation;
+    float splineAngleTolerance = this->splineAngleTolerance;
+    float splineRadiusTolerance = this->splineRadiusTolerance;
+    bool pipeModelRadii = this->pipeModelRadii;
+    float pipeExponent = this->pipeExponent;
+    bool bakeOcclusion = this->bakeOcclusion;
+    OcclusionSettings occlusionSettings = this->occlusionSettings;
+    const LeafTextureArray* textures = &leafTextures;
+    int layerCount = glm::max(leafTextures.GetLayerCount(), 1);
+    
+    return [=](Tree& prototype, unsigned int seed) {
+        const TreePreset& preset = species[seed % species.size()];
+        prototype.SetAngleRandomness(angleRandomness);
+        prototype.SetLengthRandomness(lengthRandomness);
+        prototype.SetBranchProbability(branchProbability);
+        prototype.SetLeafBudget(leafBudget);
+        prototype.SetSplineTessellation(splineTessellation);
+        prototype.SetSplineAngleTolerance(splineAngleTolerance);
+        prototype.SetSplineRadiusTolerance(splineRadiusTolerance);
+        prototype.SetPipeModelRadii(pipeModelRadii);
+        prototype.SetPipeExponent(pipeExponent);
+        prototype.SetBakeOcclusion(bakeOcclusion);
+        prototype.SetOcclusionSettings(occlusionSettings);
+        prototype.SetLeafTextures(textures, (seed / species.size()) % layerCount);
+        
+        prototype.SetAngle(preset.branchAngle);
+        prototype.SetLengthScale(preset.lengthScale);
+        prototype.SetRadiusScale(preset.radiusScale);
+        prototype.SetLeafSize(preset.leafSize);
+        prototype.SetLeafDensity(preset.leafDensity);
+        prototype.SetMinLeafDepth(preset.minLeafDepth);
+        prototype.SetDivergenceAngle1(preset.divergenceAngle1);
+        prototype.SetDivergenceAngle2(preset.divergenceAngle2);
+        prototype.SetTropism(preset.tropism);
+        prototype.SetAxiom(preset.axiom);
+        for (const auto& rule : preset.rules) {
+            prototype.AddRule(rule.first, rule.second);
+        }
+        prototype.Generate(preset.iterations);
+    };
+}
+
+void Renderer::BuildForest() {
+    forest.ClearPrototypes();
+    
+    // Seeds 0..n-1 pick the presets in order
+    ForestPrototypeBuilder builder = MakePrototypeBuilder();
+    int prototypeCount = presets.empty() ? 1 : glm::min((int)presets.size(), 4);
+    for (int i = 0; i < prototypeCount; i++) {
+        auto prototype = std::make_unique<Tree>();
+        prototype->SetSeed(i);
+        builder(*prototype, i);
+        forest.AddPrototype(std::move(prototype));
+    }
+    
+    // Poisson-disk placements, one species per prototype spaced by its crown
+    std::vector<PoissonSpecies> species(prototypeCount);
+    for (int i = 0; i < prototypeCount; i++) {
+        species[i].radius = glm::max(forest.GetPrototype(i)->GetCrownRadius(), 0.5f) * forestCrownSpacing;
+    }
+    
+    // A disc with the edited tree in a clearing at its center
+    float outerRadius = forestRadius;
+    PlacementDensity density = [outerRadius](const glm::vec2& position) {
+        float distance = glm::length(position);
+        return (distance > 10.0f && distance < outerRadius) ? 1.0f : 0.0f;
+    };
+    std::vector<PoissonSample> samples;
+    SamplePoissonDisk(glm::vec2(-forestRadius), glm::vec2(forestRadius), species, 1337, density,
+                      PoissonDiskSettings(), samples);
+    
+    std::mt19937 rng(1337);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    std::vector<ForestInstance> instances(samples.size());
+    for (size_t i = 0; i < samples.size(); i++) {
+        ForestInstance& instance = instances[i];
+        instance.position = glm::vec3(samples[i].position.x, 0.0f, samples[i].position.y);
+        instance.yaw = unit(rng) * glm::two_pi<float>();
+        instance.scale = glm::mix(0.8f, 1.2f, unit(rng));
+        instance.tint = glm::vec3(glm::mix(0.85f, 1.1f, unit(rng)), glm::mix(0.9f, 1.1f, unit(rng)), glm::mix(0.85f, 1.0f, unit(rng)));
+        instance.lodBias = glm::mix(0.9f, 1.1f, unit(rng));
+        instance.prototype = samples[i].species;
+    }
+    forest.SetInstances(instances);
+    
+    std::cout << "Forest built: " << prototypeCount << " prototypes, " << instances.size() << " trees" << std::endl;
+}
+
+void Renderer::StartForestStreaming() {
+    ForestStreamSettings settings = streamSettings;
+    settings.gpuBudgetBytes = (size_t)streamGpuBudgetMB << 20;
+    settings.cpuBudgetBytes = (size_t)streamCpuBudgetMB << 20;
+    forestStreamer.Start(settings, MakePrototypeBuilder());
+}
+
 void Renderer::processKeyboardInput(GLFWwindow* window, float deltaTime) {
     float adjustedDeltaTime = deltaTime * (movementSpeed / 50.0f);
 
@@ -460,7 +766,15 @@ void Renderer::RenderDebugUI(float deltaTime) {
     changed |= ImGui::SliderFloat("Divergence Angle 1 (b)", &treeDivergenceAngle1, 0.0f, 180.0f, "%.1f deg");
     changed |= ImGui::SliderFloat("Divergence Angle 2 (e)", &treeDivergenceAngle2, 0.0f, 180.0f, "%.1f deg");
     changed |= ImGui::SliderFloat("Length Scale", &treeLengthScale, 0.5f, 0.95f, "%.2f");
+    changed |= ImGui::Checkbox("Pipe Model Radii", &pipeModelRadii);
+    if (pipeModelRadii) {
+        changed |= ImGui::SliderFloat("Pipe Exponent", &pipeExponent, 1.5f, 3.5f, "%.2f");
+        ImGui::TextDisabled("(radii follow the branching, Radius Scale is unused)");
+    }
+    // The pipe model overwrites every radius it would set
+    ImGui::BeginDisabled(pipeModelRadii);
     changed |= ImGui::SliderFloat("Radius Scale", &treeRadiusScale, 0.5f, 0.95f, "%.2f");
+    ImGui::EndDisabled();
     
     ImGui::Separator();
     ImGui::Text("Randomness Parameters:");
@@ -493,6 +807,30 @@ void Renderer::RenderDebugUI(float deltaTime) {
     }
     ImGui::TextDisabled("(lower = sparser tree)");
     
+    ImGui::Separator();
+    ImGui::Text("Branch Mesh:");
+    
+    changed |= ImGui::Checkbox("Spline Tessellation", &splineTessellation);
+    if (splineTessellation) {
+        changed |= ImGui::SliderFloat("Angle Tolerance", &splineAngleTolerance, 1.0f, 30.0f, "%.1f deg");
+        changed |= ImGui::SliderFloat("Radius Tolerance", &splineRadiusTolerance, 0.05f, 0.5f, "%.2f");
+    }
+    ImGui::TextDisabled("(rings placed by curvature along unbranched limbs)");
+    
+    const char* mesherNames[] = { "Rings", "Implicit (marching cubes)" };
+    changed |= ImGui::Combo("Branch Mesher", &branchMesher, mesherNames, 2);
+    if (branchMesher == 1) {
+        changed |= ImGui::SliderFloat("Voxel Size", &implicitSettings.voxelSize, 0.02f, 0.3f, "%.3f");
+        changed |= ImGui::SliderFloat("Blend Radius", &implicitSettings.blendRadius, 0.0f, 0.5f, "%.2f");
+        changed |= ImGui::SliderFloat("Decimation", &implicitSettings.decimationFactor, 1.0f, 4.0f, "%.1f voxels");
+    }
+    
+    changed |= ImGui::Checkbox("Bake Ambient Occlusion", &bakeOcclusion);
+    if (bakeOcclusion) {
+        changed |= ImGui::SliderInt("AO Rays", &occlusionSettings.rayCount, 4, 64);
+        changed |= ImGui::SliderFloat("AO Distance", &occlusionSettings.maxDistance, 0.5f, 10.0f, "%.1f");
+    }
+    
     ImGui::Separator();
     ImGui::Text("Leaf Parameters:");
     
@@ -503,6 +841,41 @@ void Renderer::RenderDebugUI(float deltaTime) {
     changed |= ImGui::SliderFloat("Leaf Size", &leafSize, 0.1f, 1.0f, "%.2f");
     changed |= ImGui::SliderFloat("Leaf Density", &leafDensity, 0.0f, 1.0f, "%.2f");
     changed |= ImGui::SliderInt("Min Leaf Depth", &minLeafDepth, 0, 6);
+    changed |= ImGui::SliderInt("Leaf Budget", &leafBudget, 500, 20000);
+    ImGui::TextDisabled("(leaves at density 1, blue-noise spread)");
+    
+    // Only restamps the texture layer into the instances
+    const char* speciesNames[] = { "Leaf cluster", "Single leaf" };
+    ImGui::Combo("Leaf Species", &leafSpecies, speciesNames, IM_ARRAYSIZE(speciesNames));
+    
+    // Culling is applied per frame, no regeneration needed
+    const char* cullModeNames[] = { "Off", "CPU clusters", "GPU transform feedback" };
+    int cullMode = (int)leafCullSettings.mode;
+    if (ImGui::Combo("Leaf Culling", &cullMode, cullModeNames, 3)) {
+        leafCullSettings.mode = (LeafCullMode)cullMode;
+    }
+    if (leafCullSettings.mode != LeafCullMode::Off) {
+        ImGui::SliderFloat("Prune Start", &leafCullSettings.pruneStart, 5.0f, 100.0f, "%.0f");
+        ImGui::SliderFloat("Min Leaf Fraction", &leafCullSettings.minFraction, 0.05f, 1.0f, "%.2f");
+    }
+    bool gpuLeafCulling = leafCullSettings.mode == LeafCullMode::Gpu && tree->IsLeafGpuCullingSupported();
+    if (leafCullSettings.mode == LeafCullMode::Gpu && !gpuLeafCulling) {
+        ImGui::TextDisabled("(not supported by this context, culling on the CPU)");
+    }
+    ImGui::Checkbox("Alpha To Coverage", &leafAlphaToCoverage);
+    ImGui::TextDisabled(gpuLeafCulling
+                        ? "(GPU culling keeps the unsorted order)"
+                        : "(depth-sorted front to back instead of blended)");
+    ImGui::Checkbox("Canopy Shadowing", &canopyShadowing);
+    ImGui::TextDisabled("(sunlight attenuated through a leaf density volume)");
+    ImGui::Checkbox("Tree Shadows", &treeShadows);
+    float sunThreshold = shadowMap.GetSunThreshold();
+    if (ImGui::SliderFloat("Shadow Sun Threshold", &sunThreshold, 0.1f, 10.0f, "%.1f deg")) {
+        shadowMap.SetSunThreshold(sunThreshold);
+    }
+    ImGui::TextDisabled("(cached, %d renders so far)", shadowMap.GetRenderCount());
+    ImGui::Checkbox("Half Resolution Leaves", &halfResLeaves);
+    ImGui::TextDisabled("(depth-aware upsample, alpha test instead of coverage)");
     
     if (changed) {
         treeNeedsRegeneration = true;
@@ -595,7 +968,93 @@ void Renderer::RenderDebugUI(float deltaTime) {
         ImGui::Separator();
         ImGui::Text("Statistics:");
         ImGui::Text("Branches: %d", tree->GetBranchCount());
+        ImGui::Text("Branch Chunks: %d", tree->GetBranchChunkCount());
+        if (ImGui::Button("Benchmark Ring Kernels", ImVec2(-1, 0))) {
+            tree->BenchmarkRingKernels();
+        }
         ImGui::Text("Leaves: %d", tree->GetLeafCount());
+        ImGui::Text("Leaf Clusters: %d / %d visible", tree->GetVisibleLeafClusterCount(), tree->GetLeafClusterCount());
+        if (leafCullSettings.mode == LeafCullMode::Gpu && tree->IsLeafGpuCullingSupported()) {
+            ImGui::Text("Leaves Drawn: (counted on GPU)");
+        } else {
+            ImGui::Text("Leaves Drawn: %d", tree->GetDrawnLeafCount());
+        }
+    }
+
+    if (ImGui::CollapsingHeader("Forest")) {
+        if (ImGui::Checkbox("Render Forest", &renderForest) && renderForest && forest.GetPrototypeCount() == 0) {
+            forestNeedsBuild = true;
+        }
+        ImGui::SliderFloat("Crown Spacing", &forestCrownSpacing, 0.5f, 4.0f, "%.2f");
+        ImGui::SliderFloat("Forest Radius", &forestRadius, 20.0f, 1000.0f, "%.0f");
+        if (ImGui::Button("Build Forest", ImVec2(-1, 0))) {
+            renderForest = true;
+            forestNeedsBuild = true;
+        }
+        ImGui::TextDisabled("(one prototype per preset, or the edited tree)");
+        
+        // Leaf bands are picked per frame, no rebuild needed
+        ImGui::SliderFloat("Leaf Band Start", &forestSettings.leafBandStart, 5.0f, 200.0f, "%.0f");
+        ImGui::SliderInt("Leaf Bands", &forestSettings.bandCount, 1, 8);
+        ImGui::SliderFloat("Far Leaf Fraction", &forestSettings.minLeafFraction, 0.005f, 0.5f, "%.3f");
+        ImGui::SliderFloat("Impostor Distance", &forestSettings.impostorDistance, 0.0f, 1000.0f, "%.0f");
+        ImGui::TextDisabled("(0 draws every tree as geometry)");
+        // Changing either rebakes every prototype, one per frame
+        ImGui::SliderInt("Impostor Views", &forestSettings.impostor.frames, 4, 16);
+        ImGui::SliderInt("Impostor View Size", &forestSettings.impostor.frameSize, 32, 256);
+        // Band and impostor switches wait out the margin, then cross-fade
+        ImGui::SliderFloat("LOD Hysteresis", &forestSettings.lodTransitions.hysteresis, 0.0f, 0.5f, "%.2f");
+        ImGui::SliderInt("LOD Fade Frames", &forestSettings.lodTransitions.fadeFrames, 0, 60);
+        ImGui::TextDisabled("(0 switches without a fade)");
+        ImGui::Checkbox("Occlusion Culling", &occlusionCulling);
+        ImGui::SliderInt("Occluder Bands", &forestSettings.occluderBands, 0, 4);
+        
+        ImGui::Separator();
+        ImGui::Text("Streamed Tiles:");
+        bool streaming = forestStreamer.IsRunning();
+        if (ImGui::Checkbox("Stream Tiles Around Camera", &streaming)) {
+            if (streaming) {
+                StartForestStreaming();
+            } else {
+                forestStreamer.Stop();
+            }
+        }
+        // Tile layout changes only apply on restart
+        ImGui::SliderFloat("Tile Size", &streamSettings.tileSize, 16.0f, 256.0f, "%.0f");
+        ImGui::SliderInt("Load Radius", &streamSettings.loadRadius, 0, 8);
+        ImGui::SliderFloat("Tile Crown Spacing", &streamSettings.crownSpacing, 0.5f, 4.0f, "%.2f");
+        ImGui::SliderInt("Prototypes Per Tile", &streamSettings.prototypesPerTile, 1, 8);
+        ImGui::SliderInt("Workers", &streamSettings.workerCount, 1, 8);
+        ImGui::SliderInt("GPU Budget (MB)", &streamGpuBudgetMB, 64, 4096);
+        ImGui::SliderInt("RAM Budget (MB)", &streamCpuBudgetMB, 64, 8192);
+        if (streaming && ImGui::Button("Restart Streaming", ImVec2(-1, 0))) {
+            StartForestStreaming();
+        }
+        ImGui::Text("Tiles: %d resident, %d pending", forestStreamer.GetResidentTileCount(), forestStreamer.GetPendingTileCount());
+        ImGui::Text("Streamed Trees Visible: %d, occluded: %d, impostors: %d", forestStreamer.GetVisibleTreeCount(),
+                    forestStreamer.GetOccludedTreeCount(), forestStreamer.GetImpostorTreeCount());
+        ImGui::Text("GPU: %.1f MB  RAM: %.1f MB", forestStreamer.GetGpuMemoryBytes() / 1048576.0, forestStreamer.GetCpuMemoryBytes() / 1048576.0);
+        ImGui::Text("Evicted Tiles: %d", forestStreamer.GetEvictionCount());
+        
+        ImGui::Separator();
+        ImGui::Text("Prototypes: %d", forest.GetPrototypeCount());
+        ImGui::Text("Trees Visible: %d / %d", forest.GetVisibleInstanceCount(), (int)forest.GetInstances().size());
+        ImGui::Text("Trees Occluded: %d, as impostors: %d", forest.GetOccludedInstanceCount(),
+                    forest.GetImpostorInstanceCount());
+        ImGui::Text("Trees Cross-Fading: %d", forest.GetFadingInstanceCount());
+        ImGui::Text("Forest Draw Calls: %d", forest.GetDrawCallCount());
+        ImGui::Text("Forest Leaves Drawn: %llu", forest.GetDrawnLeafCount());
+        
+        const GeometryHeap& heap = GeometryHeap::Get();
+        ImGui::Text("Geometry Heap: %.1f / %.1f MB", heap.GetUsedBytes() / 1048576.0, heap.GetGpuMemoryBytes() / 1048576.0);
+        ImGui::TextDisabled(heap.HasMultiDrawIndirect() ? "(branches: multi-draw indirect)" : "(branches: base-vertex draw loop)");
+    }
+
+    if (ImGui::CollapsingHeader("Wind")) {
+        ImGui::Checkbox("Enable Wind", &windSettings.enabled);
+        ImGui::SliderFloat("Wind Strength", &windSettings.strength, 0.0f, 4.0f, "%.2f");
+        ImGui::SliderFloat("Wind Frequency", &windSettings.frequency, 0.1f, 2.0f, "%.2f");
+        ImGui::SliderFloat("Wind Heading", &windSettings.heading, 0.0f, 360.0f, "%.0f deg");
     }
 
     if (ImGui::CollapsingHeader("Controls")) {
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <memory>
+#include <vector>
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
 #include <glm/glm.hpp>
@@ -9,23 +10,36 @@
 #include "Shader.h"
 #include "Sky.h"
 #include "Tree.h"
+#include "LeafHalfResPass.h"
+#include "Forest.h"
+#include "ForestStreamer.h"
+#include "PoissonDisk.h"
 
 struct TreePreset {
     std::string name;
     std::string axiom;
-    int iterations;
-    float branchAngle;
-    float lengthScale;
-    float radiusScale;
-    float leafSize;
-    float leafDensity;
-    float divergenceAngle1;  
-    float divergenceAngle2;  
-    int minLeafDepth;
-    float tropism;
+    int iterations = 4;
+    float branchAngle = 25.0f;
+    float lengthScale = 0.9f;
+    float radiusScale = 0.88f;
+    float leafSize = 0.3f;
+    float leafDensity = 0.7f;
+    float divergenceAngle1 = 137.5f;  
+    float divergenceAngle2 = 90.0f;  
+    int minLeafDepth = 3;
+    glm::vec3 tropism = glm::vec3(0.0f, -0.2f, 0.0f);
     std::vector<std::pair<char, std::string>> rules; // symbol, replacement
 };
 
+// Passes of one frame, Render runs them in the order of its pass list
+enum class RenderPass {
+    Branches,   // Edited tree
+    Leaves,     // Edited tree
+    Forest,     // Built and streamed forest
+    Sky,        // Far plane, only where nothing was drawn
+    Occluders   // Hi-Z target for later frames
+};
+
 class Renderer {
 public:
     Renderer();
@@ -41,6 +55,9 @@ public:
     void SavePresetToFile();
     void LoadPresetsFromFile();
     void ApplyPreset(const TreePreset& preset);
+    void BuildForest();
+    void StartForestStreaming();
+    ForestPrototypeBuilder MakePrototypeBuilder() const;
     
 private:
     // Core components
@@ -52,6 +69,12 @@ private:
     Shader* skyShader = nullptr;
     Shader* treeShader = nullptr;
     Shader* leafShader = nullptr;
+    Shader* leafCullShader = nullptr;
+    Shader* leafCountShader = nullptr;
+    Shader* leafCommandShader = nullptr;
+    Shader* leafUpsampleShader = nullptr;
+    Shader* hizReduceShader = nullptr;
+    Shader* impostorShader = nullptr;
     
     // Camera controls
     bool showDebugWindow = true;
@@ -72,16 +95,57 @@ private:
     float treeBranchAngle = 25.0f;
     float treeLengthScale = 0.90f;
     float treeRadiusScale = 0.88f;
+    bool pipeModelRadii = true;
+    float pipeExponent = 2.5f;
     bool treeNeedsRegeneration = false;
     
+    // Branch mesh parameters
+    bool splineTessellation = false;
+    float splineAngleTolerance = 8.0f;
+    float splineRadiusTolerance = 0.2f;
+    int branchMesher = 0;  // 0 = rings, 1 = implicit
+    ImplicitMeshSettings implicitSettings;
+    bool bakeOcclusion = true;
+    OcclusionSettings occlusionSettings;
+    
     // Leaf parameters
     bool renderLeaves = true;
     float leafSize = 0.3f;
     float leafDensity = 0.7f;
     int minLeafDepth = 3;
+    int leafBudget = 6000;
+    LeafTextureArray leafTextures;
+    int leafSpecies = 0;  // Layer in leafTextures
+    LeafCullSettings leafCullSettings;
+    bool leafAlphaToCoverage = true;
+    bool canopyShadowing = true;
+    // Sun shadows of the edited tree, rendered again only when it or the sun changes
+    StaticShadowMap shadowMap;
+    bool treeShadows = true;
+    bool halfResLeaves = false;
+    LeafHalfResPass leafHalfResPass;
+    WindSettings windSettings;
     float treeDivergenceAngle1 = 137.5f;  // Golden angle
     float treeDivergenceAngle2 = 90.0f;   // Secondary divergence
     float tropism = -20.0f;
+    
+    // Forest of instanced prototypes around the edited tree
+    Forest forest;
+    ForestSettings forestSettings;
+    bool renderForest = false;
+    bool forestNeedsBuild = false;
+    float forestCrownSpacing = 1.2f;  // Minimum distance between trunks, in crown radii
+    float forestRadius = 200.0f;
+    
+    // Forest tiles generated in the background around the camera
+    ForestStreamer forestStreamer;
+    ForestStreamSettings streamSettings;
+    int streamGpuBudgetMB = 512;
+    int streamCpuBudgetMB = 1024;
+    
+    // Hi-Z depth of near trees, culls forest trees and leaf clusters behind them
+    HiZOcclusion occlusion;
+    bool occlusionCulling = true;
     // L-System UI
     static const int MAX_RULES = 8;
     char axiomInputBuffer[256] = "F";
@@ -94,5 +158,11 @@ private:
     
     void ApplyCurrentRules();
     void ApplyTreePreset(int presetIndex);
+    
+    // Frame passes
+    std::vector<RenderPass> passes;
+    void BuildPassList();
+    void RunPass(RenderPass pass, const glm::mat4& view, const glm::mat4& projection,
+                 const glm::vec3& sunDirection, const glm::vec3& cameraPosition);
 
 };
\ No newline at end of file
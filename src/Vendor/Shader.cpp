@@ -6,23 +6,59 @@
 #include "Window.h"
 #include <glm/gtc/type_ptr.hpp>
 
+// Replaces each #include "file" line with that file, resolved against the
+// including file's directory, so helpers shared between shaders live once.
+// Fails if any file along the way is missing or an include is malformed.
+static bool ExpandIncludes(const std::string& filepath, std::vector<std::string>& lines, int depth = 0) {
+    std::ifstream stream(filepath);
+    if (!stream.is_open()) {
+        std::cout << "Error: File is not opened: " << filepath << std::endl;
+        return false;
+    }
+    if (depth > 8) {
+        std::cout << "Error: Shader includes nest too deep at " << filepath << std::endl;
+        return false;
+    }
+
+    std::string directory;
+    size_t slash = filepath.find_last_of("/\\");
+    if (slash != std::string::npos) directory = filepath.substr(0, slash + 1);
+
+    std::string line;
+    while (getline(stream, line)) {
+        size_t start = line.find_first_not_of(" \t");
+        if (start != std::string::npos && line.compare(start, 8, "#include") == 0) {
+            size_t open = line.find('"', start);
+            size_t close = open == std::string::npos ? open : line.find('"', open + 1);
+            if (close == std::string::npos) {
+                std::cout << "Error: Malformed include in " << filepath << ": " << line << std::endl;
+                return false;
+            }
+            if (!ExpandIncludes(directory + line.substr(open + 1, close - open - 1), lines, depth + 1)) {
+                std::cout << "Error: Include failed in " << filepath << ": " << line << std::endl;
+                return false;
+            }
+        } else {
+            lines.push_back(line);
+        }
+    }
+    return true;
+}
+
 ShaderProgramSource Shader::ParseShader(const std::string& filepath) {
     enum class ShaderType { // enum to determine the index in the string stream array
-        NONE = -1, VERTEX = 0, FRAGMENT = 1
+        NONE = -1, VERTEX = 0, FRAGMENT = 1, GEOMETRY = 2
     };
 
-    std::fstream stream;
-    stream.open(filepath);
-    if (!stream.is_open()) {
-        std::cout << "Error: File is not opened: " << filepath << std::endl;
-        return{ "","" };
+    std::vector<std::string> lines;
+    if (!ExpandIncludes(filepath, lines)) {
+        return{ "","","" };
     }
 
-    std::string line;
-    std::stringstream ss[2];
+    std::stringstream ss[3];
     ShaderType type = ShaderType::NONE;
 
-    while (getline(stream, line))
+    for (const std::string& line : lines)
     {
         if (line.find("#shader") != std::string::npos) {
             if (line.find("vertex") != std::string::npos) {
@@ -34,13 +70,15 @@ ShaderProgramSource Shader::ParseShader(const std::string& filepath) {
                 // set mode to fragment
                 type = ShaderType::FRAGMENT;
             }
+            else if (line.find("geometry") != std::string::npos) {
+                type = ShaderType::GEOMETRY;
+            }
         }
         else {
             ss[static_cast<int>(type)] << line << '\n';
         }
     }
-    stream.close();
-    return { ss[0].str(),ss[1].str() };
+    return { ss[0].str(),ss[1].str(),ss[2].str() };
 }
 
 std::string Shader::LoadShaderFromFile(const std::string& filepath) {
@@ -77,6 +115,7 @@ unsigned int Shader::CompileShader(unsigned int type, const std::string& source)
         switch (type) {
         case GL_VERTEX_SHADER: shaderType = "Vertex"; break;
         case GL_FRAGMENT_SHADER: shaderType = "Fragment"; break;
+        case GL_GEOMETRY_SHADER: shaderType = "Geometry"; break;
         case GL_TESS_CONTROL_SHADER: shaderType = "Tessellation Control"; break;
         case GL_TESS_EVALUATION_SHADER: shaderType = "Tessellation Evaluation"; break;
         default: shaderType = "Unknown"; break;
@@ -211,6 +250,64 @@ unsigned int Shader::CreateTessellationShader(const std::string& vertexPath, con
     std::cout << "Tessellation shader program created successfully!" << std::endl;
     return program;
 }
+
+unsigned int Shader::CreateFeedbackShader(const ShaderProgramSource& source,
+    const std::vector<std::string>& feedbackVaryings) {
+    if (source.VertexSource.empty()) {
+        std::cout << "Failed to load transform feedback vertex shader" << std::endl;
+        return 0;
+    }
+
+    unsigned int program = glCreateProgram();
+    std::vector<unsigned int> stages;
+    stages.push_back(CompileShader(GL_VERTEX_SHADER, source.VertexSource));
+    if (!source.GeometrySource.empty()) {
+        stages.push_back(CompileShader(GL_GEOMETRY_SHADER, source.GeometrySource));
+    }
+    if (!source.FragmentSource.empty()) {
+        stages.push_back(CompileShader(GL_FRAGMENT_SHADER, source.FragmentSource));
+    }
+
+    for (unsigned int stage : stages) {
+        if (stage == 0) {
+            std::cout << "Failed to compile transform feedback shader!" << std::endl;
+            for (unsigned int other : stages) {
+                if (other != 0) glDeleteShader(other);
+            }
+            GLCall(glDeleteProgram(program));
+            return 0;
+        }
+        GLCall(glAttachShader(program, stage));
+    }
+
+    // Captured outputs have to be declared before linking
+    std::vector<const char*> names;
+    for (const auto& varying : feedbackVaryings) {
+        names.push_back(varying.c_str());
+    }
+    GLCall(glTransformFeedbackVaryings(program, names.size(), names.data(), GL_INTERLEAVED_ATTRIBS));
+
+    GLCall(glLinkProgram(program));
+    int linkStatus;
+    GLCall(glGetProgramiv(program, GL_LINK_STATUS, &linkStatus));
+
+    if (linkStatus == GL_FALSE) {
+        int length;
+        GLCall(glGetProgramiv(program, GL_INFO_LOG_LENGTH, &length));
+
+        char* message = (char*)alloca(length * sizeof(char));
+        GLCall(glGetProgramInfoLog(program, length, &length, message));
+
+        std::cerr << "Failed to link transform feedback shader program: " << message << std::endl;
+    }
+
+    for (unsigned int stage : stages) {
+        GLCall(glDeleteShader(stage));
+    }
+
+    return program;
+}
+
 int Shader::GetUniformLocation(const std::string name) {
     if (m_UniformLocationCache.find(name) != m_UniformLocationCache.end())
         return m_UniformLocationCache[name];
@@ -238,6 +335,10 @@ void Shader::SetUniform4f(const std::string& name, float v0, float v1, float v2,
     GLCall(glUniform4f(GetUniformLocation(name), v0, v1, v2, v3));
 }
 
+void Shader::SetUniform2f(const std::string& name, float v0, float v1) {
+    GLCall(glUniform2f(GetUniformLocation(name), v0, v1));
+}
+
 void Shader::SetUniform3f(const std::string& name, float v0, float v1, float v2) {
     GLCall(glUniform3f(GetUniformLocation(name), v0, v1, v2));
 }
@@ -1,11 +1,13 @@
 #pragma once
 #include <string>
+#include <vector>
 #include <unordered_map>
 #include <glm/glm.hpp>
 
 struct ShaderProgramSource {
     std::string VertexSource;
     std::string FragmentSource;
+    std::string GeometrySource;
 };
 
 struct TessellationShaderProgramSource {
@@ -33,6 +35,13 @@ public:
         m_RendererID = CreateTessellationShader(vertexPath, fragmentPath, tcsPath, tesPath);
     }
 
+    // Transform feedback shader constructor. The fragment and geometry stages
+    // are optional, the listed outputs are captured interleaved.
+    Shader(const std::string& filepath, const std::vector<std::string>& feedbackVaryings) {
+        ShaderProgramSource source = ParseShader(filepath);
+        m_RendererID = CreateFeedbackShader(source, feedbackVaryings);
+    }
+
     ~Shader();
 
     void Bind() const;
@@ -41,6 +50,7 @@ public:
     // Set Uniforms
     void SetUniform1i(const std::string& name, int value);
     void SetUniform1f(const std::string& name, float value);
+    void SetUniform2f(const std::string& name, float v0, float v1);
     void SetUniform3f(const std::string& name, float v0, float v1, float v2);
     void SetUniform4f(const std::string& name, float v0, float v1, float v2, float v3);
     void SetUniform3v(const std::string& name, const glm::vec3& vector);
@@ -61,5 +71,7 @@ private:
     unsigned int CreateShader(const std::string& vertexShader, const std::string& fragmentShader);
     unsigned int CreateTessellationShader(const std::string& vertexPath, const std::string& fragmentPath,
         const std::string& tcsPath, const std::string& tesPath);
+    unsigned int CreateFeedbackShader(const ShaderProgramSource& source,
+        const std::vector<std::string>& feedbackVaryings);
     int GetUniformLocation(const std::string name);
 };
\ No newline at end of file
@@ -28,6 +28,7 @@ Window::Window(int width, int height, const std::string& title) : m_window(nullp
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 0);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
     glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+    glfwWindowHint(GLFW_SAMPLES, 4);  // Leaves use alpha-to-coverage
     //std::cout << "OpenGL Version: " << glGetString(GL_VERSION) << std::endl;
 
     m_window = glfwCreateWindow(width, height, title.c_str(), nullptr, nullptr);
@@ -44,6 +45,7 @@ Window::Window(int width, int height, const std::string& title) : m_window(nullp
     SCREEN_WIDTH = width;
     SCREEN_HEIGHT = height;
     glEnable(GL_DEPTH_TEST);
+    glEnable(GL_MULTISAMPLE);
 
 }
 
@@ -0,0 +1,251 @@
+#include "AmbientOcclusion.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <thread>
+
+// Van der Corput radical inverse, used for the Hammersley point set
+static float RadicalInverse(unsigned int bits) {
+    bits = (bits << 16u) | (bits >> 16u);
+    bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
+    bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
+    bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
+    bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
+    return float(bits) * 2.3283064365386963e-10f;
+}
+
+// Orthonormal basis around n (Duff et al. 2017)
+static void BuildBasis(const glm::vec3& n, glm::vec3& tangent, glm::vec3& bitangent) {
+    float sign = std::copysign(1.0f, n.z);
+    float a = -1.0f / (sign + n.z);
+    float b = n.x * n.y * a;
+    tangent = glm::vec3(1.0f + sign * n.x * n.x * a, sign * b, -sign * n.x);
+    bitangent = glm::vec3(b, sign + n.y * n.y * a, -n.y);
+}
+
+static float IntersectSphere(const glm::vec3& ro, const glm::vec3& rd, const glm::vec3& center, float r) {
+    glm::vec3 oc = ro - center;
+    float b = glm::dot(rd, oc);
+    float c = glm::dot(oc, oc) - r * r;
+    float h = b * b - c;
+    return h > 0.0f ? -b - std::sqrt(h) : -1.0f;
+}
+
+// Ray against a capsule (Quilez), returns the entry distance or -1
+static float IntersectCapsule(const glm::vec3& ro, const glm::vec3& rd,
+                              const glm::vec3& pa, const glm::vec3& pb, float r) {
+    glm::vec3 ba = pb - pa;
+    glm::vec3 oa = ro - pa;
+    float baba = glm::dot(ba, ba);
+    float bard = glm::dot(ba, rd);
+    float baoa = glm::dot(ba, oa);
+    float rdoa = glm::dot(rd, oa);
+    float oaoa = glm::dot(oa, oa);
+    float a = baba - bard * bard;
+    float b = baba * rdoa - baoa * bard;
+    float c = baba * oaoa - baoa * baoa - r * r * baba;
+    float h = b * b - a * c;
+    if (h < 0.0f) return -1.0f;
+    
+    if (a < 1e-8f) {
+        // Ray runs along the axis, only the caps can be hit first
+        float ta = IntersectSphere(ro, rd, pa, r);
+        float tb = IntersectSphere(ro, rd, pb, r);
+        if (ta > 0.0f && (tb <= 0.0f || ta < tb)) return ta;
+        return tb;
+    }
+    
+    float t = (-b - std::sqrt(h)) / a;
+    float y = baoa + t * bard;
+    if (y > 0.0f && y < baba) return t;
+    return IntersectSphere(ro, rd, y <= 0.0f ? pa : pb, r);
+}
+
+static float IntersectDisc(const glm::vec3& ro, const glm::vec3& rd,
+                           const glm::vec3& center, const glm::vec3& normal, float r) {
+    float denom = glm::dot(rd, normal);
+    if (std::abs(denom) < 1e-6f) return -1.0f;
+    float t = glm::dot(center - ro, normal) / denom;
+    glm::vec3 offset = ro + rd * t - center;
+    return glm::dot(offset, offset) <= r * r ? t : -1.0f;
+}
+
+static bool IntersectBounds(const glm::vec3& ro, const glm::vec3& invDir,
+                            const glm::vec3& boundsMin, const glm::vec3& boundsMax, float tMax) {
+    glm::vec3 t0 = (boundsMin - ro) * invDir;
+    glm::vec3 t1 = (boundsMax - ro) * invDir;
+    glm::vec3 tNear = glm::min(t0, t1);
+    glm::vec3 tFar = glm::max(t0, t1);
+    float enter = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.0f));
+    float exit = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, tMax));
+    return enter <= exit;
+}
+
+OcclusionBaker::OcclusionBaker(const OcclusionSettings& settings)
+    : settings(settings) {
+    int count = std::max(1, settings.rayCount);
+    hemisphere.reserve(count);
+    for (int i = 0; i < count; i++) {
+        // Cosine-weighted Hammersley directions
+        float u = (i + 0.5f) / count;
+        float phi = 2.0f * 3.14159265f * RadicalInverse(i);
+        float r = std::sqrt(u);
+        hemisphere.push_back(glm::vec3(r * std::cos(phi), r * std::sin(phi), std::sqrt(1.0f - u)));
+    }
+}
+
+int OcclusionBaker::AddCapsule(const glm::vec3& a, const glm::vec3& b, float radius) {
+    Primitive primitive;
+    primitive.a = a;
+    primitive.b = b;
+    primitive.radius = radius;
+    primitive.disc = false;
+    primitive.boundsMin = glm::min(a, b) - glm::vec3(radius);
+    primitive.boundsMax = glm::max(a, b) + glm::vec3(radius);
+    primitives.push_back(primitive);
+    return primitives.size() - 1;
+}
+
+int OcclusionBaker::AddDisc(const glm::vec3& center, const glm::vec3& normal, float radius) {
+    Primitive primitive;
+    primitive.a = center;
+    primitive.b = glm::normalize(normal);
+    primitive.radius = radius;
+    primitive.disc = true;
+    primitive.boundsMin = center - glm::vec3(radius);
+    primitive.boundsMax = center + glm::vec3(radius);
+    primitives.push_back(primitive);
+    return primitives.size() - 1;
+}
+
+void OcclusionBaker::Build() {
+    nodes.clear();
+    primitiveOrder.resize(primitives.size());
+    for (size_t i = 0; i < primitives.size(); i++) primitiveOrder[i] = i;
+    if (!primitives.empty()) {
+        nodes.reserve(primitives.size() * 2);
+        BuildNode(0, primitives.size());
+    }
+}
+
+int OcclusionBaker::BuildNode(int first, int count) {
+    int index = nodes.size();
+    nodes.push_back(Node());
+
+    glm::vec3 boundsMin(1e30f), boundsMax(-1e30f);
+    glm::vec3 centroidMin(1e30f), centroidMax(-1e30f);
+    for (int i = first; i < first + count; i++) {
+        const Primitive& primitive = primitives[primitiveOrder[i]];
+        boundsMin = glm::min(boundsMin, primitive.boundsMin);
+        boundsMax = glm::max(boundsMax, primitive.boundsMax);
+        glm::vec3 centroid = (primitive.boundsMin + primitive.boundsMax) * 0.5f;
+        centroidMin = glm::min(centroidMin, centroid);
+        centroidMax = glm::max(centroidMax, centroid);
+    }
+    nodes[index].boundsMin = boundsMin;
+    nodes[index].boundsMax = boundsMax;
+
+    const int maxLeafSize = 4;
+    if (count <= maxLeafSize) {
+        nodes[index].first = first;
+        nodes[index].count = count;
+        return index;
+    }
+
+    // Median split along the widest centroid axis
+    glm::vec3 extent = centroidMax - centroidMin;
+    int axis = (extent.x > extent.y && extent.x > extent.z) ? 0 : (extent.y > extent.z ? 1 : 2);
+    int half = count / 2;
+    std::nth_element(primitiveOrder.begin() + first, primitiveOrder.begin() + first + half,
+                     primitiveOrder.begin() + first + count, [&](int lhs, int rhs) {
+        const Primitive& l = primitives[lhs];
+        const Primitive& r = primitives[rhs];
+        return (l.boundsMin[axis] + l.boundsMax[axis]) < (r.boundsMin[axis] + r.boundsMax[axis]);
+    });
+
+    int left = BuildNode(first, half);
+    int right = BuildNode(first + half, count - half);
+    nodes[index].left = left;
+    nodes[index].right = right;
+    nodes[index].count = 0;
+    return index;
+}
+
+float OcclusionBaker::Transmittance(const glm::vec3& origin, const glm::vec3& direction, int ignore) const {
+    glm::vec3 invDir = 1.0f / direction;
+    float transmittance = 1.0f;
+    int stack[64];
+    int stackSize = 0;
+    stack[stackSize++] = 0;
+
+    while (stackSize > 0) {
+        const Node& node = nodes[stack[--stackSize]];
+        if (!IntersectBounds(origin, invDir, node.boundsMin, node.boundsMax, settings.maxDistance)) continue;
+
+        if (node.count > 0) {
+            for (int i = node.first; i < node.first + node.count; i++) {
+                int id = primitiveOrder[i];
+                if (id == ignore) continue;
+
+                const Primitive& primitive = primitives[id];
+                float t = primitive.disc
+                    ? IntersectDisc(origin, direction, primitive.a, primitive.b, primitive.radius)
+                    : IntersectCapsule(origin, direction, primitive.a, primitive.b, primitive.radius);
+                if (t <= 0.0f || t >= settings.maxDistance) continue;
+                
+                if (!primitive.disc) return 0.0f;
+                transmittance *= 1.0f - settings.discOpacity;
+                if (transmittance < 0.01f) return 0.0f;
+            }
+        } else if (stackSize + 2 <= 64) {
+            stack[stackSize++] = node.left;
+            stack[stackSize++] = node.right;
+        }
+    }
+    return transmittance;
+}
+
+void OcclusionBaker::Bake(const std::vector<glm::vec3>& points, const std::vector<glm::vec3>& normals,
+                          const std::vector<int>* ignore, std::vector<float>& outOcclusion) const {
+    outOcclusion.assign(points.size(), 1.0f);
+    if (nodes.empty() || points.empty()) return;
+
+    unsigned int threadCount = settings.threadCount;
+    if (threadCount == 0) threadCount = std::max(1u, std::thread::hardware_concurrency());
+
+    const size_t batchSize = 256;
+    std::atomic<size_t> nextBatch(0);
+
+    auto worker = [&]() {
+        for (size_t start = nextBatch.fetch_add(batchSize); start < points.size();
+             start = nextBatch.fetch_add(batchSize)) {
+            size_t end = std::min(points.size(), start + batchSize);
+            for (size_t i = start; i < end; i++) {
+                glm::vec3 n = normals[i];
+                float length = glm::length(n);
+                n = length > 0.0f ? n / length : glm::vec3(0.0f, 1.0f, 0.0f);
+
+                glm::vec3 tangent, bitangent;
+                BuildBasis(n, tangent, bitangent);
+                glm::vec3 origin = points[i] + n * settings.bias;
+                int skip = ignore ? (*ignore)[i] : -1;
+
+                float open = 0.0f;
+                for (const auto& h : hemisphere) {
+                    glm::vec3 direction = tangent * h.x + bitangent * h.y + n * h.z;
+                    open += Transmittance(origin, direction, skip);
+                }
+                outOcclusion[i] = open / hemisphere.size();
+            }
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (unsigned int t = 1; t < threadCount; t++) {
+        workers.emplace_back(worker);
+    }
+    worker();
+    for (auto& thread : workers) {
+        thread.join();
+    }
+}
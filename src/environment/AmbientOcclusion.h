@@ -0,0 +1,56 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <vector>
+
+struct OcclusionSettings {
+    int rayCount = 16;            // Hemisphere rays per sample point
+    float maxDistance = 3.0f;     // Occluders further away than this are ignored
+    float bias = 0.02f;           // Ray origin offset along the normal
+    float discOpacity = 0.35f;    // Fraction of light a single leaf disc blocks
+    unsigned int threadCount = 0; // 0 = one per hardware thread
+};
+
+// Offline ambient occlusion baker. Capsules and discs go into a BVH, then
+// every sample point casts a fixed cosine-weighted set of hemisphere rays
+// against it. Capsules are opaque, discs only attenuate the ray since leaf
+// cards are mostly alpha-tested holes. Points are processed in parallel and
+// results are deterministic.
+class OcclusionBaker {
+public:
+    explicit OcclusionBaker(const OcclusionSettings& settings);
+
+    int AddCapsule(const glm::vec3& a, const glm::vec3& b, float radius);
+    int AddDisc(const glm::vec3& center, const glm::vec3& normal, float radius);
+    void Build();
+
+    // Writes the unoccluded fraction (1 = fully open) for each point. If
+    // ignore is given, ray hits against primitive ignore[i] are skipped for
+    // point i, so a leaf does not occlude itself.
+    void Bake(const std::vector<glm::vec3>& points, const std::vector<glm::vec3>& normals,
+              const std::vector<int>* ignore, std::vector<float>& outOcclusion) const;
+
+private:
+    struct Primitive {
+        glm::vec3 a;       // Capsule start or disc center
+        glm::vec3 b;       // Capsule end or disc normal
+        float radius;
+        bool disc;
+        glm::vec3 boundsMin, boundsMax;
+    };
+
+    struct Node {
+        glm::vec3 boundsMin, boundsMax;
+        int left, right;   // Children of interior nodes
+        int first, count;  // Primitive range of leaves, count is 0 for interior nodes
+    };
+
+    int BuildNode(int first, int count);
+    float Transmittance(const glm::vec3& origin, const glm::vec3& direction, int ignore) const;
+
+    OcclusionSettings settings;
+    std::vector<Primitive> primitives;
+    std::vector<int> primitiveOrder;
+    std::vector<Node> nodes;
+    std::vector<glm::vec3> hemisphere; // Directions around +Z
+};
@@ -0,0 +1,101 @@
+#include "BlueNoise.h"
+#include <algorithm>
+#include <cmath>
+#include <unordered_map>
+
+static unsigned long long CellKey(const glm::ivec3& cell) {
+    return ((unsigned long long)(cell.x & 0x1FFFFF) << 42) |
+           ((unsigned long long)(cell.y & 0x1FFFFF) << 21) |
+           (unsigned long long)(cell.z & 0x1FFFFF);
+}
+
+void ProgressiveSampleOrder(const std::vector<glm::vec3>& points, size_t count,
+                            unsigned int seed, std::vector<int>& outOrder) {
+    outOrder.clear();
+    count = std::min(count, points.size());
+    if (count == 0) return;
+    outOrder.reserve(count);
+
+    // Hashed visiting order
+    std::vector<std::pair<unsigned int, int>> keyed(points.size());
+    for (size_t i = 0; i < points.size(); i++) {
+        keyed[i] = { HashUInt((unsigned int)i ^ HashUInt(seed)), (int)i };
+    }
+    std::sort(keyed.begin(), keyed.end());
+    std::vector<int> pending(points.size());
+    for (size_t i = 0; i < keyed.size(); i++) pending[i] = keyed[i].second;
+
+    glm::vec3 boundsMin(1e30f), boundsMax(-1e30f);
+    for (const auto& p : points) {
+        boundsMin = glm::min(boundsMin, p);
+        boundsMax = glm::max(boundsMax, p);
+    }
+    float diagonal = glm::length(boundsMax - boundsMin);
+    float radius = std::max(diagonal * 0.5f, 1e-4f);
+    const float minRadius = std::max(diagonal * 1e-5f, 1e-6f);
+    const float shrink = 0.8f;
+
+    std::unordered_map<unsigned long long, std::vector<int>> grid;
+    std::vector<int> remaining;
+
+    while (outOrder.size() < count) {
+        if (radius < minRadius) {
+            // Only coincident points are left, take them in visiting order
+            for (size_t i = 0; i < pending.size() && outOrder.size() < count; i++) {
+                outOrder.push_back(pending[i]);
+            }
+            break;
+        }
+
+        // Bucket the accepted points with one cell per radius, so a conflict
+        // can only sit in the 27 surrounding cells
+        float invCell = 1.0f / radius;
+        grid.clear();
+        for (int index : outOrder) {
+            glm::ivec3 cell = glm::ivec3(glm::floor((points[index] - boundsMin) * invCell));
+            grid[CellKey(cell)].push_back(index);
+        }
+
+        float radiusSq = radius * radius;
+        size_t acceptedBefore = outOrder.size();
+        remaining.clear();
+        for (size_t i = 0; i < pending.size(); i++) {
+            int index = pending[i];
+            if (outOrder.size() >= count) {
+                remaining.push_back(index);
+                continue;
+            }
+
+            const glm::vec3& p = points[index];
+            glm::ivec3 cell = glm::ivec3(glm::floor((p - boundsMin) * invCell));
+            bool conflict = false;
+            for (int dz = -1; dz <= 1 && !conflict; dz++) {
+                for (int dy = -1; dy <= 1 && !conflict; dy++) {
+                    for (int dx = -1; dx <= 1 && !conflict; dx++) {
+                        auto it = grid.find(CellKey(cell + glm::ivec3(dx, dy, dz)));
+                        if (it == grid.end()) continue;
+                        for (int other : it->second) {
+                            glm::vec3 d = points[other] - p;
+                            if (glm::dot(d, d) < radiusSq) {
+                                conflict = true;
+                                break;
+                            }
+                        }
+                    }
+                }
+            }
+
+            if (conflict) {
+                remaining.push_back(index);
+            } else {
+                outOrder.push_back(index);
+                grid[CellKey(cell)].push_back(index);
+            }
+        }
+
+        // Passes that barely accept anything are wasted work, skip ahead faster
+        bool sparse = (outOrder.size() - acceptedBefore) * 100 < pending.size();
+        pending.swap(remaining);
+        radius *= sparse ? shrink * shrink * shrink : shrink;
+    }
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <vector>
+
+// Integer hash (PCG output permutation), same as the one in leaf.shader
+inline unsigned int HashUInt(unsigned int x) {
+    unsigned int state = x * 747796405u + 2891336453u;
+    unsigned int word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+    return (word >> 22u) ^ word;
+}
+
+// Uniform float in [0, 1) from a hash
+inline float HashFloat(unsigned int x) {
+    return (HashUInt(x) >> 8) * (1.0f / 16777216.0f);
+}
+
+// Picks count points out of a candidate pool so that every prefix of the
+// result is spread like a Poisson-disk set. It uses dart throwing with a
+// shrinking radius: each pass accepts the candidates further than the
+// current radius from everything accepted so far. Candidates are visited in
+// a hashed order, so the result only depends on the input and the seed.
+void ProgressiveSampleOrder(const std::vector<glm::vec3>& points, size_t count,
+                            unsigned int seed, std::vector<int>& outOrder);
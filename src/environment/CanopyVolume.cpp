@@ -0,0 +1,134 @@
+#include "CanopyVolume.h"
+#include <algorithm>
+#include <cmath>
+#include <thread>
+
+CanopyVolume::CanopyVolume(const CanopyVolumeSettings& settings)
+    : settings(settings), dimensions(0), boundsMin(0.0f), voxelSize(1.0f) {
+}
+
+void CanopyVolume::Build(const std::vector<glm::vec3>& positions, const std::vector<float>& areas,
+                         const glm::vec3& sunDirection) {
+    density.clear();
+    opticalDepth.clear();
+    dimensions = glm::ivec3(0);
+    if (positions.empty()) return;
+
+    glm::vec3 leafMin(1e30f), leafMax(-1e30f);
+    for (const auto& p : positions) {
+        leafMin = glm::min(leafMin, p);
+        leafMax = glm::max(leafMax, p);
+    }
+
+    // One empty voxel of padding on every side, so splats never clip and
+    // the sunlit faces start from zero
+    int resolution = std::max(settings.resolution, 4);
+    glm::vec3 extent = leafMax - leafMin;
+    float longest = std::max(std::max(extent.x, extent.y), std::max(extent.z, 1e-3f));
+    voxelSize = longest / (resolution - 2);
+    dimensions = glm::ivec3(glm::ceil(extent / voxelSize)) + 2;
+    dimensions = glm::clamp(dimensions, glm::ivec3(3), glm::ivec3(resolution));
+    boundsMin = (leafMin + leafMax) * 0.5f - glm::vec3(dimensions) * voxelSize * 0.5f;
+
+    density.assign((size_t)dimensions.x * dimensions.y * dimensions.z, 0.0f);
+    Splat(positions, areas);
+
+    opticalDepth.assign(density.size(), 0.0f);
+    SweepToward(glm::normalize(sunDirection));
+}
+
+void CanopyVolume::Splat(const std::vector<glm::vec3>& positions, const std::vector<float>& areas) {
+    float voxelVolume = voxelSize * voxelSize * voxelSize;
+    float scale = settings.extinction * settings.alphaCoverage / voxelVolume;
+
+    unsigned int threadCount = settings.threadCount;
+    if (threadCount == 0) threadCount = std::max(1u, std::thread::hardware_concurrency());
+    threadCount = std::min<unsigned int>(threadCount, dimensions.z);
+
+    auto worker = [&](unsigned int t) {
+        int zBegin = dimensions.z * t / threadCount;
+        int zEnd = dimensions.z * (t + 1) / threadCount;
+        for (size_t i = 0; i < positions.size(); i++) {
+            // Voxel centers sit at half-integer grid coordinates
+            glm::vec3 grid = (positions[i] - boundsMin) / voxelSize - 0.5f;
+            glm::ivec3 base = glm::ivec3(glm::floor(grid));
+            glm::vec3 f = grid - glm::vec3(base);
+            if (base.z + 1 < zBegin || base.z >= zEnd) continue;
+
+            float amount = areas[i] * scale;
+            for (int corner = 0; corner < 8; corner++) {
+                glm::ivec3 offset(corner & 1, (corner >> 1) & 1, corner >> 2);
+                glm::ivec3 cell = base + offset;
+                if (cell.z < zBegin || cell.z >= zEnd) continue;
+                if (cell.x < 0 || cell.y < 0 || cell.x >= dimensions.x || cell.y >= dimensions.y) continue;
+                float weight = (offset.x ? f.x : 1.0f - f.x) *
+                               (offset.y ? f.y : 1.0f - f.y) *
+                               (offset.z ? f.z : 1.0f - f.z);
+                density[Index(cell.x, cell.y, cell.z)] += amount * weight;
+            }
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (unsigned int t = 1; t < threadCount; t++) {
+        workers.emplace_back(worker, t);
+    }
+    worker(0);
+    for (auto& thread : workers) {
+        thread.join();
+    }
+}
+
+void CanopyVolume::SweepToward(const glm::vec3& direction) {
+    // March along the axis the sun direction is closest to. Each step moves
+    // one slice toward the sun and shears the other two axes, so a voxel
+    // continues the sum of the bilinear sample it sees in the previous slice.
+    int a = 0;
+    for (int axis = 1; axis < 3; axis++) {
+        if (std::abs(direction[axis]) > std::abs(direction[a])) a = axis;
+    }
+    int b = (a + 1) % 3;
+    int c = (a + 2) % 3;
+    int step = direction[a] > 0.0f ? 1 : -1;
+    float shearB = direction[b] / std::abs(direction[a]);
+    float shearC = direction[c] / std::abs(direction[a]);
+    float pathLength = voxelSize / std::abs(direction[a]);
+
+    auto at = [&](int slice, int u, int v) -> size_t {
+        glm::ivec3 cell;
+        cell[a] = slice;
+        cell[b] = u;
+        cell[c] = v;
+        return Index(cell.x, cell.y, cell.z);
+    };
+
+    // Slices are walked from the sunlit side, where the sum starts at zero
+    int sliceCount = dimensions[a];
+    int first = step > 0 ? sliceCount - 1 : 0;
+    for (int k = 0; k < sliceCount; k++) {
+        int slice = first - k * step;
+        int previous = slice + step;
+        bool hasPrevious = previous >= 0 && previous < sliceCount;
+
+        for (int v = 0; v < dimensions[c]; v++) {
+            for (int u = 0; u < dimensions[b]; u++) {
+                float here = density[at(slice, u, v)];
+                float behindDensity = 0.0f, behindDepth = 0.0f;
+                if (hasPrevious) {
+                    float su = u + shearB, sv = v + shearC;
+                    int u0 = (int)std::floor(su), v0 = (int)std::floor(sv);
+                    float fu = su - u0, fv = sv - v0;
+                    for (int corner = 0; corner < 4; corner++) {
+                        int uu = u0 + (corner & 1), vv = v0 + (corner >> 1);
+                        if (uu < 0 || vv < 0 || uu >= dimensions[b] || vv >= dimensions[c]) continue;
+                        float weight = ((corner & 1) ? fu : 1.0f - fu) * ((corner >> 1) ? fv : 1.0f - fv);
+                        behindDensity += density[at(previous, uu, vv)] * weight;
+                        behindDepth += opticalDepth[at(previous, uu, vv)] * weight;
+                    }
+                }
+                // Trapezoid between the two samples
+                opticalDepth[at(slice, u, v)] = behindDepth + 0.5f * (behindDensity + here) * pathLength;
+            }
+        }
+    }
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <vector>
+
+struct CanopyVolumeSettings {
+    int resolution = 32;            // Voxels along the longest axis of the canopy
+    float extinction = 0.5f;        // Projected leaf area per unit leaf area, 0.5 for random orientation
+    float alphaCoverage = 0.46f;    // Opaque fraction of the leaf card
+    unsigned int threadCount = 0;   // 0 = one per hardware thread
+};
+
+// Leaf area density of a canopy on a coarse grid, turned into the optical
+// depth from each voxel toward the sun. That is a running sum swept slice by
+// slice from the sunlit side, so a leaf fragment gets its direct light
+// transmittance from a single texel. Ambient darkening stays with the baked
+// occlusion.
+class CanopyVolume {
+public:
+    explicit CanopyVolume(const CanopyVolumeSettings& settings = CanopyVolumeSettings());
+
+    // Splats each leaf's card area with trilinear weights. Threads own
+    // disjoint z slabs and visit leaves in input order, so the result does
+    // not depend on scheduling.
+    void Build(const std::vector<glm::vec3>& positions, const std::vector<float>& areas,
+               const glm::vec3& sunDirection);
+
+    bool IsEmpty() const { return opticalDepth.empty(); }
+    const glm::ivec3& GetDimensions() const { return dimensions; }
+    const glm::vec3& GetBoundsMin() const { return boundsMin; }
+    glm::vec3 GetBoundsExtent() const { return glm::vec3(dimensions) * voxelSize; }
+
+    // One value per voxel, x fastest
+    const std::vector<float>& GetOpticalDepth() const { return opticalDepth; }
+
+private:
+    void Splat(const std::vector<glm::vec3>& positions, const std::vector<float>& areas);
+    void SweepToward(const glm::vec3& direction);
+    size_t Index(int x, int y, int z) const { return ((size_t)z * dimensions.y + y) * dimensions.x + x; }
+
+    CanopyVolumeSettings settings;
+    glm::ivec3 dimensions;
+    glm::vec3 boundsMin;
+    float voxelSize;
+    std::vector<float> density;        // Extinction per unit length
+    std::vector<float> opticalDepth;
+};
@@ -0,0 +1,441 @@
+#include "Forest.h"
+#include "GeometryHeap.h"
+#include "LeafClusters.h"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+// Culling spheres are padded for wind sway, which moves geometry past the rest bounds
+static const float swayPadding = 1.15f;
+
+Forest::Forest()
+    : initialized(false),
+      occlusion(nullptr), impostorShader(nullptr), lodBandCount(0),
+      placementBuffer(0), placementTexture(0), placementCapacity(0),
+      emptyVAO(0),
+      visibleInstanceCount(0), occludedInstanceCount(0), impostorInstanceCount(0),
+      fadingInstanceCount(0), drawCallCount(0), drawnLeafCount(0) {
+}
+
+Forest::~Forest() {
+    Clean();
+}
+
+void Forest::Init() {
+    if (initialized) return;
+
+    glGenBuffers(1, &placementBuffer);
+    glBindBuffer(GL_TEXTURE_BUFFER, placementBuffer);
+    glBufferData(GL_TEXTURE_BUFFER, sizeof(ForestInstanceData), nullptr, GL_STREAM_DRAW);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    placementCapacity = 1;
+
+    glGenTextures(1, &placementTexture);
+    glBindTexture(GL_TEXTURE_BUFFER, placementTexture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, placementBuffer);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+
+    glGenVertexArrays(1, &emptyVAO);
+    initialized = true;
+}
+
+void Forest::Clean() {
+    ClearPrototypes();
+    if (!initialized) return;
+
+    glDeleteTextures(1, &placementTexture);
+    glDeleteBuffers(1, &placementBuffer);
+    glDeleteVertexArrays(1, &emptyVAO);
+    placementCapacity = 0;
+    initialized = false;
+}
+
+Tree* Forest::AddPrototype() {
+    return AddPrototype(std::make_unique<Tree>());
+}
+
+Tree* Forest::AddPrototype(std::unique_ptr<Tree> prototype) {
+    prototypes.push_back(std::move(prototype));
+    prototypeLeaves.push_back(PrototypeLeaves());
+    prototypeImpostors.push_back(std::make_unique<TreeImpostor>());
+
+    // Prototypes stay at the origin, placements put them in the world
+    Tree* added = prototypes.back().get();
+    added->Init(glm::vec3(0.0f));
+    return added;
+}
+
+void Forest::ForEachPrototype(const std::function<void(Tree&)>& function) {
+    for (auto& prototype : prototypes) {
+        function(*prototype);
+    }
+}
+
+size_t Forest::GetGpuMemoryBytes() const {
+    size_t bytes = placementCapacity * sizeof(ForestInstanceData);
+    for (size_t i = 0; i < prototypes.size(); i++) {
+        bytes += prototypes[i]->GetGpuMemoryBytes();
+        bytes += prototypeLeaves[i].count * sizeof(PackedLeafInstance);
+        bytes += prototypeImpostors[i]->GetGpuMemoryBytes();
+    }
+    return bytes;
+}
+
+size_t Forest::GetCpuMemoryBytes() const {
+    size_t bytes = instances.capacity() * sizeof(ForestInstance) + visibleData.capacity() * sizeof(ForestInstanceData);
+    for (const auto& prototype : prototypes) {
+        bytes += prototype->GetCpuMemoryBytes();
+    }
+    return bytes;
+}
+
+void Forest::ClearPrototypes() {
+    for (auto& prototype : prototypes) {
+        prototype->Clean();
+    }
+    for (auto& leaves : prototypeLeaves) {
+        GeometryHeap::Get().GetLeafInstances().Free(leaves.range);
+    }
+    for (auto& impostor : prototypeImpostors) {
+        impostor->Clean();
+    }
+    prototypes.clear();
+    prototypeLeaves.clear();
+    prototypeImpostors.clear();
+}
+
+void Forest::UpdatePrototypeLeaves(int prototype) {
+    Tree& tree = *prototypes[prototype];
+    PrototypeLeaves& leaves = prototypeLeaves[prototype];
+    if (leaves.built && leaves.revision == tree.GetRevision()) return;
+
+    // Stable, so leaves of equal rank keep their cluster-major order
+    std::vector<PackedLeafInstance> sorted = tree.GetPackedLeafInstances();
+    std::stable_sort(sorted.begin(), sorted.end(),
+                     [](const PackedLeafInstance& a, const PackedLeafInstance& b) { return a.rank < b.rank; });
+
+    unsigned int rankCounts[256] = {};
+    for (const auto& leaf : sorted) {
+        rankCounts[leaf.rank]++;
+    }
+    leaves.rankPrefix[0] = 0;
+    for (int rank = 0; rank < 256; rank++) {
+        leaves.rankPrefix[rank + 1] = leaves.rankPrefix[rank] + rankCounts[rank];
+    }
+
+    HeapBuffer& heapLeaves = GeometryHeap::Get().GetLeafInstances();
+    heapLeaves.Free(leaves.range);
+    leaves.range = heapLeaves.Allocate(sorted.size());
+    heapLeaves.Upload(leaves.range, sorted.data());
+
+    leaves.count = sorted.size();
+    leaves.revision = tree.GetRevision();
+    leaves.built = true;
+}
+
+bool Forest::IsImpostorCurrent(int prototype) const {
+    const TreeImpostor& impostor = *prototypeImpostors[prototype];
+    const ImpostorSettings& baked = impostor.GetSettings();
+    return impostor.IsBaked() && impostor.GetRevision() == prototypes[prototype]->GetRevision() &&
+           baked.frames == settings.impostor.frames && baked.frameSize == settings.impostor.frameSize;
+}
+
+float Forest::BandLeafFraction(int band) const {
+    // Band b covers distances up to leafBandStart * 2^b. Its fraction is the
+    // LeafKeepFraction falloff at the geometric middle of that range.
+    if (band <= 0) return 1.0f;
+    float fraction = std::pow(2.0f, 1.0f - 2.0f * band);
+    return glm::clamp(fraction, settings.minLeafFraction, 1.0f);
+}
+
+unsigned int Forest::BandLeafCount(const PrototypeLeaves& leaves, float fraction) const {
+    if (fraction >= 1.0f) return leaves.count;
+
+    // A leaf's rank is 255 * index / count inside its cluster, so ranks below
+    // 255 * fraction keep that fraction of every cluster
+    int rank = glm::clamp((int)std::ceil(255.0f * fraction), 1, 256);
+    return leaves.rankPrefix[rank];
+}
+
+void Forest::Render(Shader& treeShader, Shader& leafShader, const glm::mat4& view,
+                    const glm::mat4& projection, bool renderLeaves) {
+    visibleInstanceCount = 0;
+    occludedInstanceCount = 0;
+    impostorInstanceCount = 0;
+    fadingInstanceCount = 0;
+    drawCallCount = 0;
+    drawnLeafCount = 0;
+    batches.clear();
+    if (!initialized || prototypes.empty() || instances.empty()) return;
+
+    int prototypeCount = prototypes.size();
+    int bandCount = glm::max(settings.bandCount, 1);
+    // Bands, then impostors, then the outgoing copies of band-to-band fades,
+    // which only draw leaves
+    int bandSlots = bandCount * 2 + 1;
+    bool impostors = impostorShader && settings.impostorDistance > 0.0f;
+
+    // Local bounding sphere of every prototype, and the half extents of its
+    // box for the tighter occlusion test
+    std::vector<glm::vec4> prototypeSpheres(prototypeCount);
+    std::vector<glm::vec3> prototypeExtents(prototypeCount);
+    std::vector<char> impostorReady(prototypeCount, 0);
+    int impostorWanted = -1;
+    for (int p = 0; p < prototypeCount; p++) {
+        UpdatePrototypeLeaves(p);
+        impostorReady[p] = impostors && IsImpostorCurrent(p);
+        glm::vec3 boundsMin, boundsMax;
+        prototypes[p]->GetLocalBounds(boundsMin, boundsMax);
+        prototypeSpheres[p] = glm::vec4((boundsMin + boundsMax) * 0.5f,
+                                        glm::length(boundsMax - boundsMin) * 0.5f * swayPadding);
+        prototypeExtents[p] = (boundsMax - boundsMin) * 0.5f * swayPadding;
+    }
+
+    // Frustum cull and pick a leaf band, remembering each survivor's bucket
+    glm::vec4 planes[6];
+    ExtractFrustumPlanes(projection * view, planes);
+    glm::vec3 cameraPosition = glm::vec3(glm::inverse(view)[3]);
+    float bandStart = glm::max(settings.leafBandStart, 1e-3f);
+
+    int bucketCount = prototypeCount * bandSlots;
+    std::vector<int> bucketOffsets(bucketCount + 1, 0);
+    sortKeys.clear();
+    visibleData.clear();
+    // Level of a placement at a distance, bands then the impostor slot
+    auto levelAt = [&](float distance, bool impostorReady) {
+        if (impostorReady && distance > settings.impostorDistance) return bandCount;
+        if (distance <= bandStart) return 0;
+        return glm::min(bandCount - 1, 1 + (int)std::floor(std::log2(distance / bandStart)));
+    };
+    auto emit = [&](const ForestInstance& instance, int slot, const glm::vec4& fade) {
+        int bucket = instance.prototype * bandSlots + slot;
+        bucketOffsets[bucket + 1]++;
+        sortKeys.push_back(bucket);
+
+        ForestInstanceData data;
+        data.positionScale = glm::vec4(instance.position, instance.scale);
+        data.tintYaw = glm::vec4(instance.tint, instance.yaw);
+        data.lodFade = fade;
+        visibleData.push_back(data);
+    };
+
+    // Levels are band indices, they mean something else once the bands change
+    if (lod.GetCount() != instances.size() || lodBandCount != bandCount) {
+        lod.Reset(instances.size());
+        lodBandCount = bandCount;
+    }
+    lod.BeginFrame();
+    float hysteresis = glm::clamp(settings.lodTransitions.hysteresis, 0.0f, 0.9f);
+    for (size_t i = 0; i < instances.size(); i++) {
+        const ForestInstance& instance = instances[i];
+        if (instance.prototype < 0 || instance.prototype >= prototypeCount) continue;
+
+        const glm::vec4& sphere = prototypeSpheres[instance.prototype];
+        float c = std::cos(instance.yaw), s = std::sin(instance.yaw);
+        glm::vec3 localCenter = glm::vec3(sphere) * instance.scale;
+        glm::vec3 center = instance.position + glm::vec3(c * localCenter.x + s * localCenter.z,
+                                                         localCenter.y,
+                                                         -s * localCenter.x + c * localCenter.z);
+        float radius = sphere.w * instance.scale;
+
+        bool visible = true;
+        for (const auto& plane : planes) {
+            if (glm::dot(glm::vec3(plane), center) + plane.w < -radius) {
+                visible = false;
+                break;
+            }
+        }
+        if (!visible) continue;
+        if (occlusion) {
+            // World box of the yawed local box
+            const glm::vec3& localExtent = prototypeExtents[instance.prototype];
+            glm::vec3 extent = instance.scale * glm::vec3(std::abs(c) * localExtent.x + std::abs(s) * localExtent.z,
+                                                          localExtent.y,
+                                                          std::abs(s) * localExtent.x + std::abs(c) * localExtent.z);
+            if (occlusion->IsOccluded(center - extent, center + extent)) {
+                occludedInstanceCount++;
+                continue;
+            }
+        }
+
+        float distance = glm::length(center - cameraPosition) * instance.lodBias;
+        bool ready = impostorReady[instance.prototype] != 0;
+        if (impostors && !ready && distance > settings.impostorDistance && impostorWanted < 0) {
+            // Stays geometry until its impostor is baked
+            impostorWanted = instance.prototype;
+        }
+        const LodState& state = lod.Select(i, levelAt(distance, ready), levelAt(distance * (1.0f - hysteresis), ready),
+                                           levelAt(distance * (1.0f + hysteresis), ready), settings.lodTransitions);
+
+        visibleInstanceCount++;
+        if (state.level == bandCount) impostorInstanceCount++;
+        if (state.fade >= 1.0f) {
+            emit(instance, state.level, LodOpaque());
+            continue;
+        }
+
+        // Both levels while it cross-fades, an impostor that went stale is dropped
+        fadingInstanceCount++;
+        if (state.level == bandCount || state.previous == bandCount) {
+            emit(instance, state.level, LodFadeIn(state.fade));
+            if (state.previous != bandCount || ready) {
+                emit(instance, state.previous, LodFadeOut(state.fade));
+            }
+            continue;
+        }
+
+        // Every band has the same branches, so between bands only the leaves
+        // fade. The incoming copy keeps its branches opaque, z = 1 tells
+        // tree.shader, and the outgoing one draws no branches at all.
+        glm::vec4 fadeIn = LodFadeIn(state.fade);
+        fadeIn.z = 1.0f;
+        emit(instance, state.level, fadeIn);
+        emit(instance, bandCount + 1 + state.previous, LodFadeOut(state.fade));
+    }
+
+    if (visibleData.empty()) return;
+
+    // Counting sort into prototype-major, band-minor runs
+    for (int bucket = 0; bucket < bucketCount; bucket++) {
+        bucketOffsets[bucket + 1] += bucketOffsets[bucket];
+    }
+    std::vector<ForestInstanceData> bucketed(visibleData.size());
+    std::vector<int> cursor(bucketOffsets.begin(), bucketOffsets.end() - 1);
+    for (size_t i = 0; i < visibleData.size(); i++) {
+        bucketed[cursor[sortKeys[i]]++] = visibleData[i];
+    }
+    visibleData.swap(bucketed);
+
+    for (int bucket = 0; bucket < bucketCount; bucket++) {
+        int count = bucketOffsets[bucket + 1] - bucketOffsets[bucket];
+        if (count > 0) {
+            int slot = bucket % bandSlots;
+            bool leavesOnly = slot > bandCount;
+            int band = leavesOnly ? slot - bandCount - 1 : slot;
+            batches.push_back({ bucket / bandSlots, band, bucketOffsets[bucket], count, slot == bandCount, leavesOnly });
+        }
+    }
+
+    // Orphan and refill, the previous frame's draws may still be reading it
+    glBindBuffer(GL_TEXTURE_BUFFER, placementBuffer);
+    placementCapacity = glm::max(placementCapacity, visibleData.size());
+    glBufferData(GL_TEXTURE_BUFFER, placementCapacity * sizeof(ForestInstanceData), nullptr, GL_STREAM_DRAW);
+    glBufferSubData(GL_TEXTURE_BUFFER, 0, visibleData.size() * sizeof(ForestInstanceData), visibleData.data());
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+    drawCallCount += DrawBatches(treeShader, leafShader, view, projection,
+                                 bandCount, renderLeaves ? bandCount : 0, drawnLeafCount);
+    // Fading placements can leave impostor runs with no impostor placement counted
+    if (std::any_of(batches.begin(), batches.end(), [](const Batch& run) { return run.impostor; })) {
+        DrawImpostors(view, projection);
+    }
+
+    // Bake a missing impostor once a placement needs it, if no other forest
+    // has used up this frame's bake
+    if (impostorWanted >= 0 && TreeImpostor::TakeBake()) {
+        prototypeImpostors[impostorWanted]->Bake(*prototypes[impostorWanted], treeShader, leafShader, settings.impostor);
+    }
+}
+
+void Forest::RenderOccluders(Shader& treeShader, Shader& leafShader, const glm::mat4& view,
+                             const glm::mat4& projection) {
+    if (!initialized || batches.empty()) return;
+
+    // Branches of the near bands stand in for trunks, only the nearest band
+    // adds its leaves. The placement buffer still holds this frame's runs.
+    unsigned long long leafCount = 0;
+    int occluderBands = glm::max(settings.occluderBands, 0);
+    DrawBatches(treeShader, leafShader, view, projection, occluderBands, glm::min(occluderBands, 1), leafCount);
+}
+
+int Forest::DrawBatches(Shader& treeShader, Shader& leafShader, const glm::mat4& view, const glm::mat4& projection,
+                        int branchBands, int leafBands, unsigned long long& leafCount) {
+    int drawCalls = 0;
+    glActiveTexture(GL_TEXTURE3);
+    glBindTexture(GL_TEXTURE_BUFFER, placementTexture);
+    glActiveTexture(GL_TEXTURE0);
+
+    // Chunk commands of every prototype, each covering its placements across
+    // the drawn bands, which are adjacent in the buffer and start it
+    branchCommands.clear();
+    Tree* firstPrototype = nullptr;
+    size_t batch = 0;
+    while (batch < batches.size()) {
+        int prototype = batches[batch].prototype;
+        int first = batches[batch].first;
+        int count = 0;
+        for (; batch < batches.size() && batches[batch].prototype == prototype; batch++) {
+            const Batch& run = batches[batch];
+            if (!run.impostor && !run.leavesOnly && run.band < branchBands) count += run.count;
+        }
+        if (count == 0) continue;
+        prototypes[prototype]->AppendBranchCommands(first, count, branchCommands);
+        if (!firstPrototype) firstPrototype = prototypes[prototype].get();
+    }
+
+    // Wind settings are the same for all prototypes, any of them sets them up
+    if (firstPrototype) {
+        treeShader.Bind();
+        treeShader.setUniformMat4f("u_View", view);
+        treeShader.setUniformMat4f("u_Projection", projection);
+        firstPrototype->ApplyInstancedBranchUniforms(treeShader);
+        drawCalls += GeometryHeap::Get().DrawBranches(branchCommands, placementBuffer, sizeof(ForestInstanceData));
+        treeShader.Unbind();
+    }
+
+    if (leafBands <= 0) return drawCalls;
+
+    // One leaf draw per prototype and occupied band, all from the heap's leaves
+    leafShader.Bind();
+    leafShader.setUniformMat4f("u_View", view);
+    leafShader.setUniformMat4f("u_Projection", projection);
+    glActiveTexture(GL_TEXTURE4);
+    glBindTexture(GL_TEXTURE_BUFFER, GeometryHeap::Get().GetLeafTexture());
+    glActiveTexture(GL_TEXTURE0);
+    glBindVertexArray(emptyVAO);
+    for (const auto& run : batches) {
+        if (run.impostor || run.band >= leafBands) continue;
+        const PrototypeLeaves& leaves = prototypeLeaves[run.prototype];
+        float fraction = BandLeafFraction(run.band);
+        unsigned int bandLeaves = BandLeafCount(leaves, fraction);
+        if (bandLeaves == 0) continue;
+
+        leafShader.SetUniform1i("u_ForestLeafBase", leaves.range.offset);
+
+        // Survivors grow by 1/sqrt(fraction) to cover the thinned canopy
+        prototypes[run.prototype]->RenderLeavesInstanced(leafShader, bandLeaves, 1.0f / std::sqrt(fraction),
+                                                         run.first, run.count);
+        drawCalls++;
+        leafCount += (unsigned long long)bandLeaves * run.count;
+    }
+    glBindVertexArray(0);
+    leafShader.Unbind();
+    return drawCalls;
+}
+
+void Forest::DrawImpostors(const glm::mat4& view, const glm::mat4& projection) {
+    // The placement buffer texture is still on unit 3 from DrawBatches
+    glm::vec3 cameraPosition = glm::vec3(glm::inverse(view)[3]);
+    glm::vec3 lightDir = prototypes.front()->GetSunDirection();
+    impostorShader->Bind();
+    impostorShader->setUniformMat4f("u_View", view);
+    impostorShader->setUniformMat4f("u_Projection", projection);
+    impostorShader->SetUniform3f("u_CameraPos", cameraPosition.x, cameraPosition.y, cameraPosition.z);
+    impostorShader->SetUniform3f("u_LightDir", lightDir.x, lightDir.y, lightDir.z);
+    impostorShader->SetUniform1i("u_ForestInstances", 3);
+
+    // The quads face the camera, whichever way they wind
+    GLboolean cullFace = glIsEnabled(GL_CULL_FACE);
+    glDisable(GL_CULL_FACE);
+    glBindVertexArray(emptyVAO);
+    for (const auto& run : batches) {
+        if (!run.impostor) continue;
+        prototypeImpostors[run.prototype]->Apply(*impostorShader);
+        impostorShader->SetUniform1i("u_ForestBase", run.first);
+        glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, run.count);
+        drawCallCount++;
+    }
+    glBindVertexArray(0);
+    if (cullFace) glEnable(GL_CULL_FACE);
+    impostorShader->Unbind();
+}
@@ -0,0 +1,167 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <functional>
+#include <memory>
+#include <vector>
+#include "Shader.h"
+#include "Tree.h"
+#include "TreeImpostor.h"
+#include "LodTransitions.h"
+
+// One placed copy of a prototype tree
+struct ForestInstance {
+    glm::vec3 position = glm::vec3(0.0f);
+    float yaw = 0.0f;                   // Radians around +Y
+    float scale = 1.0f;                 // Uniform only, normals are not re-normalized per axis
+    glm::vec3 tint = glm::vec3(1.0f);   // Multiplies bark and leaf color
+    float lodBias = 1.0f;               // Scales the distance leaf bands are picked by
+    int prototype = 0;
+};
+
+// A placement as tree.shader reads it, three vec4 instance attributes, and
+// leaf.shader and impostor.shader read it, three RGBA32F texels
+struct ForestInstanceData {
+    glm::vec4 positionScale;
+    glm::vec4 tintYaw;
+    glm::vec4 lodFade;  // Screen-door dither of a cross-fading copy, see LodFadeIn. z is 1 when only its leaves fade.
+};
+static_assert(sizeof(ForestInstanceData) == 48, "LoadPlacement reads three texels per placement");
+
+struct ForestSettings {
+    float leafBandStart = 30.0f;    // Distance where the first leaf band starts thinning
+    int bandCount = 5;              // Every band doubles the distance of the previous one
+    float minLeafFraction = 0.02f;  // Leaves a prototype keeps in the last band
+    int occluderBands = 2;          // Bands whose branches go into the Hi-Z pass, the first with leaves
+    float impostorDistance = 300.0f;  // Placements past it draw as impostors, 0 turns them off
+    ImpostorSettings impostor;
+    LodTransitionSettings lodTransitions;
+};
+
+// Draws many placements of a few prototype trees. Prototypes are ordinary
+// Trees generated in local space, placements carry only a transform, a tint
+// and an LOD bias.
+// Each frame the placements are frustum culled as spheres, tested against the
+// Hi-Z depth of earlier frames when occlusion is set, sorted by
+// prototype and leaf band, and uploaded to one buffer. The branches of every
+// prototype then go out together as one multi-draw from the geometry heap
+// (see GeometryHeap.h), the leaves once per prototype and occupied band.
+// Leaf bands replace the per-cluster pruning of a single tree. A copy of the
+// prototype's packed leaves is sorted by rank, the leaf's place in its
+// cluster, so any prefix of it thins every cluster evenly. A band draws that
+// prefix for each placement and grows the cards to keep the canopy area.
+// Past impostorDistance a placement is one quad of its prototype's
+// TreeImpostor instead, one instanced draw per prototype. Prototypes are
+// baked lazily, at most one per frame, and keep their geometry until then.
+// Bands and impostors are levels of one LodTransitions entry per placement,
+// so switching waits out a hysteresis margin and then cross-fades: for a few
+// frames the placement goes into both runs, dithered complementarily. Bands
+// share their branches, so a fade between two bands draws them once.
+class Forest {
+public:
+    Forest();
+    ~Forest();
+
+    void Init();
+    void Clean();
+
+    // The forest owns its prototypes. Configure and Generate them like the
+    // single tree, leaf buffers follow every regeneration.
+    Tree* AddPrototype();
+    // Adopts a prototype generated without a GL context, e.g. on a worker
+    // thread, and initializes it
+    Tree* AddPrototype(std::unique_ptr<Tree> prototype);
+    void ClearPrototypes();
+    int GetPrototypeCount() const { return prototypes.size(); }
+    Tree* GetPrototype(int index) { return prototypes[index].get(); }
+    void ForEachPrototype(const std::function<void(Tree&)>& function);
+
+    void SetInstances(const std::vector<ForestInstance>& instances) {
+        this->instances = instances;
+        lod.Reset(instances.size());
+    }
+    const std::vector<ForestInstance>& GetInstances() const { return instances; }
+    void SetSettings(const ForestSettings& settings) { this->settings = settings; }
+    void SetImpostorShader(Shader* impostorShader) { this->impostorShader = impostorShader; }
+
+    void Render(Shader& treeShader, Shader& leafShader, const glm::mat4& view,
+                const glm::mat4& projection, bool renderLeaves = true);
+    // Draws the near bands of the last Render into an active HiZOcclusion pass
+    void RenderOccluders(Shader& treeShader, Shader& leafShader, const glm::mat4& view,
+                         const glm::mat4& projection);
+    // Hi-Z depth placements are tested against, null to skip
+    void SetOcclusion(const HiZOcclusion* occlusion) { this->occlusion = occlusion; }
+
+    // Statistics of the last frame
+    int GetVisibleInstanceCount() const { return visibleInstanceCount; }
+    int GetOccludedInstanceCount() const { return occludedInstanceCount; }
+    int GetImpostorInstanceCount() const { return impostorInstanceCount; }
+    int GetFadingInstanceCount() const { return fadingInstanceCount; }
+    int GetDrawCallCount() const { return drawCallCount; }
+    unsigned long long GetDrawnLeafCount() const { return drawnLeafCount; }
+    
+    // Approximate footprint of the prototypes and forest buffers
+    size_t GetGpuMemoryBytes() const;
+    size_t GetCpuMemoryBytes() const;
+
+private:
+    // Rank-sorted leaves of one prototype in the geometry heap, read by
+    // leaf.shader from unit 4
+    struct PrototypeLeaves {
+        HeapRange range;
+        unsigned int revision = 0;
+        bool built = false;
+        unsigned int count = 0;
+        unsigned int rankPrefix[257] = {};  // Leaves with a rank below the index
+    };
+
+    // A run of visible placements sharing a prototype and a leaf band, or
+    // its impostors, which come after all of the prototype's bands. The
+    // outgoing copies of band-to-band fades come last and skip branches.
+    struct Batch {
+        int prototype;
+        int band;
+        int first;
+        int count;
+        bool impostor;
+        bool leavesOnly;
+    };
+
+    void UpdatePrototypeLeaves(int prototype);
+    bool IsImpostorCurrent(int prototype) const;
+    void DrawImpostors(const glm::mat4& view, const glm::mat4& projection);
+    float BandLeafFraction(int band) const;
+    unsigned int BandLeafCount(const PrototypeLeaves& leaves, float fraction) const;
+    // Branches of batches below branchBands, leaves of those below leafBands.
+    // Returns the number of draw calls.
+    int DrawBatches(Shader& treeShader, Shader& leafShader, const glm::mat4& view, const glm::mat4& projection,
+                    int branchBands, int leafBands, unsigned long long& leafCount);
+
+    bool initialized;
+    std::vector<std::unique_ptr<Tree>> prototypes;
+    std::vector<PrototypeLeaves> prototypeLeaves;
+    std::vector<std::unique_ptr<TreeImpostor>> prototypeImpostors;
+    std::vector<ForestInstance> instances;
+    ForestSettings settings;
+    const HiZOcclusion* occlusion;
+    Shader* impostorShader;
+    LodTransitions lod;
+    int lodBandCount;  // Band count the levels in lod were picked with
+
+    // Visible placements of the current frame, bucketed into batches
+    std::vector<ForestInstanceData> visibleData;
+    std::vector<unsigned int> sortKeys;
+    std::vector<Batch> batches;
+    std::vector<DrawElementsIndirectCommand> branchCommands;
+    GLuint placementBuffer, placementTexture;
+    size_t placementCapacity;
+    GLuint emptyVAO;  // Leaves are fetched from buffer textures, not attributes
+
+    int visibleInstanceCount;
+    int occludedInstanceCount;
+    int impostorInstanceCount;
+    int fadingInstanceCount;
+    int drawCallCount;
+    unsigned long long drawnLeafCount;
+};
@@ -0,0 +1,297 @@
+#include "ForestStreamer.h"
+#include "PoissonDisk.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <glm/gtc/constants.hpp>
+
+ForestStreamer::ForestStreamer()
+    : occlusion(nullptr), impostorShader(nullptr), running(false),
+      cameraTile(0, 0), cameraPosition(0.0f), frame(0),
+      stopping(false),
+      pendingTileCount(0), visibleTreeCount(0), occludedTreeCount(0), impostorTreeCount(0),
+      gpuBytes(0), cpuBytes(0), evictionCount(0) {
+}
+
+ForestStreamer::~ForestStreamer() {
+    Stop();
+}
+
+void ForestStreamer::Start(const ForestStreamSettings& settings, const ForestPrototypeBuilder& builder) {
+    Stop();
+
+    this->settings = settings;
+    this->builder = builder;
+    stopping = false;
+    running = true;
+    frame = 0;
+
+    int workerCount = std::max(settings.workerCount, 1);
+    for (int i = 0; i < workerCount; i++) {
+        workers.emplace_back(&ForestStreamer::WorkerLoop, this);
+    }
+    std::cout << "Forest streaming started with " << workerCount << " workers" << std::endl;
+}
+
+void ForestStreamer::Stop() {
+    if (!running) return;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+        queue.clear();
+    }
+    wake.notify_all();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    workers.clear();
+
+    // Forests release their GL objects, unadopted prototypes never had any
+    finished.clear();
+    tiles.clear();
+    pendingTileCount = 0;
+    visibleTreeCount = 0;
+    gpuBytes = cpuBytes = 0;
+    running = false;
+}
+
+unsigned int ForestStreamer::TileSeed(const TileCoord& coord) const {
+    unsigned int hash = settings.worldSeed;
+    hash ^= (unsigned int)coord.first * 0x8da6b343u;
+    hash ^= (unsigned int)coord.second * 0xd8163841u;
+    hash = (hash ^ (hash >> 16)) * 0x45d9f3bu;
+    hash = (hash ^ (hash >> 16)) * 0x45d9f3bu;
+    return hash ^ (hash >> 16);
+}
+
+bool ForestStreamer::InRange(const TileCoord& coord, int radius) const {
+    return std::abs(coord.first - cameraTile.first) <= radius &&
+           std::abs(coord.second - cameraTile.second) <= radius;
+}
+
+ForestStreamer::GeneratedTile ForestStreamer::GenerateTile(const TileCoord& coord) const {
+    GeneratedTile tile;
+    tile.coord = coord;
+    unsigned int seed = TileSeed(coord);
+
+    int prototypeCount = std::max(settings.prototypesPerTile, 1);
+    for (int i = 0; i < prototypeCount; i++) {
+        unsigned int prototypeSeed = seed + 0x9e3779b9u * (unsigned int)(i + 1);
+        auto prototype = std::make_unique<Tree>();
+        prototype->SetSeed(prototypeSeed);
+        builder(*prototype, prototypeSeed);
+        tile.prototypes.push_back(std::move(prototype));
+    }
+
+    // Every prototype is a species spaced by its own crown
+    std::vector<PoissonSpecies> species(prototypeCount);
+    for (int i = 0; i < prototypeCount; i++) {
+        species[i].radius = glm::max(tile.prototypes[i]->GetCrownRadius(), 0.5f) * settings.crownSpacing;
+    }
+    float maxRadius = 0.0f;
+    for (const auto& kind : species) {
+        maxRadius = glm::max(maxRadius, kind.radius);
+    }
+
+    // Tiles are sampled alone, inset by half the largest spacing on every side
+    // so trees of adjacent tiles keep it too, unless crowns outgrow the tile
+    glm::vec2 origin = glm::vec2(coord.first, coord.second) * settings.tileSize;
+    glm::vec2 inset = glm::vec2(glm::min(maxRadius * 0.5f, settings.tileSize * 0.25f));
+    std::vector<PoissonSample> samples;
+    SamplePoissonDiskRect(origin + inset, origin + glm::vec2(settings.tileSize) - inset, species, seed,
+                          std::vector<PoissonSample>(), nullptr, PoissonDiskSettings(), samples);
+
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    tile.instances.resize(samples.size());
+    for (size_t i = 0; i < samples.size(); i++) {
+        ForestInstance& instance = tile.instances[i];
+        instance.position = glm::vec3(samples[i].position.x, 0.0f, samples[i].position.y);
+        instance.yaw = unit(rng) * glm::two_pi<float>();
+        instance.scale = glm::mix(0.8f, 1.2f, unit(rng));
+        instance.tint = glm::vec3(glm::mix(0.85f, 1.1f, unit(rng)), glm::mix(0.9f, 1.1f, unit(rng)), glm::mix(0.85f, 1.0f, unit(rng)));
+        instance.lodBias = glm::mix(0.9f, 1.1f, unit(rng));
+        instance.prototype = samples[i].species;
+    }
+    return tile;
+}
+
+void ForestStreamer::WorkerLoop() {
+    while (true) {
+        TileCoord coord;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [this] { return stopping || !queue.empty(); });
+            if (stopping) return;
+            coord = queue.back();
+            queue.pop_back();
+        }
+
+        GeneratedTile tile = GenerateTile(coord);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        finished.push_back(std::move(tile));
+    }
+}
+
+void ForestStreamer::Update(const glm::vec3& cameraPosition) {
+    if (!running) return;
+    frame++;
+
+    this->cameraPosition = cameraPosition;
+    cameraTile = TileCoord((int)std::floor(cameraPosition.x / settings.tileSize),
+                           (int)std::floor(cameraPosition.z / settings.tileSize));
+    int radius = std::max(settings.loadRadius, 0);
+
+    // Touch the tiles in range, unknown ones are queued
+    std::vector<TileCoord> entering;
+    for (int dz = -radius; dz <= radius; dz++) {
+        for (int dx = -radius; dx <= radius; dx++) {
+            TileCoord coord(cameraTile.first + dx, cameraTile.second + dz);
+            auto found = tiles.find(coord);
+            if (found == tiles.end()) {
+                tiles[coord].lastUsedFrame = frame;
+                entering.push_back(coord);
+                pendingTileCount++;
+            } else {
+                found->second.lastUsedFrame = frame;
+            }
+        }
+    }
+
+    auto tileDistance = [this](const TileCoord& coord) {
+        glm::vec2 center = (glm::vec2(coord.first, coord.second) + 0.5f) * settings.tileSize;
+        glm::vec2 offset = center - glm::vec2(this->cameraPosition.x, this->cameraPosition.z);
+        return glm::dot(offset, offset);
+    };
+
+    std::vector<GeneratedTile> ready;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        queue.insert(queue.end(), entering.begin(), entering.end());
+
+        // Tiles that left range before a worker took them are forgotten
+        auto left = std::remove_if(queue.begin(), queue.end(), [&](const TileCoord& coord) {
+            if (InRange(coord, radius)) return false;
+            tiles.erase(coord);
+            pendingTileCount--;
+            return true;
+        });
+        queue.erase(left, queue.end());
+
+        // Workers pop from the back, so the nearest tile goes last
+        std::sort(queue.begin(), queue.end(), [&](const TileCoord& a, const TileCoord& b) {
+            return tileDistance(a) > tileDistance(b);
+        });
+        ready.swap(finished);
+    }
+    if (!entering.empty()) {
+        wake.notify_all();
+    }
+
+    // Adopt generated tiles, the uploads are what limits this
+    std::sort(ready.begin(), ready.end(), [&](const GeneratedTile& a, const GeneratedTile& b) {
+        return tileDistance(a.coord) < tileDistance(b.coord);
+    });
+    int uploads = 0;
+    std::vector<GeneratedTile> deferred;
+    for (auto& generated : ready) {
+        if (!InRange(generated.coord, radius)) {
+            tiles.erase(generated.coord);
+            pendingTileCount--;
+            continue;
+        }
+        if (uploads >= settings.maxUploadsPerFrame) {
+            deferred.push_back(std::move(generated));
+            continue;
+        }
+
+        ForestTile& tile = tiles[generated.coord];
+        tile.forest = std::make_unique<Forest>();
+        tile.forest->Init();
+        for (auto& prototype : generated.prototypes) {
+            tile.forest->AddPrototype(std::move(prototype));
+        }
+        tile.forest->SetInstances(generated.instances);
+        tile.resident = true;
+        pendingTileCount--;
+        uploads++;
+    }
+    if (!deferred.empty()) {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto& generated : deferred) {
+            finished.push_back(std::move(generated));
+        }
+    }
+
+    EvictToBudget();
+}
+
+void ForestStreamer::EvictToBudget() {
+    gpuBytes = cpuBytes = 0;
+    for (auto& entry : tiles) {
+        ForestTile& tile = entry.second;
+        if (!tile.resident) continue;
+        tile.gpuBytes = tile.forest->GetGpuMemoryBytes();
+        tile.cpuBytes = tile.forest->GetCpuMemoryBytes();
+        gpuBytes += tile.gpuBytes;
+        cpuBytes += tile.cpuBytes;
+    }
+
+    while (gpuBytes > settings.gpuBudgetBytes || cpuBytes > settings.cpuBudgetBytes) {
+        // Least recently used among the tiles out of range
+        auto victim = tiles.end();
+        for (auto it = tiles.begin(); it != tiles.end(); ++it) {
+            const ForestTile& tile = it->second;
+            if (!tile.resident || tile.lastUsedFrame == frame) continue;
+            if (victim == tiles.end() || tile.lastUsedFrame < victim->second.lastUsedFrame) {
+                victim = it;
+            }
+        }
+        if (victim == tiles.end()) break;  // Only tiles in range are left
+
+        gpuBytes -= victim->second.gpuBytes;
+        cpuBytes -= victim->second.cpuBytes;
+        tiles.erase(victim);
+        evictionCount++;
+    }
+}
+
+void ForestStreamer::Render(Shader& treeShader, Shader& leafShader, const glm::mat4& view,
+                            const glm::mat4& projection, bool renderLeaves) {
+    visibleTreeCount = 0;
+    occludedTreeCount = 0;
+    impostorTreeCount = 0;
+    for (auto& entry : tiles) {
+        ForestTile& tile = entry.second;
+        if (!tile.resident || tile.lastUsedFrame != frame) continue;
+
+        tile.forest->SetSettings(forestSettings);
+        tile.forest->SetOcclusion(occlusion);
+        tile.forest->SetImpostorShader(impostorShader);
+        tile.forest->Render(treeShader, leafShader, view, projection, renderLeaves);
+        visibleTreeCount += tile.forest->GetVisibleInstanceCount();
+        occludedTreeCount += tile.forest->GetOccludedInstanceCount();
+        impostorTreeCount += tile.forest->GetImpostorInstanceCount();
+    }
+}
+
+void ForestStreamer::RenderOccluders(Shader& treeShader, Shader& leafShader, const glm::mat4& view,
+                                     const glm::mat4& projection) {
+    for (auto& entry : tiles) {
+        ForestTile& tile = entry.second;
+        if (!tile.resident || tile.lastUsedFrame != frame) continue;
+        tile.forest->RenderOccluders(treeShader, leafShader, view, projection);
+    }
+}
+
+void ForestStreamer::ForEachPrototype(const std::function<void(Tree&)>& function) {
+    for (auto& entry : tiles) {
+        if (entry.second.resident) {
+            entry.second.forest->ForEachPrototype(function);
+        }
+    }
+}
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "Shader.h"
+#include "Forest.h"
+
+struct ForestStreamSettings {
+    float tileSize = 64.0f;
+    int loadRadius = 3;               // Tiles kept around the camera's tile, in tiles
+    float crownSpacing = 1.2f;        // Minimum distance between trunks, in crown radii
+    int prototypesPerTile = 2;
+    unsigned int worldSeed = 1337;
+    int workerCount = 2;
+    int maxUploadsPerFrame = 1;       // Generated tiles handed to the GPU per Update
+    size_t gpuBudgetBytes = 512ull << 20;
+    size_t cpuBudgetBytes = 1024ull << 20;
+};
+
+// Configures and generates one prototype. Called on worker threads with a
+// tree that has no GL objects yet and a seed already applied through
+// Tree::SetSeed, so it must only read state that outlives the streamer.
+using ForestPrototypeBuilder = std::function<void(Tree& prototype, unsigned int seed)>;
+
+// Streams square forest tiles around the camera. Every tile is a Forest with
+// its own prototypes and Poisson-disk placements, all derived from the tile
+// coordinates, so a tile that is evicted and loaded again looks the same.
+// - Tiles entering range are queued, and workers take the nearest one first.
+//   A worker runs Tree::Generate for the tile's prototypes and scatters its
+//   placements, all without touching GL.
+// - Update adopts finished tiles on the render thread, a few per frame, since
+//   that is where the GPU uploads happen.
+// - Tiles leaving range stay cached until the GPU or CPU budget is exceeded,
+//   then the least recently used ones are dropped. Tiles in range are never
+//   evicted, the budgets only bound the cache.
+class ForestStreamer {
+public:
+    ForestStreamer();
+    ~ForestStreamer();
+
+    // Starts the workers. The builder and settings apply until Stop.
+    void Start(const ForestStreamSettings& settings, const ForestPrototypeBuilder& builder);
+    // Joins the workers, waiting for tiles being generated, and drops every tile
+    void Stop();
+    bool IsRunning() const { return running; }
+
+    // Render thread: queues tiles entering range, adopts generated ones and evicts
+    void Update(const glm::vec3& cameraPosition);
+    void Render(Shader& treeShader, Shader& leafShader, const glm::mat4& view,
+                const glm::mat4& projection, bool renderLeaves = true);
+    // Near bands of the tiles drawn this frame, see Forest::RenderOccluders
+    void RenderOccluders(Shader& treeShader, Shader& leafShader, const glm::mat4& view,
+                         const glm::mat4& projection);
+    void SetOcclusion(const HiZOcclusion* occlusion) { this->occlusion = occlusion; }
+    void SetImpostorShader(Shader* impostorShader) { this->impostorShader = impostorShader; }
+
+    // Per-frame state of every resident prototype, such as wind
+    void ForEachPrototype(const std::function<void(Tree&)>& function);
+    void SetForestSettings(const ForestSettings& settings) { forestSettings = settings; }
+
+    // Statistics
+    int GetResidentTileCount() const { return tiles.size() - pendingTileCount; }
+    int GetPendingTileCount() const { return pendingTileCount; }
+    int GetVisibleTreeCount() const { return visibleTreeCount; }
+    int GetOccludedTreeCount() const { return occludedTreeCount; }
+    int GetImpostorTreeCount() const { return impostorTreeCount; }
+    size_t GetGpuMemoryBytes() const { return gpuBytes; }
+    size_t GetCpuMemoryBytes() const { return cpuBytes; }
+    int GetEvictionCount() const { return evictionCount; }
+
+private:
+    typedef std::pair<int, int> TileCoord;
+
+    struct ForestTile {
+        bool resident = false;            // Otherwise queued or being generated
+        std::unique_ptr<Forest> forest;
+        size_t gpuBytes = 0;
+        size_t cpuBytes = 0;
+        unsigned long long lastUsedFrame = 0;
+    };
+
+    // Output of a worker, adopted on the render thread
+    struct GeneratedTile {
+        TileCoord coord;
+        std::vector<std::unique_ptr<Tree>> prototypes;
+        std::vector<ForestInstance> instances;
+    };
+
+    void WorkerLoop();
+    GeneratedTile GenerateTile(const TileCoord& coord) const;
+    unsigned int TileSeed(const TileCoord& coord) const;
+    bool InRange(const TileCoord& coord, int radius) const;
+    void EvictToBudget();
+
+    ForestStreamSettings settings;
+    ForestSettings forestSettings;
+    const HiZOcclusion* occlusion;
+    Shader* impostorShader;
+    ForestPrototypeBuilder builder;
+    bool running;
+
+    std::map<TileCoord, ForestTile> tiles;
+    TileCoord cameraTile;
+    glm::vec3 cameraPosition;
+    unsigned long long frame;
+
+    // Shared with the workers, guarded by mutex
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::vector<TileCoord> queue;     // Nearest tile last
+    std::vector<GeneratedTile> finished;
+    bool stopping;
+    std::vector<std::thread> workers;
+
+    int pendingTileCount;
+    int visibleTreeCount;
+    int occludedTreeCount;
+    int impostorTreeCount;
+    size_t gpuBytes, cpuBytes;
+    int evictionCount;
+};
@@ -0,0 +1,279 @@
+#include "GeometryHeap.h"
+#include "Tree.h"
+#include <algorithm>
+#include <cstddef>
+#include <iostream>
+
+HeapBuffer::HeapBuffer()
+    : buffer(0), texture(0), textureFormat(GL_NONE), stride(0), capacity(0), usedCount(0) {
+}
+
+void HeapBuffer::Init(size_t stride, unsigned int initialCapacity, GLenum textureFormat) {
+    this->stride = stride;
+    this->textureFormat = textureFormat;
+    capacity = std::max(initialCapacity, 1u);
+    usedCount = 0;
+    freeRanges.clear();
+    freeRanges[0] = capacity;
+
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+    glBufferData(GL_COPY_WRITE_BUFFER, capacity * stride, nullptr, GL_STATIC_DRAW);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+    if (textureFormat != GL_NONE) {
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_BUFFER, texture);
+        glTexBuffer(GL_TEXTURE_BUFFER, textureFormat, buffer);
+        glBindTexture(GL_TEXTURE_BUFFER, 0);
+    }
+}
+
+void HeapBuffer::Clean() {
+    if (texture != 0) {
+        glDeleteTextures(1, &texture);
+        texture = 0;
+    }
+    if (buffer != 0) {
+        glDeleteBuffers(1, &buffer);
+        buffer = 0;
+    }
+    capacity = 0;
+    usedCount = 0;
+    freeRanges.clear();
+}
+
+HeapRange HeapBuffer::Allocate(unsigned int count) {
+    HeapRange range;
+    if (count == 0 || buffer == 0) return range;
+
+    auto fit = std::find_if(freeRanges.begin(), freeRanges.end(),
+                            [count](const std::pair<const unsigned int, unsigned int>& free) { return free.second >= count; });
+    if (fit == freeRanges.end()) {
+        Grow(capacity + count);
+        fit = std::find_if(freeRanges.begin(), freeRanges.end(),
+                           [count](const std::pair<const unsigned int, unsigned int>& free) { return free.second >= count; });
+    }
+
+    range.offset = fit->first;
+    range.count = count;
+    unsigned int remaining = fit->second - count;
+    freeRanges.erase(fit);
+    if (remaining > 0) {
+        freeRanges[range.offset + count] = remaining;
+    }
+    usedCount += count;
+    return range;
+}
+
+void HeapBuffer::Free(HeapRange& range) {
+    if (range.count == 0) return;
+    if (buffer != 0) {
+        auto inserted = freeRanges.emplace(range.offset, range.count).first;
+
+        // Merge with the free range after, then the one before
+        auto next = std::next(inserted);
+        if (next != freeRanges.end() && inserted->first + inserted->second == next->first) {
+            inserted->second += next->second;
+            freeRanges.erase(next);
+        }
+        if (inserted != freeRanges.begin()) {
+            auto previous = std::prev(inserted);
+            if (previous->first + previous->second == inserted->first) {
+                previous->second += inserted->second;
+                freeRanges.erase(inserted);
+            }
+        }
+        usedCount -= range.count;
+    }
+    range = HeapRange();
+}
+
+void HeapBuffer::Upload(const HeapRange& range, const void* data) {
+    if (range.count == 0 || buffer == 0) return;
+    glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, range.offset * stride, range.count * stride, data);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+void HeapBuffer::Grow(unsigned int minimumCapacity) {
+    unsigned int newCapacity = std::max(capacity * 2, minimumCapacity);
+
+    // Park the contents in a scratch buffer, then respecify the original
+    GLuint scratch;
+    glGenBuffers(1, &scratch);
+    glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, scratch);
+    glBufferData(GL_COPY_WRITE_BUFFER, capacity * stride, nullptr, GL_STREAM_COPY);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, capacity * stride);
+
+    glBindBuffer(GL_COPY_READ_BUFFER, scratch);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+    glBufferData(GL_COPY_WRITE_BUFFER, newCapacity * stride, nullptr, GL_STATIC_DRAW);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, capacity * stride);
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    glDeleteBuffers(1, &scratch);
+
+    // The texture's size was fixed when it was attached
+    if (texture != 0) {
+        glBindTexture(GL_TEXTURE_BUFFER, texture);
+        glTexBuffer(GL_TEXTURE_BUFFER, textureFormat, buffer);
+        glBindTexture(GL_TEXTURE_BUFFER, 0);
+    }
+
+    // The new tail is free, joined to a free range ending at the old capacity
+    unsigned int tailOffset = capacity;
+    unsigned int tailCount = newCapacity - capacity;
+    if (!freeRanges.empty()) {
+        auto last = std::prev(freeRanges.end());
+        if (last->first + last->second == capacity) {
+            tailOffset = last->first;
+            tailCount += last->second;
+            freeRanges.erase(last);
+        }
+    }
+    freeRanges[tailOffset] = tailCount;
+    capacity = newCapacity;
+}
+
+GeometryHeap& GeometryHeap::Get() {
+    static GeometryHeap heap;
+    return heap;
+}
+
+GeometryHeap::GeometryHeap()
+    : initialized(false), multiDrawIndirect(false),
+      branchVAO(0),
+      indirectBuffer(0), indirectCapacity(0) {
+}
+
+void GeometryHeap::Init() {
+    if (initialized) return;
+
+    // The commands carry a base instance, so plain ARB_multi_draw_indirect needs ARB_base_instance too
+    multiDrawIndirect = GLEW_VERSION_4_3 || (GLEW_ARB_multi_draw_indirect && GLEW_ARB_base_instance);
+    std::cout << "Geometry heap: " << (multiDrawIndirect ? "multi-draw indirect" : "base-vertex draw loop") << std::endl;
+
+    branchVertices.Init(sizeof(BranchVertex), 1 << 16);
+    branchIndices.Init(sizeof(unsigned short), 1 << 18);
+    leafInstances.Init(sizeof(PackedLeafInstance), 1 << 16, GL_RGBA32UI);
+    windBranches.Init(2 * sizeof(glm::vec4), 1 << 12, GL_RGBA32F);
+
+    glGenVertexArrays(1, &branchVAO);
+    glBindVertexArray(branchVAO);
+    glBindBuffer(GL_ARRAY_BUFFER, branchVertices.GetBuffer());
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(BranchVertex), (void*)offsetof(BranchVertex, position));
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(BranchVertex), (void*)offsetof(BranchVertex, normal));
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(BranchVertex), (void*)offsetof(BranchVertex, color));
+    glEnableVertexAttribArray(2);
+    glVertexAttribPointer(3, 1, GL_FLOAT, GL_FALSE, sizeof(BranchVertex), (void*)offsetof(BranchVertex, occlusion));
+    glEnableVertexAttribArray(3);
+    glVertexAttribIPointer(4, 1, GL_UNSIGNED_INT, sizeof(BranchVertex), (void*)offsetof(BranchVertex, windBranch));
+    glEnableVertexAttribArray(4);
+    glVertexAttribDivisor(5, 1);
+    glVertexAttribDivisor(6, 1);
+    glVertexAttribDivisor(7, 1);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, branchIndices.GetBuffer());
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    glGenBuffers(1, &indirectBuffer);
+    indirectCapacity = 0;
+    initialized = true;
+}
+
+void GeometryHeap::Clean() {
+    if (!initialized) return;
+
+    glDeleteVertexArrays(1, &branchVAO);
+    glDeleteBuffers(1, &indirectBuffer);
+    branchVertices.Clean();
+    branchIndices.Clean();
+    leafInstances.Clean();
+    windBranches.Clean();
+    indirectCapacity = 0;
+    initialized = false;
+}
+
+void GeometryHeap::SetInstanceAttributes(GLuint instanceBuffer, GLsizei instanceStride, GLintptr baseOffset) {
+    // Expects branchVAO bound. Disabled attributes read as (0, 0, 0, 1).
+    if (instanceBuffer == 0) {
+        glDisableVertexAttribArray(5);
+        glDisableVertexAttribArray(6);
+        glDisableVertexAttribArray(7);
+        return;
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+    glVertexAttribPointer(5, 4, GL_FLOAT, GL_FALSE, instanceStride, (void*)baseOffset);
+    glEnableVertexAttribArray(5);
+    glVertexAttribPointer(6, 4, GL_FLOAT, GL_FALSE, instanceStride, (void*)(baseOffset + sizeof(glm::vec4)));
+    glEnableVertexAttribArray(6);
+    glVertexAttribPointer(7, 4, GL_FLOAT, GL_FALSE, instanceStride, (void*)(baseOffset + 2 * sizeof(glm::vec4)));
+    glEnableVertexAttribArray(7);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+int GeometryHeap::DrawBranches(const std::vector<DrawElementsIndirectCommand>& commands,
+                               GLuint instanceBuffer, GLsizei instanceStride) {
+    if (!initialized || commands.empty()) return 0;
+
+    // Enable polygon offset to reduce Z-fighting
+    glEnable(GL_POLYGON_OFFSET_FILL);
+    glPolygonOffset(1.0f, 1.0f);
+    glBindVertexArray(branchVAO);
+
+    int drawCalls = 0;
+    if (multiDrawIndirect) {
+        // Orphan and refill, like the forest's placements
+        size_t bytes = commands.size() * sizeof(DrawElementsIndirectCommand);
+        indirectCapacity = std::max(indirectCapacity, bytes);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+        glBufferData(GL_DRAW_INDIRECT_BUFFER, indirectCapacity, nullptr, GL_STREAM_DRAW);
+        glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, bytes, commands.data());
+
+        SetInstanceAttributes(instanceBuffer, instanceStride, 0);
+        glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_SHORT, nullptr, (GLsizei)commands.size(), 0);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+        drawCalls = 1;
+    } else {
+        // Without base instances the per-instance attributes are moved
+        // instead, which only happens between runs of different placements
+        GLuint attributeBase = ~0u;
+        if (instanceBuffer == 0) {
+            SetInstanceAttributes(0, 0, 0);
+        }
+        for (const auto& command : commands) {
+            if (instanceBuffer != 0 && command.baseInstance != attributeBase) {
+                attributeBase = command.baseInstance;
+                SetInstanceAttributes(instanceBuffer, instanceStride, (GLintptr)attributeBase * instanceStride);
+            }
+            glDrawElementsInstancedBaseVertex(GL_TRIANGLES, command.count, GL_UNSIGNED_SHORT,
+                                              (void*)(command.firstIndex * sizeof(unsigned short)),
+                                              command.instanceCount, command.baseVertex);
+        }
+        drawCalls = commands.size();
+    }
+
+    glBindVertexArray(0);
+    glDisable(GL_POLYGON_OFFSET_FILL);
+    return drawCalls;
+}
+
+size_t GeometryHeap::GetGpuMemoryBytes() const {
+    size_t bytes = 0;
+    for (const HeapBuffer* heap : { &branchVertices, &branchIndices, &leafInstances, &windBranches }) {
+        bytes += heap->GetCapacity() * heap->GetStride();
+    }
+    return bytes;
+}
+
+size_t GeometryHeap::GetUsedBytes() const {
+    size_t bytes = 0;
+    for (const HeapBuffer* heap : { &branchVertices, &branchIndices, &leafInstances, &windBranches }) {
+        bytes += heap->GetUsedCount() * heap->GetStride();
+    }
+    return bytes;
+}
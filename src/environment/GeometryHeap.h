@@ -0,0 +1,128 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <map>
+#include <vector>
+
+// Interleaved branch vertex, as tree.shader reads it
+struct BranchVertex {
+    glm::vec3 position;
+    glm::vec3 normal;
+    glm::vec3 color;
+    float occlusion;
+    unsigned int windBranch;  // Into the heap's shared wind table
+};
+static_assert(sizeof(BranchVertex) == 44, "Branch attributes are set up for a 44 byte stride");
+
+// Layout of glMultiDrawElementsIndirect and glDrawElementsIndirect
+struct DrawElementsIndirectCommand {
+    GLuint count;
+    GLuint instanceCount;
+    GLuint firstIndex;
+    GLint baseVertex;
+    GLuint baseInstance;
+};
+
+// A run of elements in one of the heap's buffers
+struct HeapRange {
+    unsigned int offset = 0;
+    unsigned int count = 0;
+};
+
+// Element ranges of one GL buffer, handed out first fit. Freed ranges merge
+// with their neighbours. A full buffer doubles, copying its contents into
+// new storage under the same name, so VAOs and buffer textures pointing at
+// it stay valid. Uploads go through the copy targets and leave the element
+// array binding of the current VAO alone.
+class HeapBuffer {
+public:
+    HeapBuffer();
+
+    // A texture format other than GL_NONE also creates a buffer texture over
+    // the whole buffer, reattached whenever it grows
+    void Init(size_t stride, unsigned int initialCapacity, GLenum textureFormat = GL_NONE);
+    void Clean();
+
+    // CPU bookkeeping only, so ranges can be freed after Clean
+    HeapRange Allocate(unsigned int count);
+    void Free(HeapRange& range);
+
+    void Upload(const HeapRange& range, const void* data);
+
+    GLuint GetBuffer() const { return buffer; }
+    GLuint GetTexture() const { return texture; }
+    size_t GetStride() const { return stride; }
+    unsigned int GetCapacity() const { return capacity; }
+    unsigned int GetUsedCount() const { return usedCount; }
+
+private:
+    void Grow(unsigned int minimumCapacity);
+
+    GLuint buffer;
+    GLuint texture;
+    GLenum textureFormat;
+    size_t stride;
+    unsigned int capacity;
+    unsigned int usedCount;
+    std::map<unsigned int, unsigned int> freeRanges;  // Offset to count
+};
+
+// The geometry of every tree in a few shared buffers, so a pass binds one
+// VAO and can submit all of its branch draws in one call.
+// - Branch vertices, interleaved, and 16-bit chunk-local indices drawn with
+//   a base vertex.
+// - Packed leaf instances, sourced by the trees' leaf VAOs at their offset
+//   and, as one buffer texture, by the forest's leaf bands.
+// - Wind hierarchies in one buffer texture. Branch vertices store indices
+//   into it and parent links point within it, leaves add u_WindBase.
+// Branch draws go out as one glMultiDrawElementsIndirect where
+// ARB_multi_draw_indirect is available, otherwise as a tight loop of
+// base-vertex draws over the same commands.
+class GeometryHeap {
+public:
+    // The heap of the GL context. Trees initialize it, whoever owns the
+    // context cleans it up before destroying it.
+    static GeometryHeap& Get();
+
+    GeometryHeap();
+
+    void Init();
+    void Clean();
+    bool IsInitialized() const { return initialized; }
+
+    HeapBuffer& GetBranchVertices() { return branchVertices; }
+    HeapBuffer& GetBranchIndices() { return branchIndices; }
+    HeapBuffer& GetLeafInstances() { return leafInstances; }
+    HeapBuffer& GetWindBranches() { return windBranches; }
+
+    // RGBA32UI, one texel per PackedLeafInstance
+    GLuint GetLeafTexture() const { return leafInstances.GetTexture(); }
+    // RGBA32F, two texels per WindBranch
+    GLuint GetWindTexture() const { return windBranches.GetTexture(); }
+
+    // Draws branch triangles with a polygon offset. Per-instance attributes
+    // 5 to 7, three vec4s, are read from instanceBuffer starting at each
+    // command's baseInstance. Returns the number of GL draw calls issued.
+    int DrawBranches(const std::vector<DrawElementsIndirectCommand>& commands,
+                     GLuint instanceBuffer = 0, GLsizei instanceStride = 0);
+
+    bool HasMultiDrawIndirect() const { return multiDrawIndirect; }
+    size_t GetGpuMemoryBytes() const;
+    size_t GetUsedBytes() const;
+
+private:
+    void SetInstanceAttributes(GLuint instanceBuffer, GLsizei instanceStride, GLintptr baseOffset);
+
+    bool initialized;
+    bool multiDrawIndirect;
+
+    HeapBuffer branchVertices;
+    HeapBuffer branchIndices;
+    HeapBuffer leafInstances;
+    HeapBuffer windBranches;
+
+    GLuint branchVAO;
+    GLuint indirectBuffer;
+    size_t indirectCapacity;
+};
@@ -0,0 +1,223 @@
+#include "HiZOcclusion.h"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+HiZOcclusion::HiZOcclusion()
+    : initialized(false), active(false), reduceShader(nullptr),
+      width(0), height(0), levelCount(0),
+      depthTexture(0), framebuffer(0), emptyVAO(0), previousFramebuffer(0),
+      readBuffer(0), readFence(0),
+      pendingViewProjection(1.0f), viewProjection(1.0f) {
+    for (int i = 0; i < 4; i++) previousViewport[i] = 0;
+}
+
+void HiZOcclusion::Init(int width, int height) {
+    if (initialized) return;
+    this->width = std::max(width, 1);
+    this->height = std::max(height, 1);
+    levelCount = 1 + (int)std::floor(std::log2((float)std::max(this->width, this->height)));
+
+    // Raw depths through texelFetch, no comparison and no filtering
+    glGenTextures(1, &depthTexture);
+    glBindTexture(GL_TEXTURE_2D, depthTexture);
+    for (int level = 0; level < levelCount; level++) {
+        glTexImage2D(GL_TEXTURE_2D, level, GL_DEPTH_COMPONENT32F,
+                     std::max(this->width >> level, 1), std::max(this->height >> level, 1),
+                     0, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+    }
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_NONE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levelCount - 1);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    GLint boundFramebuffer = 0;
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &boundFramebuffer);
+    glGenFramebuffers(1, &framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthTexture, 0);
+    glDrawBuffer(GL_NONE);
+    glReadBuffer(GL_NONE);
+    bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+    glBindFramebuffer(GL_FRAMEBUFFER, boundFramebuffer);
+
+    size_t readBytes = 0;
+    for (int level = readLevel; level < levelCount; level++) {
+        readBytes += (size_t)std::max(this->width >> level, 1) * std::max(this->height >> level, 1) * sizeof(float);
+    }
+    glGenBuffers(1, &readBuffer);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, readBuffer);
+    glBufferData(GL_PIXEL_PACK_BUFFER, readBytes, nullptr, GL_STREAM_READ);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    glGenVertexArrays(1, &emptyVAO);
+    initialized = true;
+
+    if (!complete) {
+        std::cerr << "Hi-Z occlusion target is incomplete" << std::endl;
+        Clean();
+        return;
+    }
+    std::cout << "Hi-Z occlusion: " << this->width << "x" << this->height << ", " << levelCount << " levels" << std::endl;
+}
+
+void HiZOcclusion::Clean() {
+    if (!initialized) return;
+    if (readFence) {
+        glDeleteSync(readFence);
+        readFence = 0;
+    }
+    glDeleteBuffers(1, &readBuffer);
+    glDeleteFramebuffers(1, &framebuffer);
+    glDeleteTextures(1, &depthTexture);
+    glDeleteVertexArrays(1, &emptyVAO);
+    readBuffer = framebuffer = depthTexture = emptyVAO = 0;
+    levels.clear();
+    active = false;
+    initialized = false;
+}
+
+void HiZOcclusion::Update() {
+    if (!initialized || !readFence) return;
+
+    // Never blocks, an unfinished copy is looked at again next frame
+    GLenum status = glClientWaitSync(readFence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+    if (status == GL_TIMEOUT_EXPIRED) return;
+    glDeleteSync(readFence);
+    readFence = 0;
+    if (status == GL_WAIT_FAILED) return;
+
+    std::vector<Level> readLevels;
+    size_t readBytes = 0;
+    for (int level = readLevel; level < levelCount; level++) {
+        Level read;
+        read.width = std::max(width >> level, 1);
+        read.height = std::max(height >> level, 1);
+        readBytes += (size_t)read.width * read.height * sizeof(float);
+        readLevels.push_back(std::move(read));
+    }
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, readBuffer);
+    const float* data = (const float*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, readBytes, GL_MAP_READ_BIT);
+    if (data) {
+        for (auto& level : readLevels) {
+            level.depth.assign(data, data + (size_t)level.width * level.height);
+            data += level.depth.size();
+        }
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        levels.swap(readLevels);
+        viewProjection = pendingViewProjection;
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+bool HiZOcclusion::Begin(const glm::mat4& view, const glm::mat4& projection) {
+    if (!IsReady() || active) return false;
+    Update();
+    if (readFence) return false;
+
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &previousFramebuffer);
+    glGetIntegerv(GL_VIEWPORT, previousViewport);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glViewport(0, 0, width, height);
+    glDepthMask(GL_TRUE);
+    glClear(GL_DEPTH_BUFFER_BIT);
+
+    pendingViewProjection = projection * view;
+    active = true;
+    return true;
+}
+
+void HiZOcclusion::End() {
+    if (!active) return;
+    active = false;
+
+    GLint depthFunc = GL_LESS;
+    glGetIntegerv(GL_DEPTH_FUNC, &depthFunc);
+    GLboolean depthTest = glIsEnabled(GL_DEPTH_TEST);
+    glEnable(GL_DEPTH_TEST);
+    glDepthFunc(GL_ALWAYS);
+
+    // Each level reads the one below, which is then the only level in the
+    // texture's range, so no level is read and written at once
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, depthTexture);
+    reduceShader->Bind();
+    reduceShader->SetUniform1i("u_Depth", 0);
+    glBindVertexArray(emptyVAO);
+    for (int level = 1; level < levelCount; level++) {
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level - 1);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, level - 1);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthTexture, level);
+        glViewport(0, 0, std::max(width >> level, 1), std::max(height >> level, 1));
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+    }
+    glBindVertexArray(0);
+    reduceShader->Unbind();
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levelCount - 1);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthTexture, 0);
+
+    // Queue the copy into the pixel buffer, fenced so Update can tell when it landed
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, readBuffer);
+    size_t offset = 0;
+    for (int level = readLevel; level < levelCount; level++) {
+        glGetTexImage(GL_TEXTURE_2D, level, GL_DEPTH_COMPONENT, GL_FLOAT, (void*)offset);
+        offset += (size_t)std::max(width >> level, 1) * std::max(height >> level, 1) * sizeof(float);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    readFence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+    glDepthFunc(depthFunc);
+    if (!depthTest) glDisable(GL_DEPTH_TEST);
+    glBindFramebuffer(GL_FRAMEBUFFER, previousFramebuffer);
+    glViewport(previousViewport[0], previousViewport[1], previousViewport[2], previousViewport[3]);
+}
+
+bool HiZOcclusion::IsOccluded(const glm::vec3& center, float radius) const {
+    return IsOccluded(center - glm::vec3(radius), center + glm::vec3(radius));
+}
+
+bool HiZOcclusion::IsOccluded(const glm::vec3& boundsMin, const glm::vec3& boundsMax) const {
+    if (levels.empty()) return false;
+
+    // Screen rectangle and nearest depth of the box
+    glm::vec2 uvMin(1.0f), uvMax(0.0f);
+    float nearest = 1.0f;
+    for (int i = 0; i < 8; i++) {
+        glm::vec3 corner((i & 1) ? boundsMax.x : boundsMin.x,
+                         (i & 2) ? boundsMax.y : boundsMin.y,
+                         (i & 4) ? boundsMax.z : boundsMin.z);
+        glm::vec4 clip = viewProjection * glm::vec4(corner, 1.0f);
+        if (clip.w <= 1e-4f) return false;
+        glm::vec3 ndc = glm::vec3(clip) / clip.w;
+        glm::vec2 uv = glm::vec2(ndc) * 0.5f + 0.5f;
+        uvMin = glm::min(uvMin, uv);
+        uvMax = glm::max(uvMax, uv);
+        nearest = std::min(nearest, ndc.z * 0.5f + 0.5f);
+    }
+    uvMin = glm::clamp(uvMin, glm::vec2(0.0f), glm::vec2(1.0f));
+    uvMax = glm::clamp(uvMax, glm::vec2(0.0f), glm::vec2(1.0f));
+    if (uvMin.x >= uvMax.x || uvMin.y >= uvMax.y) return false;  // Off screen, frustum culling's call
+
+    // The level where the rectangle spans at most two texels per axis
+    const Level& finest = levels[0];
+    glm::vec2 extent = (uvMax - uvMin) * glm::vec2(finest.width, finest.height);
+    int index = (int)std::ceil(std::log2(std::max(std::max(extent.x, extent.y), 1.0f)));
+    const Level& level = levels[std::min(index, (int)levels.size() - 1)];
+
+    glm::ivec2 size(level.width, level.height);
+    glm::ivec2 low = glm::min(glm::ivec2(uvMin * glm::vec2(size)), size - 1);
+    glm::ivec2 high = glm::min(glm::ivec2(uvMax * glm::vec2(size)), size - 1);
+    float farthest = 0.0f;
+    for (int y = low.y; y <= high.y; y++) {
+        for (int x = low.x; x <= high.x; x++) {
+            farthest = std::max(farthest, level.depth[(size_t)y * level.width + x]);
+        }
+    }
+    return nearest > farthest;
+}
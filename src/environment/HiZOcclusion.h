@@ -0,0 +1,66 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <vector>
+#include "Shader.h"
+
+// Occlusion culling against a hierarchical depth buffer.
+// 1. Begin redirects rendering into a small depth-only target. The caller
+//    draws occluders with the usual shaders: trunks and nearby trees.
+// 2. End builds the mip chain with hiz_reduce.shader, every texel keeping
+//    the farthest depth below it, and copies it into a pixel buffer.
+// 3. A later frame maps the copy once its fence has signaled, so nothing
+//    waits on the GPU. IsOccluded then tests bounds on the CPU against the
+//    pyramid and the camera it was rendered with.
+// The tested depth is a frame or two old, so something uncovered by a fast
+// camera turn shows up that much late.
+class HiZOcclusion {
+public:
+    HiZOcclusion();
+
+    void Init(int width = 512, int height = 256);
+    void Clean();
+    void SetShader(Shader* reduceShader) { this->reduceShader = reduceShader; }
+    bool IsReady() const { return initialized && reduceShader; }
+
+    // Picks up a finished readback, call before culling each frame
+    void Update();
+
+    // Returns false while the previous pyramid is still on its way back,
+    // skip the occluders then
+    bool Begin(const glm::mat4& view, const glm::mat4& projection);
+    void End();
+
+    // A world-space box entirely behind the read back depth. False without
+    // a pyramid, or when the box reaches the camera.
+    bool IsOccluded(const glm::vec3& boundsMin, const glm::vec3& boundsMax) const;
+    bool IsOccluded(const glm::vec3& center, float radius) const;
+    bool HasDepth() const { return !levels.empty(); }
+
+private:
+    struct Level {
+        int width, height;
+        std::vector<float> depth;
+    };
+
+    bool initialized;
+    bool active;
+    Shader* reduceShader;
+
+    int width, height, levelCount;
+    GLuint depthTexture;
+    GLuint framebuffer;
+    GLuint emptyVAO;
+    GLint previousFramebuffer;
+    GLint previousViewport[4];
+
+    // Levels from readLevel up, copied into one pixel buffer
+    static const int readLevel = 1;
+    GLuint readBuffer;
+    GLsync readFence;
+    glm::mat4 pendingViewProjection;
+
+    std::vector<Level> levels;  // Index 0 is readLevel
+    glm::mat4 viewProjection;
+};
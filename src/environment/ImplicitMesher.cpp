@@ -0,0 +1,413 @@
+#include "ImplicitMesher.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <thread>
+#include <unordered_map>
+
+// --- Marching cubes tables ---
+//
+// Corner i of a cell sits at cornerOffsets[i]; edge e joins edgeCorners[e].
+// Instead of hard-coding the classic 256-entry triangle table, it is derived
+// once by walking the cube faces: on every face each run of inside corners is
+// cut off by a segment from the edge where the run starts to the edge where it
+// ends. Ambiguous faces therefore always separate inside corners, and since
+// neighbouring cells see the same corners on a shared face they agree, which
+// keeps the surface crack free. Segments chain into closed loops that are
+// fan triangulated.
+
+static const int cornerOffsets[8][3] = {
+    {0, 0, 0}, {1, 0, 0}, {1, 1, 0}, {0, 1, 0},
+    {0, 0, 1}, {1, 0, 1}, {1, 1, 1}, {0, 1, 1}
+};
+
+static const int edgeCorners[12][2] = {
+    {0, 1}, {1, 2}, {2, 3}, {3, 0},
+    {4, 5}, {5, 6}, {6, 7}, {7, 4},
+    {0, 4}, {1, 5}, {2, 6}, {3, 7}
+};
+
+struct TriangleTable {
+    int triangles[256][16];
+
+    TriangleTable() {
+        // Faces as corner cycles, wound counter-clockwise seen from outside
+        int faces[6][4] = {
+            {0, 1, 2, 3}, {4, 5, 6, 7}, {0, 1, 5, 4},
+            {3, 2, 6, 7}, {0, 3, 7, 4}, {1, 2, 6, 5}
+        };
+        for (auto& face : faces) {
+            glm::vec3 c[4];
+            for (int k = 0; k < 4; k++) {
+                c[k] = glm::vec3(cornerOffsets[face[k]][0], cornerOffsets[face[k]][1], cornerOffsets[face[k]][2]);
+            }
+            glm::vec3 outward = (c[0] + c[2]) * 0.5f - glm::vec3(0.5f);
+            if (glm::dot(glm::cross(c[1] - c[0], c[2] - c[1]), outward) < 0.0f) {
+                std::swap(face[1], face[3]);
+            }
+        }
+
+        auto edgeBetween = [](int a, int b) {
+            for (int e = 0; e < 12; e++) {
+                if ((edgeCorners[e][0] == a && edgeCorners[e][1] == b) ||
+                    (edgeCorners[e][0] == b && edgeCorners[e][1] == a)) {
+                    return e;
+                }
+            }
+            return -1;
+        };
+
+        for (int config = 0; config < 256; config++) {
+            auto inside = [config](int corner) { return (config >> corner) & 1; };
+
+            int next[12];
+            std::fill(next, next + 12, -1);
+
+            for (const auto& face : faces) {
+                for (int k = 0; k < 4; k++) {
+                    int from = face[k];
+                    int to = face[(k + 1) % 4];
+                    if (inside(from) || !inside(to)) continue;
+
+                    // Entering an inside run: link to the edge where it ends
+                    for (int step = 1; step < 4; step++) {
+                        int a = face[(k + step) % 4];
+                        int b = face[(k + step + 1) % 4];
+                        if (inside(a) && !inside(b)) {
+                            next[edgeBetween(from, to)] = edgeBetween(a, b);
+                            break;
+                        }
+                    }
+                }
+            }
+
+            int count = 0;
+            bool visited[12] = {};
+            for (int start = 0; start < 12; start++) {
+                if (next[start] < 0 || visited[start]) continue;
+
+                int loop[12];
+                int loopSize = 0;
+                for (int e = start; !visited[e]; e = next[e]) {
+                    visited[e] = true;
+                    loop[loopSize++] = e;
+                }
+
+                for (int k = 1; k + 1 < loopSize; k++) {
+                    triangles[config][count++] = loop[0];
+                    triangles[config][count++] = loop[k];
+                    triangles[config][count++] = loop[k + 1];
+                }
+            }
+            std::fill(triangles[config] + count, triangles[config] + 16, -1);
+        }
+    }
+};
+
+static const TriangleTable& GetTriangleTable() {
+    static const TriangleTable table;
+    return table;
+}
+
+// --- SDF helpers ---
+
+static float CapsuleDistance(const Capsule& capsule, const glm::vec3& p) {
+    glm::vec3 ab = capsule.b - capsule.a;
+    float lengthSq = glm::dot(ab, ab);
+    float t = lengthSq > 0.0f ? glm::clamp(glm::dot(p - capsule.a, ab) / lengthSq, 0.0f, 1.0f) : 0.0f;
+    return glm::length(p - (capsule.a + ab * t)) - glm::mix(capsule.ra, capsule.rb, t);
+}
+
+// Polynomial smooth minimum, equal to min(a, b) once they differ by more than k
+static float SmoothMin(float a, float b, float k) {
+    if (k <= 0.0f) return std::min(a, b);
+    float h = std::max(k - std::abs(a - b), 0.0f) / k;
+    return std::min(a, b) - h * h * k * 0.25f;
+}
+
+static uint64_t PackKey(uint64_t x, uint64_t y, uint64_t z, uint64_t axis) {
+    return x | (y << 20) | (z << 40) | (axis << 60);
+}
+
+// --- ImplicitMesher ---
+
+struct ImplicitMesher::Tile {
+    int x, y, z;
+    std::vector<int> candidates;
+
+    std::vector<glm::vec3> positions;
+    std::vector<glm::vec3> normals;
+    std::vector<int> depths;
+    std::vector<int> owners;
+    std::vector<uint64_t> edgeKeys;
+    std::vector<unsigned int> indices;
+};
+
+ImplicitMesher::ImplicitMesher(const ImplicitMeshSettings& settings)
+    : settings(settings), origin(0.0f) {
+}
+
+float ImplicitMesher::Evaluate(const std::vector<Capsule>& capsules, const std::vector<int>& candidates,
+                               const glm::vec3& p, int* nearest) const {
+    float value = 1e9f;
+    float nearestDistance = 1e9f;
+    for (int index : candidates) {
+        float d = CapsuleDistance(capsules[index], p);
+        value = SmoothMin(value, d, settings.blendRadius);
+        if (nearest && d < nearestDistance) {
+            nearestDistance = d;
+            *nearest = index;
+        }
+    }
+    return value;
+}
+
+void ImplicitMesher::PolygonizeTile(const std::vector<Capsule>& capsules, Tile& tile) {
+    const TriangleTable& table = GetTriangleTable();
+    const int n = settings.tileSize;
+    const int stride = n + 1;
+    const float h = settings.voxelSize;
+
+    const int baseX = tile.x * n;
+    const int baseY = tile.y * n;
+    const int baseZ = tile.z * n;
+
+    auto gridPoint = [&](int x, int y, int z) {
+        return origin + glm::vec3(baseX + x, baseY + y, baseZ + z) * h;
+    };
+
+    std::vector<float> values(stride * stride * stride);
+    bool anyInside = false, anyOutside = false;
+    for (int z = 0; z <= n; z++) {
+        for (int y = 0; y <= n; y++) {
+            for (int x = 0; x <= n; x++) {
+                float v = Evaluate(capsules, tile.candidates, gridPoint(x, y, z), nullptr);
+                values[(z * stride + y) * stride + x] = v;
+                if (v < 0.0f) anyInside = true; else anyOutside = true;
+            }
+        }
+    }
+    if (!anyInside || !anyOutside) return;
+
+    std::unordered_map<uint64_t, unsigned int> edgeVertices;
+
+    auto edgeVertex = [&](int x, int y, int z, int edge) -> unsigned int {
+        const int* c0 = cornerOffsets[edgeCorners[edge][0]];
+        const int* c1 = cornerOffsets[edgeCorners[edge][1]];
+        int axis = (c0[0] != c1[0]) ? 0 : (c0[1] != c1[1]) ? 1 : 2;
+        int lx = x + std::min(c0[0], c1[0]);
+        int ly = y + std::min(c0[1], c1[1]);
+        int lz = z + std::min(c0[2], c1[2]);
+
+        uint64_t key = PackKey(baseX + lx, baseY + ly, baseZ + lz, axis);
+        auto it = edgeVertices.find(key);
+        if (it != edgeVertices.end()) return it->second;
+
+        int ox = lx + (axis == 0), oy = ly + (axis == 1), oz = lz + (axis == 2);
+        float v0 = values[(lz * stride + ly) * stride + lx];
+        float v1 = values[(oz * stride + oy) * stride + ox];
+        float t = v0 / (v0 - v1);
+        glm::vec3 p = glm::mix(gridPoint(lx, ly, lz), gridPoint(ox, oy, oz), t);
+
+        // Gradient by central differences gives a smooth normal across
+        // collars, the sample at p only finds the nearest capsule
+        float e = h * 0.5f;
+        int nearest = tile.candidates.front();
+        Evaluate(capsules, tile.candidates, p, &nearest);
+        glm::vec3 dx(e, 0, 0), dy(0, e, 0), dz(0, 0, e);
+        glm::vec3 gradient(
+            Evaluate(capsules, tile.candidates, p + dx, nullptr) - Evaluate(capsules, tile.candidates, p - dx, nullptr),
+            Evaluate(capsules, tile.candidates, p + dy, nullptr) - Evaluate(capsules, tile.candidates, p - dy, nullptr),
+            Evaluate(capsules, tile.candidates, p + dz, nullptr) - Evaluate(capsules, tile.candidates, p - dz, nullptr));
+        float gradientLength = glm::length(gradient);
+
+        unsigned int index = tile.positions.size();
+        tile.positions.push_back(p);
+        tile.normals.push_back(gradientLength > 0.0f ? gradient / gradientLength : glm::vec3(0.0f, 1.0f, 0.0f));
+        tile.depths.push_back(capsules[nearest].depth);
+        tile.owners.push_back(nearest);
+        tile.edgeKeys.push_back(key);
+        edgeVertices[key] = index;
+        return index;
+    };
+
+    for (int z = 0; z < n; z++) {
+        for (int y = 0; y < n; y++) {
+            for (int x = 0; x < n; x++) {
+                int config = 0;
+                for (int c = 0; c < 8; c++) {
+                    int cx = x + cornerOffsets[c][0];
+                    int cy = y + cornerOffsets[c][1];
+                    int cz = z + cornerOffsets[c][2];
+                    if (values[(cz * stride + cy) * stride + cx] < 0.0f) config |= 1 << c;
+                }
+                if (config == 0 || config == 255) continue;
+
+                const int* triangles = table.triangles[config];
+                for (int k = 0; triangles[k] >= 0; k++) {
+                    tile.indices.push_back(edgeVertex(x, y, z, triangles[k]));
+                }
+            }
+        }
+    }
+}
+
+void ImplicitMesher::Build(const std::vector<Capsule>& capsules, ImplicitMeshResult& result) {
+    result.positions.clear();
+    result.normals.clear();
+    result.depths.clear();
+    result.owners.clear();
+    result.indices.clear();
+    result.tileCount = 0;
+    if (capsules.empty() || settings.voxelSize <= 0.0f || settings.tileSize <= 0) return;
+
+    // Anything further than this from a capsule surface cannot change the
+    // sign of the field near the surface
+    const float margin = settings.blendRadius + 2.0f * settings.voxelSize;
+    const float tileExtent = settings.tileSize * settings.voxelSize;
+
+    glm::vec3 boundsMin(1e9f), boundsMax(-1e9f);
+    for (const auto& capsule : capsules) {
+        float r = std::max(capsule.ra, capsule.rb) + margin;
+        boundsMin = glm::min(boundsMin, glm::min(capsule.a, capsule.b) - glm::vec3(r));
+        boundsMax = glm::max(boundsMax, glm::max(capsule.a, capsule.b) + glm::vec3(r));
+    }
+    origin = boundsMin;
+
+    glm::vec3 extentCells = (boundsMax - boundsMin) / settings.voxelSize;
+    if (glm::max(extentCells.x, glm::max(extentCells.y, extentCells.z)) >= float((1 << 20) - 1)) {
+        return; // Edge keys hold 20 bits per axis
+    }
+
+    // Sparse tile set: each capsule registers with every tile its padded
+    // bounds touch. Capsule lists stay sorted, so shared tile faces evaluate
+    // identically on both sides.
+    std::unordered_map<uint64_t, int> tileLookup;
+    std::vector<Tile> tiles;
+    for (int i = 0; i < (int)capsules.size(); i++) {
+        const Capsule& capsule = capsules[i];
+        float r = std::max(capsule.ra, capsule.rb) + margin;
+        glm::ivec3 lo = glm::ivec3(glm::floor((glm::min(capsule.a, capsule.b) - glm::vec3(r) - origin) / tileExtent));
+        glm::ivec3 hi = glm::ivec3(glm::floor((glm::max(capsule.a, capsule.b) + glm::vec3(r) - origin) / tileExtent));
+        lo = glm::max(lo, glm::ivec3(0));
+
+        for (int z = lo.z; z <= hi.z; z++) {
+            for (int y = lo.y; y <= hi.y; y++) {
+                for (int x = lo.x; x <= hi.x; x++) {
+                    uint64_t key = PackKey(x, y, z, 0);
+                    auto it = tileLookup.find(key);
+                    if (it == tileLookup.end()) {
+                        it = tileLookup.emplace(key, (int)tiles.size()).first;
+                        Tile tile;
+                        tile.x = x; tile.y = y; tile.z = z;
+                        tiles.push_back(std::move(tile));
+                    }
+                    tiles[it->second].candidates.push_back(i);
+                }
+            }
+        }
+    }
+    result.tileCount = tiles.size();
+
+    unsigned int threadCount = settings.threadCount;
+    if (threadCount == 0) threadCount = std::max(1u, std::thread::hardware_concurrency());
+    threadCount = std::min<unsigned int>(threadCount, tiles.size());
+
+    std::atomic<size_t> nextTile(0);
+    auto worker = [&]() {
+        for (size_t t = nextTile++; t < tiles.size(); t = nextTile++) {
+            PolygonizeTile(capsules, tiles[t]);
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (unsigned int t = 1; t < threadCount; t++) {
+        workers.emplace_back(worker);
+    }
+    worker();
+    for (auto& thread : workers) {
+        thread.join();
+    }
+
+    // Weld in tile order so the output does not depend on thread timing
+    std::unordered_map<uint64_t, unsigned int> globalVertices;
+    std::vector<unsigned int> remap;
+    for (const Tile& tile : tiles) {
+        remap.resize(tile.positions.size());
+        for (size_t v = 0; v < tile.positions.size(); v++) {
+            auto inserted = globalVertices.emplace(tile.edgeKeys[v], (unsigned int)result.positions.size());
+            if (inserted.second) {
+                result.positions.push_back(tile.positions[v]);
+                result.normals.push_back(tile.normals[v]);
+                result.depths.push_back(tile.depths[v]);
+                result.owners.push_back(tile.owners[v]);
+            }
+            remap[v] = inserted.first->second;
+        }
+        for (unsigned int index : tile.indices) {
+            result.indices.push_back(remap[index]);
+        }
+    }
+
+    Decimate(result);
+}
+
+void ImplicitMesher::Decimate(ImplicitMeshResult& result) const {
+    if (settings.decimationFactor <= 1.0f || result.positions.empty()) return;
+
+    // Vertex clustering: merge all vertices in a cell into their average and
+    // drop the triangles that collapse
+    const float cell = settings.voxelSize * settings.decimationFactor;
+
+    std::unordered_map<uint64_t, unsigned int> clusters;
+    std::vector<unsigned int> remap(result.positions.size());
+    std::vector<glm::vec3> positions, normals;
+    std::vector<int> depths, owners, counts;
+
+    for (size_t v = 0; v < result.positions.size(); v++) {
+        glm::ivec3 c = glm::ivec3(glm::floor((result.positions[v] - origin) / cell));
+        auto inserted = clusters.emplace(PackKey(c.x, c.y, c.z, 0), (unsigned int)positions.size());
+        if (inserted.second) {
+            positions.push_back(glm::vec3(0.0f));
+            normals.push_back(glm::vec3(0.0f));
+            depths.push_back(result.depths[v]);
+            owners.push_back(result.owners[v]);
+            counts.push_back(0);
+        }
+        unsigned int cluster = inserted.first->second;
+        positions[cluster] += result.positions[v];
+        normals[cluster] += result.normals[v];
+        // The shallowest capsule wins, so merged joints follow the parent
+        if (result.depths[v] < depths[cluster]) {
+            depths[cluster] = result.depths[v];
+            owners[cluster] = result.owners[v];
+        }
+        counts[cluster]++;
+        remap[v] = cluster;
+    }
+
+    for (size_t c = 0; c < positions.size(); c++) {
+        positions[c] /= (float)counts[c];
+        float length = glm::length(normals[c]);
+        normals[c] = length > 0.0f ? normals[c] / length : glm::vec3(0.0f, 1.0f, 0.0f);
+    }
+
+    std::vector<unsigned int> indices;
+    indices.reserve(result.indices.size());
+    for (size_t i = 0; i + 2 < result.indices.size(); i += 3) {
+        unsigned int a = remap[result.indices[i]];
+        unsigned int b = remap[result.indices[i + 1]];
+        unsigned int c = remap[result.indices[i + 2]];
+        if (a == b || b == c || a == c) continue;
+        indices.push_back(a);
+        indices.push_back(b);
+        indices.push_back(c);
+    }
+
+    result.positions.swap(positions);
+    result.normals.swap(normals);
+    result.depths.swap(depths);
+    result.owners.swap(owners);
+    result.indices.swap(indices);
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <vector>
+
+// A tapered capsule: the segment a-b swept with a radius going from ra to rb
+struct Capsule {
+    glm::vec3 a;
+    glm::vec3 b;
+    float ra;
+    float rb;
+    int depth;
+};
+
+struct ImplicitMeshSettings {
+    float voxelSize = 0.08f;       // Grid spacing of the marching cubes lattice
+    float blendRadius = 0.15f;     // Smooth-union width, grows collars at junctions
+    float decimationFactor = 2.0f; // Vertex clustering cell in voxels, <= 1 disables
+    int tileSize = 16;             // Cells per tile edge
+    unsigned int threadCount = 0;  // 0 = one per hardware thread
+};
+
+struct ImplicitMeshResult {
+    std::vector<glm::vec3> positions;
+    std::vector<glm::vec3> normals;
+    std::vector<int> depths;       // Depth of the nearest capsule, for coloring
+    std::vector<int> owners;       // Index of that capsule
+    std::vector<unsigned int> indices;
+    int tileCount = 0;
+};
+
+// Polygonizes the smooth union of a set of capsules with marching cubes.
+// The SDF is only evaluated in tiles that some capsule can reach, each tile
+// only looks at the capsules overlapping it, and tiles run in parallel.
+// Vertices on shared tile faces are welded, so the result is watertight.
+class ImplicitMesher {
+public:
+    explicit ImplicitMesher(const ImplicitMeshSettings& settings);
+
+    void Build(const std::vector<Capsule>& capsules, ImplicitMeshResult& result);
+
+private:
+    struct Tile;
+
+    void PolygonizeTile(const std::vector<Capsule>& capsules, Tile& tile);
+    float Evaluate(const std::vector<Capsule>& capsules, const std::vector<int>& candidates,
+                   const glm::vec3& p, int* nearest) const;
+    void Decimate(ImplicitMeshResult& result) const;
+
+    ImplicitMeshSettings settings;
+    glm::vec3 origin;
+};
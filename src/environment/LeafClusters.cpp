@@ -0,0 +1,148 @@
+#include "LeafClusters.h"
+#include <algorithm>
+#include <cmath>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define LEAF_CULL_SSE 1
+#include <emmintrin.h>
+#endif
+
+void ExtractFrustumPlanes(const glm::mat4& viewProjection, glm::vec4 outPlanes[6]) {
+    glm::vec4 rows[4];
+    for (int i = 0; i < 4; i++) {
+        rows[i] = glm::vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+    }
+    outPlanes[0] = rows[3] + rows[0];
+    outPlanes[1] = rows[3] - rows[0];
+    outPlanes[2] = rows[3] + rows[1];
+    outPlanes[3] = rows[3] - rows[1];
+    outPlanes[4] = rows[3] + rows[2];
+    outPlanes[5] = rows[3] - rows[2];
+    for (int i = 0; i < 6; i++) {
+        outPlanes[i] /= glm::length(glm::vec3(outPlanes[i]));
+    }
+}
+
+void LeafClusterSet::Clear() {
+    clusters.clear();
+    sphereX.clear(); sphereY.clear(); sphereZ.clear(); sphereRadius.clear();
+}
+
+void LeafClusterSet::Build(const std::vector<glm::vec3>& positions, float leafRadius, float cellSize,
+                           std::vector<int>& outOrder) {
+    Clear();
+    outOrder.clear();
+    if (positions.empty()) return;
+
+    glm::vec3 boundsMin(1e30f);
+    for (const auto& p : positions) boundsMin = glm::min(boundsMin, p);
+    float invCell = 1.0f / std::max(cellSize, 1e-4f);
+
+    // Sort by cell, ties broken by the original index to keep the order stable
+    std::vector<std::pair<unsigned long long, int>> keyed(positions.size());
+    for (size_t i = 0; i < positions.size(); i++) {
+        glm::ivec3 cell = glm::ivec3(glm::floor((positions[i] - boundsMin) * invCell));
+        unsigned long long key = ((unsigned long long)(cell.x & 0x1FFFFF) << 42) |
+                                 ((unsigned long long)(cell.y & 0x1FFFFF) << 21) |
+                                 (unsigned long long)(cell.z & 0x1FFFFF);
+        keyed[i] = { key, (int)i };
+    }
+    std::sort(keyed.begin(), keyed.end());
+
+    outOrder.resize(positions.size());
+    size_t start = 0;
+    while (start < keyed.size()) {
+        size_t end = start;
+        glm::vec3 clusterMin(1e30f), clusterMax(-1e30f);
+        while (end < keyed.size() && keyed[end].first == keyed[start].first) {
+            const glm::vec3& p = positions[keyed[end].second];
+            clusterMin = glm::min(clusterMin, p);
+            clusterMax = glm::max(clusterMax, p);
+            outOrder[end] = keyed[end].second;
+            end++;
+        }
+
+        LeafCluster cluster;
+        cluster.center = (clusterMin + clusterMax) * 0.5f;
+        cluster.radius = 0.0f;
+        for (size_t i = start; i < end; i++) {
+            cluster.radius = std::max(cluster.radius, glm::length(positions[outOrder[i]] - cluster.center));
+        }
+        cluster.radius += leafRadius;
+        cluster.first = start;
+        cluster.count = end - start;
+        clusters.push_back(cluster);
+        start = end;
+    }
+
+    // Padding lanes get a negative radius so they always fail the plane test
+    size_t padded = (clusters.size() + 3) & ~size_t(3);
+    sphereX.assign(padded, 0.0f);
+    sphereY.assign(padded, 0.0f);
+    sphereZ.assign(padded, 0.0f);
+    sphereRadius.assign(padded, -1e30f);
+    for (size_t i = 0; i < clusters.size(); i++) {
+        sphereX[i] = clusters[i].center.x;
+        sphereY[i] = clusters[i].center.y;
+        sphereZ[i] = clusters[i].center.z;
+        sphereRadius[i] = clusters[i].radius;
+    }
+}
+
+unsigned int LeafClusterSet::Cull(const glm::mat4& viewProjection, const glm::vec3& cameraPosition,
+                                  const LeafCullSettings& settings, std::vector<LeafClusterDraw>& outDraws,
+                                  const std::function<bool(const glm::vec3&, float)>& occluded) const {
+    outDraws.clear();
+
+    glm::vec4 planes[6];
+    ExtractFrustumPlanes(viewProjection, planes);
+
+    unsigned int drawn = 0;
+    auto emit = [&](size_t index) {
+        const LeafCluster& cluster = clusters[index];
+        if (occluded && occluded(cluster.center, cluster.radius)) return;
+        float distance = std::max(glm::length(cluster.center - cameraPosition) - cluster.radius, 0.0f);
+        float fraction = LeafKeepFraction(distance, settings);
+        unsigned int keep = std::min(cluster.count, (unsigned int)std::ceil(cluster.count * fraction));
+        if (keep == 0) return;
+        outDraws.push_back({ cluster.first, keep, (float)keep / cluster.count });
+        drawn += keep;
+    };
+
+#if LEAF_CULL_SSE
+    for (size_t i = 0; i < sphereX.size(); i += 4) {
+        __m128 x = _mm_loadu_ps(&sphereX[i]);
+        __m128 y = _mm_loadu_ps(&sphereY[i]);
+        __m128 z = _mm_loadu_ps(&sphereZ[i]);
+        __m128 negRadius = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(&sphereRadius[i]));
+
+        __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+        for (const auto& plane : planes) {
+            __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(plane.x)),
+                                             _mm_mul_ps(y, _mm_set1_ps(plane.y))),
+                                  _mm_add_ps(_mm_mul_ps(z, _mm_set1_ps(plane.z)),
+                                             _mm_set1_ps(plane.w)));
+            inside = _mm_and_ps(inside, _mm_cmpgt_ps(d, negRadius));
+        }
+
+        int mask = _mm_movemask_ps(inside);
+        for (int lane = 0; mask != 0; lane++, mask >>= 1) {
+            if (mask & 1) emit(i + lane);
+        }
+    }
+#else
+    for (size_t i = 0; i < clusters.size(); i++) {
+        bool inside = true;
+        for (const auto& plane : planes) {
+            float d = plane.x * sphereX[i] + plane.y * sphereY[i] + plane.z * sphereZ[i] + plane.w;
+            if (d <= -sphereRadius[i]) {
+                inside = false;
+                break;
+            }
+        }
+        if (inside) emit(i);
+    }
+#endif
+
+    return drawn;
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <functional>
+#include <vector>
+
+struct LeafCluster {
+    glm::vec3 center;
+    float radius;          // Bounding sphere including the leaf cards
+    unsigned int first;    // Range in the cluster-major instance order
+    unsigned int count;
+};
+
+// A cluster that passed culling, and how many of its instances to draw
+struct LeafClusterDraw {
+    unsigned int first;
+    unsigned int count;
+    float keepFraction;  // count over the cluster's size, what leaf.shader grows survivors by
+};
+
+enum class LeafCullMode {
+    Off,   // Draw every instance
+    Cpu,   // Cluster culling and pruning on the CPU, survivors streamed each frame
+    Gpu    // Per-leaf culling in a transform feedback pass, drawn indirectly
+};
+
+struct LeafCullSettings {
+    LeafCullMode mode = LeafCullMode::Cpu;
+    float pruneStart = 20.0f;   // Distance where clusters start losing leaves
+    float minFraction = 0.15f;  // Fraction of each cluster that is always kept
+};
+
+// Fraction of a cluster kept at a distance. Falls with the square of the
+// distance, like the cluster's projected area. leaf.shader scales the
+// survivors by 1/sqrt of the fraction actually kept so canopy coverage stays
+// the same: the CPU cull streams it per cluster, the GPU cull keeps and
+// leaf.shader grows by the same per-leaf distance.
+inline float LeafKeepFraction(float distance, const LeafCullSettings& settings) {
+    if (settings.mode == LeafCullMode::Off || distance <= settings.pruneStart) return 1.0f;
+    float ratio = settings.pruneStart / distance;
+    return glm::clamp(ratio * ratio, settings.minFraction, 1.0f);
+}
+
+// Frustum planes of a view-projection matrix (Gribb/Hartmann), normalized so
+// plane distances compare directly against sphere radii
+void ExtractFrustumPlanes(const glm::mat4& viewProjection, glm::vec4 outPlanes[6]);
+
+// Groups leaves into spatial cells so they can be frustum culled and thinned
+// per cluster instead of per leaf. Members of a cluster keep their relative
+// order. With the progressive blue-noise order from GenerateLeavesAtEndpoints,
+// any prefix of a cluster is therefore an evenly spread subset of it.
+class LeafClusterSet {
+public:
+    // Writes the cluster-major permutation of positions into outOrder
+    void Build(const std::vector<glm::vec3>& positions, float leafRadius, float cellSize,
+               std::vector<int>& outOrder);
+
+    // Frustum tests the bounding spheres four at a time and appends the
+    // surviving clusters, already trimmed to their distance prefix. Clusters
+    // inside the frustum can still be dropped by an occlusion test, which is
+    // handed the cluster's local bounding sphere.
+    // Returns the number of instances to draw.
+    unsigned int Cull(const glm::mat4& viewProjection, const glm::vec3& cameraPosition,
+                      const LeafCullSettings& settings, std::vector<LeafClusterDraw>& outDraws,
+                      const std::function<bool(const glm::vec3&, float)>& occluded = nullptr) const;
+
+    const std::vector<LeafCluster>& GetClusters() const { return clusters; }
+    void Clear();
+
+private:
+    std::vector<LeafCluster> clusters;
+
+    // Bounding spheres as SoA, padded to a multiple of four
+    std::vector<float> sphereX, sphereY, sphereZ, sphereRadius;
+};
@@ -0,0 +1,180 @@
+#include "LeafGpuCuller.h"
+#include <iostream>
+#include <string>
+
+// Each PackedLeafInstance is read and captured as one uvec4
+static const GLsizei instanceStride = 4 * sizeof(GLuint);
+
+LeafGpuCuller::LeafGpuCuller()
+    : initialized(false), supported(false),
+      cullShader(nullptr), countShader(nullptr), commandShader(nullptr),
+      sourceVAO(0), emptyVAO(0), feedback(0),
+      outputBuffer(0), indirectBuffer(0),
+      countTexture(0), countFramebuffer(0),
+      sourceCount(0), outputCapacity(0) {
+}
+
+void LeafGpuCuller::Init() {
+    supported = (GLEW_VERSION_4_0 || (GLEW_ARB_draw_indirect && GLEW_ARB_transform_feedback2)) != 0;
+    if (!supported) {
+        std::cout << "Leaf GPU culling needs indirect draws and transform feedback objects, culling on the CPU" << std::endl;
+        return;
+    }
+
+    glGenVertexArrays(1, &sourceVAO);
+    glGenVertexArrays(1, &emptyVAO);
+    glGenTransformFeedbacks(1, &feedback);
+    glGenBuffers(1, &outputBuffer);
+    glGenBuffers(1, &indirectBuffer);
+
+    // count, instanceCount, first, reserved
+    GLuint command[4] = { 4, 0, 0, 0 };
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+    glBufferData(GL_DRAW_INDIRECT_BUFFER, sizeof(command), command, GL_DYNAMIC_COPY);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+    // Single float texel the count pass accumulates into
+    glGenTextures(1, &countTexture);
+    glBindTexture(GL_TEXTURE_2D, countTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, 1, 1, 0, GL_RED, GL_FLOAT, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    GLint previousFramebuffer = 0;
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previousFramebuffer);
+    glGenFramebuffers(1, &countFramebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, countFramebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, countTexture, 0);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        std::cerr << "Leaf count framebuffer is incomplete, culling on the CPU" << std::endl;
+        supported = false;
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, previousFramebuffer);
+
+    initialized = true;
+}
+
+void LeafGpuCuller::Clean() {
+    if (!initialized) return;
+    glDeleteVertexArrays(1, &sourceVAO);
+    glDeleteVertexArrays(1, &emptyVAO);
+    glDeleteTransformFeedbacks(1, &feedback);
+    glDeleteBuffers(1, &outputBuffer);
+    glDeleteBuffers(1, &indirectBuffer);
+    glDeleteFramebuffers(1, &countFramebuffer);
+    glDeleteTextures(1, &countTexture);
+    sourceCount = 0;
+    outputCapacity = 0;
+    initialized = false;
+}
+
+void LeafGpuCuller::SetShaders(Shader* cull, Shader* count, Shader* command) {
+    cullShader = cull;
+    countShader = count;
+    commandShader = command;
+}
+
+void LeafGpuCuller::SetSource(GLuint instanceBuffer, unsigned int instanceCount, GLintptr baseOffset) {
+    if (!initialized) return;
+    sourceCount = instanceCount;
+
+    glBindVertexArray(sourceVAO);
+    glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+    glVertexAttribIPointer(0, 4, GL_UNSIGNED_INT, instanceStride, (void*)baseOffset);
+    glEnableVertexAttribArray(0);
+    glBindVertexArray(0);
+
+    if (instanceCount > outputCapacity) {
+        outputCapacity = instanceCount;
+        glBindBuffer(GL_ARRAY_BUFFER, outputBuffer);
+        glBufferData(GL_ARRAY_BUFFER, outputCapacity * instanceStride, nullptr, GL_DYNAMIC_COPY);
+
+        // The binding is feedback object state, so this only happens on resize
+        glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, feedback);
+        glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, outputBuffer);
+        glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, 0);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void LeafGpuCuller::Cull(const LeafGpuCullParams& params) {
+    if (!IsReady()) return;
+
+    if (sourceCount == 0) {
+        GLuint command[4] = { 4, 0, 0, 0 };
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+        glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, sizeof(command), command);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+        return;
+    }
+
+    // Pass 1: test every instance and capture the survivors
+    glm::vec4 planes[6];
+    ExtractFrustumPlanes(params.viewProjection, planes);
+
+    cullShader->Bind();
+    for (int i = 0; i < 6; i++) {
+        cullShader->SetUniform4f("u_FrustumPlanes[" + std::to_string(i) + "]",
+                                 planes[i].x, planes[i].y, planes[i].z, planes[i].w);
+    }
+    cullShader->SetUniform3f("u_LeafBoundsMin", params.boundsMin.x, params.boundsMin.y, params.boundsMin.z);
+    cullShader->SetUniform3f("u_LeafBoundsExtent", params.boundsExtent.x, params.boundsExtent.y, params.boundsExtent.z);
+    cullShader->SetUniform1f("u_LeafScaleMin", params.scaleMin);
+    cullShader->SetUniform1f("u_LeafScaleStep", params.scaleStep);
+    cullShader->SetUniform3f("u_CameraPos", params.cameraPosition.x, params.cameraPosition.y, params.cameraPosition.z);
+    cullShader->SetUniform1f("u_PruneStart", params.settings.pruneStart);
+    cullShader->SetUniform1f("u_MinKeepFraction", params.settings.minFraction);
+
+    glEnable(GL_RASTERIZER_DISCARD);
+    glBindVertexArray(sourceVAO);
+    glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, feedback);
+    glBeginTransformFeedback(GL_POINTS);
+    glDrawArrays(GL_POINTS, 0, sourceCount);
+    glEndTransformFeedback();
+    glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, 0);
+    glDisable(GL_RASTERIZER_DISCARD);
+
+    // Pass 2: splat one point per survivor onto the count texel
+    GLint previousFramebuffer = 0;
+    GLint previousViewport[4];
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previousFramebuffer);
+    glGetIntegerv(GL_VIEWPORT, previousViewport);
+    GLboolean depthTest = glIsEnabled(GL_DEPTH_TEST);
+    GLboolean blend = glIsEnabled(GL_BLEND);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, countFramebuffer);
+    glViewport(0, 0, 1, 1);
+    const GLfloat zero[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    glClearBufferfv(GL_COLOR, 0, zero);
+    glDisable(GL_DEPTH_TEST);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ONE, GL_ONE);
+
+    countShader->Bind();
+    glBindVertexArray(emptyVAO);
+    glDrawTransformFeedback(GL_POINTS, feedback);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, previousFramebuffer);
+    glViewport(previousViewport[0], previousViewport[1], previousViewport[2], previousViewport[3]);
+    if (depthTest) glEnable(GL_DEPTH_TEST);
+    if (!blend) glDisable(GL_BLEND);
+
+    // Pass 3: turn the count into an indirect draw command
+    commandShader->Bind();
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, countTexture);
+    commandShader->SetUniform1i("u_LeafCount", 0);
+
+    glEnable(GL_RASTERIZER_DISCARD);
+    glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, indirectBuffer);
+    glBeginTransformFeedback(GL_POINTS);
+    glDrawArrays(GL_POINTS, 0, 1);
+    glEndTransformFeedback();
+    glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+    glDisable(GL_RASTERIZER_DISCARD);
+
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindVertexArray(0);
+    commandShader->Unbind();
+}
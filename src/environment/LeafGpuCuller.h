@@ -0,0 +1,65 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include "Shader.h"
+#include "LeafClusters.h"
+
+// Everything the cull shader needs to decode a PackedLeafInstance
+struct LeafGpuCullParams {
+    glm::mat4 viewProjection;
+    glm::vec3 cameraPosition;
+    glm::vec3 boundsMin;
+    glm::vec3 boundsExtent;
+    float scaleMin;
+    float scaleStep;
+    LeafCullSettings settings;
+};
+
+// GPU-driven leaf culling in plain GL 4.0, with no CPU readback:
+// 1. leaf_cull.shader streams every instance as a point. Its geometry stage
+//    re-emits survivors into a transform feedback buffer.
+// 2. leaf_count.shader draws the captured points with glDrawTransformFeedback
+//    into a 1x1 float target with additive blending. That texel is the count.
+// 3. leaf_command.shader reads the texel and captures a
+//    DrawArraysIndirectCommand into the indirect buffer.
+// The leaf pass then draws the compacted buffer with glDrawArraysIndirect.
+// Init checks the context for indirect draws, transform feedback objects and
+// a blendable float target, and the culler is never ready without them, so
+// the tree falls back to culling on the CPU.
+class LeafGpuCuller {
+public:
+    LeafGpuCuller();
+
+    void Init();
+    void Clean();
+    void SetShaders(Shader* cullShader, Shader* countShader, Shader* commandShader);
+    bool IsReady() const { return initialized && supported && cullShader && countShader && commandShader; }
+    bool IsSupported() const { return supported; }
+
+    // Points the cull pass at the packed instances starting baseOffset bytes
+    // into a buffer and grows the compacted output to hold all of them
+    void SetSource(GLuint instanceBuffer, unsigned int instanceCount, GLintptr baseOffset = 0);
+
+    void Cull(const LeafGpuCullParams& params);
+
+    GLuint GetOutputBuffer() const { return outputBuffer; }
+    GLuint GetIndirectBuffer() const { return indirectBuffer; }
+
+private:
+    bool initialized;
+    bool supported;
+    Shader* cullShader;
+    Shader* countShader;
+    Shader* commandShader;
+
+    GLuint sourceVAO;        // Raw uvec4 view of the packed instances
+    GLuint emptyVAO;         // For the attribute-less count and command passes
+    GLuint feedback;         // Transform feedback object holding the survivor count
+    GLuint outputBuffer;     // Compacted PackedLeafInstance stream
+    GLuint indirectBuffer;   // DrawArraysIndirectCommand
+    GLuint countTexture;
+    GLuint countFramebuffer;
+    unsigned int sourceCount;
+    unsigned int outputCapacity;
+};
@@ -0,0 +1,218 @@
+#include "LeafHalfResPass.h"
+#include <iostream>
+
+// Depth format of the framebuffer the scene is drawn into, or GL_NONE
+static GLenum SceneDepthFormat(GLint framebuffer) {
+    GLenum depthAttachment = framebuffer == 0 ? GL_DEPTH : GL_DEPTH_ATTACHMENT;
+    GLenum stencilAttachment = framebuffer == 0 ? GL_STENCIL : GL_STENCIL_ATTACHMENT;
+
+    GLint type = GL_NONE;
+    glGetFramebufferAttachmentParameteriv(GL_FRAMEBUFFER, depthAttachment, GL_FRAMEBUFFER_ATTACHMENT_OBJECT_TYPE, &type);
+    if (type == GL_NONE) return GL_NONE;
+
+    GLint depthBits = 0, componentType = GL_UNSIGNED_NORMALIZED, stencilBits = 0;
+    glGetFramebufferAttachmentParameteriv(GL_FRAMEBUFFER, depthAttachment, GL_FRAMEBUFFER_ATTACHMENT_DEPTH_SIZE, &depthBits);
+    glGetFramebufferAttachmentParameteriv(GL_FRAMEBUFFER, depthAttachment, GL_FRAMEBUFFER_ATTACHMENT_COMPONENT_TYPE, &componentType);
+    glGetFramebufferAttachmentParameteriv(GL_FRAMEBUFFER, stencilAttachment, GL_FRAMEBUFFER_ATTACHMENT_OBJECT_TYPE, &type);
+    if (type != GL_NONE) {
+        glGetFramebufferAttachmentParameteriv(GL_FRAMEBUFFER, stencilAttachment, GL_FRAMEBUFFER_ATTACHMENT_STENCIL_SIZE, &stencilBits);
+    }
+
+    if (componentType == GL_FLOAT) return stencilBits > 0 ? GL_DEPTH32F_STENCIL8 : GL_DEPTH_COMPONENT32F;
+    if (stencilBits > 0) return depthBits == 24 ? GL_DEPTH24_STENCIL8 : GL_NONE;
+    switch (depthBits) {
+        case 16: return GL_DEPTH_COMPONENT16;
+        case 24: return GL_DEPTH_COMPONENT24;
+        case 32: return GL_DEPTH_COMPONENT32;
+        default: return GL_NONE;
+    }
+}
+
+static GLuint CreateDepthTexture(GLenum format, int width, int height) {
+    GLenum pixelFormat = GL_DEPTH_COMPONENT;
+    GLenum pixelType = GL_FLOAT;
+    if (format == GL_DEPTH24_STENCIL8) {
+        pixelFormat = GL_DEPTH_STENCIL;
+        pixelType = GL_UNSIGNED_INT_24_8;
+    } else if (format == GL_DEPTH32F_STENCIL8) {
+        pixelFormat = GL_DEPTH_STENCIL;
+        pixelType = GL_FLOAT_32_UNSIGNED_INT_24_8_REV;
+    }
+
+    GLuint texture = 0;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, pixelFormat, pixelType, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    return texture;
+}
+
+static GLuint CreateFramebuffer(GLuint depthTexture, GLenum depthFormat, GLuint colorTexture) {
+    bool hasStencil = depthFormat == GL_DEPTH24_STENCIL8 || depthFormat == GL_DEPTH32F_STENCIL8;
+
+    GLuint framebuffer = 0;
+    glGenFramebuffers(1, &framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, hasStencil ? GL_DEPTH_STENCIL_ATTACHMENT : GL_DEPTH_ATTACHMENT,
+                           GL_TEXTURE_2D, depthTexture, 0);
+    if (colorTexture != 0) {
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, colorTexture, 0);
+    } else {
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
+    }
+    return framebuffer;
+}
+
+LeafHalfResPass::LeafHalfResPass()
+    : initialized(false), active(false), upsampleShader(nullptr),
+      emptyVAO(0), sceneDepth(0), sceneFramebuffer(0),
+      halfSceneDepth(0), halfSceneFramebuffer(0),
+      leafColor(0), leafDepth(0), leafFramebuffer(0),
+      depthFormat(GL_NONE), width(0), height(0), previousFramebuffer(0) {
+    for (int i = 0; i < 4; i++) previousViewport[i] = 0;
+}
+
+void LeafHalfResPass::Init() {
+    glGenVertexArrays(1, &emptyVAO);
+    initialized = true;
+}
+
+void LeafHalfResPass::Clean() {
+    if (!initialized) return;
+    DeleteTargets();
+    glDeleteVertexArrays(1, &emptyVAO);
+    emptyVAO = 0;
+    initialized = false;
+}
+
+void LeafHalfResPass::DeleteTargets() {
+    GLuint framebuffers[3] = { sceneFramebuffer, halfSceneFramebuffer, leafFramebuffer };
+    GLuint textures[4] = { sceneDepth, halfSceneDepth, leafColor, leafDepth };
+    glDeleteFramebuffers(3, framebuffers);
+    glDeleteTextures(4, textures);
+    sceneFramebuffer = halfSceneFramebuffer = leafFramebuffer = 0;
+    sceneDepth = halfSceneDepth = leafColor = leafDepth = 0;
+    width = height = 0;
+}
+
+bool LeafHalfResPass::Allocate(int newWidth, int newHeight) {
+    DeleteTargets();
+    width = newWidth;
+    height = newHeight;
+    int halfWidth = (width + 1) / 2;
+    int halfHeight = (height + 1) / 2;
+
+    sceneDepth = CreateDepthTexture(depthFormat, width, height);
+    halfSceneDepth = CreateDepthTexture(depthFormat, halfWidth, halfHeight);
+    leafDepth = CreateDepthTexture(depthFormat, halfWidth, halfHeight);
+
+    glGenTextures(1, &leafColor);
+    glBindTexture(GL_TEXTURE_2D, leafColor);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, halfWidth, halfHeight, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    sceneFramebuffer = CreateFramebuffer(sceneDepth, depthFormat, 0);
+    bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+    halfSceneFramebuffer = CreateFramebuffer(halfSceneDepth, depthFormat, 0);
+    complete = complete && glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+    leafFramebuffer = CreateFramebuffer(leafDepth, depthFormat, leafColor);
+    complete = complete && glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+    glBindFramebuffer(GL_FRAMEBUFFER, previousFramebuffer);
+
+    if (!complete) {
+        std::cerr << "Half resolution leaf targets are incomplete" << std::endl;
+        DeleteTargets();
+        return false;
+    }
+    std::cout << "Half resolution leaves: " << halfWidth << "x" << halfHeight << std::endl;
+    return true;
+}
+
+bool LeafHalfResPass::Begin() {
+    if (!IsReady() || active) return false;
+
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &previousFramebuffer);
+    glGetIntegerv(GL_VIEWPORT, previousViewport);
+    int viewportWidth = previousViewport[2];
+    int viewportHeight = previousViewport[3];
+    if (viewportWidth <= 0 || viewportHeight <= 0) return false;
+
+    GLenum format = SceneDepthFormat(previousFramebuffer);
+    if (format == GL_NONE) return false;
+    if (format != depthFormat || viewportWidth != width || viewportHeight != height) {
+        depthFormat = format;
+        if (!Allocate(viewportWidth, viewportHeight)) return false;
+    }
+    int halfWidth = (width + 1) / 2;
+    int halfHeight = (height + 1) / 2;
+
+    // Resolve, then downsample, then seed the leaf target with the result
+    int x = previousViewport[0], y = previousViewport[1];
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, previousFramebuffer);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, sceneFramebuffer);
+    glBlitFramebuffer(x, y, x + width, y + height, 0, 0, width, height, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, sceneFramebuffer);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, halfSceneFramebuffer);
+    glBlitFramebuffer(0, 0, width, height, 0, 0, halfWidth, halfHeight, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, halfSceneFramebuffer);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, leafFramebuffer);
+    glBlitFramebuffer(0, 0, halfWidth, halfHeight, 0, 0, halfWidth, halfHeight, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, leafFramebuffer);
+    glViewport(0, 0, halfWidth, halfHeight);
+    const GLfloat clear[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    glClearBufferfv(GL_COLOR, 0, clear);
+
+    active = true;
+    return true;
+}
+
+void LeafHalfResPass::End(const glm::mat4& projection) {
+    if (!active) return;
+    active = false;
+
+    glBindFramebuffer(GL_FRAMEBUFFER, previousFramebuffer);
+    glViewport(previousViewport[0], previousViewport[1], previousViewport[2], previousViewport[3]);
+
+    GLboolean blend = glIsEnabled(GL_BLEND);
+    GLboolean depthTest = glIsEnabled(GL_DEPTH_TEST);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+    glEnable(GL_DEPTH_TEST);
+
+    GLuint textures[4] = { leafColor, leafDepth, halfSceneDepth, sceneDepth };
+    for (int i = 0; i < 4; i++) {
+        glActiveTexture(GL_TEXTURE0 + i);
+        glBindTexture(GL_TEXTURE_2D, textures[i]);
+    }
+
+    upsampleShader->Bind();
+    upsampleShader->SetUniform1i("u_LeafColor", 0);
+    upsampleShader->SetUniform1i("u_LeafDepth", 1);
+    upsampleShader->SetUniform1i("u_HalfSceneDepth", 2);
+    upsampleShader->SetUniform1i("u_SceneDepth", 3);
+    upsampleShader->SetUniform2f("u_ViewportOrigin", (float)previousViewport[0], (float)previousViewport[1]);
+    upsampleShader->SetUniform2f("u_DepthParams", projection[2][2], projection[3][2]);
+
+    glBindVertexArray(emptyVAO);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glBindVertexArray(0);
+    upsampleShader->Unbind();
+
+    for (int i = 3; i >= 0; i--) {
+        glActiveTexture(GL_TEXTURE0 + i);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+    if (!blend) glDisable(GL_BLEND);
+    if (!depthTest) glDisable(GL_DEPTH_TEST);
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include "Shader.h"
+
+// Renders leaves at half resolution and composites them over the scene:
+// 1. Begin resolves the scene depth, blits it down to half size and binds
+//    an offscreen target that starts from that depth, so hidden leaves are
+//    still rejected early.
+// 2. Tree::RenderLeaves draws into it. Without multisampling it takes the
+//    alpha test path, so the target holds premultiplied color and coverage.
+// 3. End draws one fullscreen triangle with leaf_upsample.shader. Each pixel
+//    blends its four nearest half-res texels, weighted by how close the
+//    depth each texel was tested against is to this pixel's own depth.
+//    Leaves do not bleed across trunk silhouettes, and the leaf depth is
+//    written and tested at full resolution.
+class LeafHalfResPass {
+public:
+    LeafHalfResPass();
+
+    void Init();
+    void Clean();
+    void SetShader(Shader* upsampleShader) { this->upsampleShader = upsampleShader; }
+    bool IsReady() const { return initialized && upsampleShader; }
+
+    // Redirects rendering to the half-res target for the current viewport.
+    // Returns false when the pass cannot run, draw the leaves directly then.
+    bool Begin();
+
+    // Restores the scene framebuffer and composites the leaves into it
+    void End(const glm::mat4& projection);
+
+private:
+    bool Allocate(int width, int height);
+    void DeleteTargets();
+
+    bool initialized;
+    bool active;
+    Shader* upsampleShader;
+
+    GLuint emptyVAO;
+    GLuint sceneDepth;            // Full-res resolved scene depth
+    GLuint sceneFramebuffer;
+    GLuint halfSceneDepth;        // Scene depth the leaves were tested against
+    GLuint halfSceneFramebuffer;
+    GLuint leafColor;             // Premultiplied, alpha = coverage
+    GLuint leafDepth;
+    GLuint leafFramebuffer;
+    GLenum depthFormat;           // Matches the scene's, blits need identical formats
+
+    int width, height;
+    GLint previousFramebuffer;
+    GLint previousViewport[4];
+};
@@ -0,0 +1,196 @@
+#include "LeafTextureArray.h"
+#include <algorithm>
+#include <iostream>
+
+#include "stb_image.h"
+
+// Alpha edge that both the alpha test and the sharpened coverage use
+static const unsigned char alphaEdge = 128;
+
+static float AlphaCoverage(const std::vector<unsigned char>& rgba, float alphaScale) {
+    size_t pixelCount = rgba.size() / 4;
+    if (pixelCount == 0) return 0.0f;
+    size_t covered = 0;
+    for (size_t i = 0; i < pixelCount; i++) {
+        if (rgba[i * 4 + 3] * alphaScale >= alphaEdge) covered++;
+    }
+    return (float)covered / (float)pixelCount;
+}
+
+static std::vector<unsigned char> Resample(const std::vector<unsigned char>& source, int sourceWidth, int sourceHeight,
+                                           int width, int height) {
+    if (sourceWidth == width && sourceHeight == height) return source;
+
+    // Bilinear, sampling at texel centers
+    std::vector<unsigned char> result((size_t)width * height * 4);
+    for (int y = 0; y < height; y++) {
+        float sy = std::max((y + 0.5f) * sourceHeight / height - 0.5f, 0.0f);
+        int y0 = std::min((int)sy, sourceHeight - 1);
+        int y1 = std::min(y0 + 1, sourceHeight - 1);
+        float fy = sy - y0;
+        for (int x = 0; x < width; x++) {
+            float sx = std::max((x + 0.5f) * sourceWidth / width - 0.5f, 0.0f);
+            int x0 = std::min((int)sx, sourceWidth - 1);
+            int x1 = std::min(x0 + 1, sourceWidth - 1);
+            float fx = sx - x0;
+            for (int c = 0; c < 4; c++) {
+                float a = source[((size_t)y0 * sourceWidth + x0) * 4 + c];
+                float b = source[((size_t)y0 * sourceWidth + x1) * 4 + c];
+                float d = source[((size_t)y1 * sourceWidth + x0) * 4 + c];
+                float e = source[((size_t)y1 * sourceWidth + x1) * 4 + c];
+                float top = a + (b - a) * fx;
+                float bottom = d + (e - d) * fx;
+                result[((size_t)y * width + x) * 4 + c] = (unsigned char)(top + (bottom - top) * fy + 0.5f);
+            }
+        }
+    }
+    return result;
+}
+
+static std::vector<unsigned char> Downsample(const std::vector<unsigned char>& source, int sourceWidth, int sourceHeight,
+                                             int width, int height) {
+    // 2x2 box, the last row or column repeats on odd sizes
+    std::vector<unsigned char> result((size_t)width * height * 4);
+    for (int y = 0; y < height; y++) {
+        int y0 = std::min(y * 2, sourceHeight - 1);
+        int y1 = std::min(y * 2 + 1, sourceHeight - 1);
+        for (int x = 0; x < width; x++) {
+            int x0 = std::min(x * 2, sourceWidth - 1);
+            int x1 = std::min(x * 2 + 1, sourceWidth - 1);
+            for (int c = 0; c < 4; c++) {
+                int sum = source[((size_t)y0 * sourceWidth + x0) * 4 + c] + source[((size_t)y0 * sourceWidth + x1) * 4 + c] +
+                          source[((size_t)y1 * sourceWidth + x0) * 4 + c] + source[((size_t)y1 * sourceWidth + x1) * 4 + c];
+                result[((size_t)y * width + x) * 4 + c] = (unsigned char)((sum + 2) / 4);
+            }
+        }
+    }
+    return result;
+}
+
+static void PreserveCoverage(std::vector<unsigned char>& rgba, float targetCoverage) {
+    if (targetCoverage <= 0.0f) return;
+
+    // Coverage only grows with the scale, so bisect for the one that matches
+    float low = 0.0f, high = 8.0f;
+    for (int i = 0; i < 16; i++) {
+        float mid = (low + high) * 0.5f;
+        if (AlphaCoverage(rgba, mid) < targetCoverage) low = mid;
+        else high = mid;
+    }
+
+    size_t pixelCount = rgba.size() / 4;
+    for (size_t i = 0; i < pixelCount; i++) {
+        rgba[i * 4 + 3] = (unsigned char)std::min(rgba[i * 4 + 3] * high + 0.5f, 255.0f);
+    }
+}
+
+LeafTextureArray::LeafTextureArray() : texture(0) {
+}
+
+int LeafTextureArray::AddLayer(const std::string& texturePath) {
+    int width, height, nrChannels;
+    stbi_set_flip_vertically_on_load(true);
+    unsigned char* data = stbi_load(texturePath.c_str(), &width, &height, &nrChannels, 0);
+    if (!data) {
+        std::cerr << "Failed to load leaf texture: " << texturePath << std::endl;
+        return -1;
+    }
+
+    Layer layer;
+    layer.width = width;
+    layer.height = height;
+    layer.rgba.resize((size_t)width * height * 4);
+
+    int pixelCount = width * height;
+    for (int i = 0; i < pixelCount; i++) {
+        unsigned char* out = &layer.rgba[(size_t)i * 4];
+        if (nrChannels == 4) {
+            for (int c = 0; c < 4; c++) out[c] = data[i * 4 + c];
+            continue;
+        }
+
+        // Black background, white leaf silhouette
+        unsigned char value;
+        if (nrChannels == 1 || nrChannels == 2) {
+            value = data[i * nrChannels];
+        } else {
+            value = (data[i * 3] + data[i * 3 + 1] + data[i * 3 + 2]) / 3;
+        }
+        out[0] = 60;
+        out[1] = 120;
+        out[2] = 40;
+        out[3] = value;
+    }
+    stbi_image_free(data);
+
+    layers.push_back(std::move(layer));
+    std::cout << "Loaded leaf texture: " << texturePath << " (layer " << layers.size() - 1 << ")" << std::endl;
+    return (int)layers.size() - 1;
+}
+
+void LeafTextureArray::Upload() {
+    if (layers.empty()) return;
+
+    int width = 1, height = 1;
+    for (const auto& layer : layers) {
+        width = std::max(width, layer.width);
+        height = std::max(height, layer.height);
+    }
+    int levelCount = 1;
+    while ((width >> levelCount) > 0 || (height >> levelCount) > 0) levelCount++;
+
+    if (texture == 0) {
+        glGenTextures(1, &texture);
+    }
+    glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BASE_LEVEL, 0);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, levelCount - 1);
+
+    for (int level = 0; level < levelCount; level++) {
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, level, GL_RGBA8, std::max(width >> level, 1), std::max(height >> level, 1),
+                     (GLsizei)layers.size(), 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    }
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    for (size_t i = 0; i < layers.size(); i++) {
+        std::vector<unsigned char> image = Resample(layers[i].rgba, layers[i].width, layers[i].height, width, height);
+        float coverage = AlphaCoverage(image, 1.0f);
+
+        int levelWidth = width, levelHeight = height;
+        for (int level = 0; level < levelCount; level++) {
+            if (level > 0) {
+                int nextWidth = std::max(levelWidth >> 1, 1);
+                int nextHeight = std::max(levelHeight >> 1, 1);
+                image = Downsample(image, levelWidth, levelHeight, nextWidth, nextHeight);
+                levelWidth = nextWidth;
+                levelHeight = nextHeight;
+
+                // Filter from the unscaled level so corrections do not compound
+                std::vector<unsigned char> corrected = image;
+                PreserveCoverage(corrected, coverage);
+                glTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, (GLint)i, levelWidth, levelHeight, 1,
+                                GL_RGBA, GL_UNSIGNED_BYTE, corrected.data());
+            } else {
+                glTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, (GLint)i, levelWidth, levelHeight, 1,
+                                GL_RGBA, GL_UNSIGNED_BYTE, image.data());
+            }
+        }
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+    std::cout << "Leaf texture array: " << layers.size() << " layer(s) at " << width << "x" << height
+              << ", " << levelCount << " levels" << std::endl;
+}
+
+void LeafTextureArray::Clean() {
+    if (texture != 0) {
+        glDeleteTextures(1, &texture);
+        texture = 0;
+    }
+    layers.clear();
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <string>
+#include <vector>
+
+// Leaf textures of every species in one GL_TEXTURE_2D_ARRAY, so trees that
+// share it can draw their leaves without rebinding. Each PackedLeafInstance
+// carries its layer. Layers are resampled to a common size and their mips
+// are built on the CPU. Every level is rescaled so the same fraction of
+// texels passes the 0.5 alpha edge as in the base level, which keeps
+// minified canopies from thinning out under the alpha test or coverage.
+class LeafTextureArray {
+public:
+    LeafTextureArray();
+
+    // Loads an image into the next layer and returns its index, or -1.
+    // Greyscale and RGB images are read as a silhouette, like
+    // Tree::LoadLeafTexture always has.
+    int AddLayer(const std::string& texturePath);
+
+    // Creates or replaces the GL texture from the layers added so far
+    void Upload();
+    void Clean();
+
+    GLuint GetTexture() const { return texture; }
+    int GetLayerCount() const { return (int)layers.size(); }
+
+private:
+    struct Layer {
+        int width, height;
+        std::vector<unsigned char> rgba;
+    };
+
+    GLuint texture;
+    std::vector<Layer> layers;
+};
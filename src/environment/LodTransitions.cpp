@@ -0,0 +1,44 @@
+#include "LodTransitions.h"
+#include <algorithm>
+
+LodTransitions::LodTransitions() : frame(1) {
+}
+
+void LodTransitions::Reset(size_t count) {
+    states.assign(count, LodState());
+}
+
+const LodState& LodTransitions::Select(size_t index, int level, int nearLevel, int farLevel,
+                                       const LodTransitionSettings& settings) {
+    LodState& state = states[index];
+    bool continuous = state.level >= 0 && state.seen + 1 == frame;
+    state.seen = frame;
+
+    // Stay on the current level while it is inside the hysteresis range
+    if (continuous) level = glm::clamp(state.level, nearLevel, farLevel);
+    if (!continuous || settings.fadeFrames <= 0) {
+        state.level = level;
+        state.previous = -1;
+        state.fade = 1.0f;
+        return state;
+    }
+
+    float step = 1.0f / settings.fadeFrames;
+    if (state.fade < 1.0f) {
+        state.fade = std::min(state.fade + step, 1.0f);
+        if (state.fade >= 1.0f) state.previous = -1;
+    }
+
+    if (level != state.level) {
+        if (state.fade < 1.0f && level == state.previous) {
+            // Turning back mid-fade continues from the same mix
+            state.fade = 1.0f - state.fade;
+        } else {
+            // A third level drops the one that was still on its way out
+            state.fade = step;
+        }
+        state.previous = state.level;
+        state.level = level;
+    }
+    return state;
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <vector>
+
+struct LodTransitionSettings {
+    float hysteresis = 0.1f;  // Fraction of the distance an object must cross a threshold by to switch
+    int fadeFrames = 8;       // Frames a cross-fade takes, 0 switches at once
+};
+
+// Level of one object and the level it is fading away from
+struct LodState {
+    int level = -1;         // -1 until the first selection
+    int previous = -1;      // Level fading out, drawn alongside level while fade < 1
+    float fade = 1.0f;      // Progress from previous to level
+    unsigned int seen = 0;  // Last frame the object was selected in
+};
+
+// How one copy of a fading object is dithered, the shaders keep a fragment
+// when its screen-door threshold is below x, or at or above it when y is 1.
+// The incoming and outgoing copies use the same threshold, so every pixel
+// shows exactly one of them.
+inline glm::vec4 LodFadeIn(float fade) { return glm::vec4(fade, 0.0f, 0.0f, 0.0f); }
+inline glm::vec4 LodFadeOut(float fade) { return glm::vec4(fade, 1.0f, 0.0f, 0.0f); }
+inline glm::vec4 LodOpaque() { return LodFadeIn(1.0f); }
+
+// Per-object LOD selection with hysteresis and dithered cross-fades.
+// The caller maps distances to levels, for the object's distance and for
+// that distance pulled in and pushed out by the hysteresis. The current
+// level only changes once it falls outside that range, so jitter around a
+// threshold does not thrash. A change starts a cross-fade over fadeFrames,
+// during which both levels are drawn with complementary screen-door
+// patterns. An object that comes back after not being selected, e.g. from
+// outside the frustum, takes its level at once, there is nothing on screen
+// to fade from.
+class LodTransitions {
+public:
+    LodTransitions();
+
+    // Forgets every object, for a new set of placements
+    void Reset(size_t count);
+    size_t GetCount() const { return states.size(); }
+
+    void BeginFrame() { frame++; }
+    // level is the one at the object's distance, nearLevel and farLevel the
+    // ones at distance * (1 - hysteresis) and distance * (1 + hysteresis)
+    const LodState& Select(size_t index, int level, int nearLevel, int farLevel,
+                           const LodTransitionSettings& settings);
+
+private:
+    std::vector<LodState> states;
+    unsigned int frame;
+};
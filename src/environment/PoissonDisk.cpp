@@ -0,0 +1,258 @@
+#include "PoissonDisk.h"
+#include "BlueNoise.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <thread>
+
+// Thinning decision hashed from the position, so it does not depend on the
+// tile or the order a sample was found in
+static bool KeepSample(const PoissonSample& sample, unsigned int seed, const PlacementDensity& density) {
+    if (!density) return true;
+    unsigned int x, y;
+    std::memcpy(&x, &sample.position.x, sizeof(x));
+    std::memcpy(&y, &sample.position.y, sizeof(y));
+    return HashFloat(x ^ HashUInt(y ^ HashUInt(seed))) < density(sample.position);
+}
+
+void SamplePoissonDiskRect(const glm::vec2& rectMin, const glm::vec2& rectMax,
+                           const std::vector<PoissonSpecies>& species, unsigned int seed,
+                           const std::vector<PoissonSample>& neighbours,
+                           const PlacementDensity& density, const PoissonDiskSettings& settings,
+                           std::vector<PoissonSample>& outSamples) {
+    outSamples.clear();
+    if (species.empty() || !(rectMax.x > rectMin.x) || !(rectMax.y > rectMin.y)) return;
+
+    std::vector<float> radii(species.size());
+    std::vector<float> cumulativeWeight(species.size());
+    float minRadius = 1e30f, maxRadius = 0.0f, totalWeight = 0.0f;
+    for (size_t i = 0; i < species.size(); i++) {
+        radii[i] = std::max(species[i].radius, 1e-3f);
+        minRadius = std::min(minRadius, radii[i]);
+        maxRadius = std::max(maxRadius, radii[i]);
+        totalWeight += std::max(species[i].weight, 0.0f);
+        cumulativeWeight[i] = totalWeight;
+    }
+    if (totalWeight <= 0.0f) return;
+
+    // A hashed counter is a lot cheaper than mt19937 and random enough here
+    unsigned int counter = HashUInt(seed);
+    auto unit = [&]() { return HashFloat(counter++); };
+    auto pickSpecies = [&]() {
+        if (species.size() == 1) return 0;
+        float target = unit() * totalWeight;
+        size_t index = std::upper_bound(cumulativeWeight.begin(), cumulativeWeight.end(), target) - cumulativeWeight.begin();
+        return (int)std::min(index, species.size() - 1);
+    };
+
+    // Cells with a diagonal just under the smallest spacing hold at most one
+    // sample. A border of `reach` cells around the rect holds the neighbours,
+    // and lets candidates inside the rect look around without bounds checks.
+    // One more cell on each side absorbs rounding at the rect's edges.
+    float cellSize = minRadius * 0.7071f * 0.999f;
+    int reach = (int)std::ceil(maxRadius / cellSize);
+    glm::vec2 gridMin = rectMin - glm::vec2((reach + 1) * cellSize);
+    glm::ivec2 gridSize = glm::ivec2(glm::ceil((rectMax - rectMin) / cellSize)) + 2 * reach + 3;
+    // Empty cells sit far away, so the distance test needs no branch for them
+    struct Cell {
+        glm::vec2 position;
+        float radius;
+        int species;
+    };
+    std::vector<Cell> grid((size_t)gridSize.x * gridSize.y, Cell{ glm::vec2(1e18f), 0.0f, -1 });
+    std::vector<int> samples;   // Grid cells of the own samples, in order
+    std::vector<int> active;    // Grid cells of samples that may still grow
+
+    // Truncating is flooring once positions before the grid are out
+    float inverseCellSize = 1.0f / cellSize;
+    auto cellIndex = [&](const glm::vec2& position, int& outIndex) {
+        glm::vec2 local = (position - gridMin) * inverseCellSize;
+        if (local.x < 0.0f || local.y < 0.0f) return false;
+        glm::ivec2 cell = glm::ivec2(local);
+        if (cell.x < 0 || cell.y < 0 || cell.x >= gridSize.x || cell.y >= gridSize.y) return false;
+        outIndex = cell.y * gridSize.x + cell.x;
+        return true;
+    };
+
+    for (const auto& neighbour : neighbours) {
+        int index;
+        if (neighbour.species < 0 || neighbour.species >= (int)species.size()) continue;
+        if (cellIndex(neighbour.position, index) && grid[index].species < 0) {
+            grid[index] = { neighbour.position, radii[neighbour.species], neighbour.species };
+        }
+    }
+
+    // Cells that can hold a conflicting sample, nearest first since most
+    // candidates are rejected by an adjacent sample
+    std::vector<glm::ivec2> offsets;
+    for (int y = -reach; y <= reach; y++) {
+        for (int x = -reach; x <= reach; x++) {
+            glm::vec2 gap = glm::vec2(glm::max(glm::abs(glm::ivec2(x, y)) - 1, 0)) * cellSize;
+            if (glm::dot(gap, gap) < maxRadius * maxRadius) {
+                offsets.push_back(glm::ivec2(x, y));
+            }
+        }
+    }
+    std::stable_sort(offsets.begin(), offsets.end(), [](const glm::ivec2& a, const glm::ivec2& b) {
+        return a.x * a.x + a.y * a.y < b.x * b.x + b.y * b.y;
+    });
+    std::vector<int> cellOffsets;
+    for (const auto& offset : offsets) {
+        cellOffsets.push_back(offset.y * gridSize.x + offset.x);
+    }
+
+    // Only called for positions inside the rect. Consecutive candidates
+    // around a parent are usually stopped by the same sample, so the one
+    // that stopped the last candidate is checked first.
+    int blocker = -1;
+    auto conflicts = [&](const glm::vec2& position, float radius, int index) {
+        const Cell& other = grid[index];
+        float spacing = std::max(radius, other.radius);
+        glm::vec2 toOther = other.position - position;
+        return glm::dot(toOther, toOther) < spacing * spacing;
+    };
+    auto fits = [&](const glm::vec2& position, float radius, int cell) {
+        if (blocker >= 0 && conflicts(position, radius, blocker)) return false;
+        for (int offset : cellOffsets) {
+            if (conflicts(position, radius, cell + offset)) {
+                blocker = cell + offset;
+                return false;
+            }
+        }
+        return true;
+    };
+
+    auto tryInsert = [&](const glm::vec2& position, int kind) {
+        if (position.x < rectMin.x || position.y < rectMin.y || position.x >= rectMax.x || position.y >= rectMax.y) return false;
+        int cell;
+        if (!cellIndex(position, cell) || !fits(position, radii[kind], cell)) return false;
+        grid[cell] = { position, radii[kind], kind };
+        samples.push_back(cell);
+        active.push_back(cell);
+        return true;
+    };
+
+    // A single seed grows over the whole rect, neighbours may already cover parts of it
+    int attempts = std::max(settings.attempts, 1);
+    for (int attempt = 0; attempt < attempts && active.empty(); attempt++) {
+        glm::vec2 position = glm::mix(rectMin, rectMax, glm::vec2(unit(), unit()));
+        tryInsert(position, pickSpecies());
+    }
+
+    float stepCos = std::cos(6.28318531f / attempts), stepSin = std::sin(6.28318531f / attempts);
+    while (!active.empty()) {
+        size_t slot = std::min((size_t)(unit() * active.size()), active.size() - 1);
+        Cell parent = grid[active[slot]];
+
+        // Candidates step around the parent from a random angle, covering
+        // every direction without trigonometry per candidate
+        float angle = unit() * 6.28318531f;
+        glm::vec2 direction(std::cos(angle), std::sin(angle));
+        bool placed = false;
+        for (int attempt = 0; attempt < attempts && !placed; attempt++) {
+            direction = glm::vec2(direction.x * stepCos - direction.y * stepSin,
+                                  direction.x * stepSin + direction.y * stepCos);
+
+            // Uniform over the annulus between one and two spacings
+            int kind = pickSpecies();
+            float spacing = std::max(parent.radius, radii[kind]);
+            float distance = spacing * std::sqrt(1.0f + 3.0f * unit());
+            placed = tryInsert(parent.position + distance * direction, kind);
+        }
+        if (!placed) {
+            active[slot] = active.back();
+            active.pop_back();
+        }
+    }
+
+    outSamples.reserve(samples.size());
+    for (int cell : samples) {
+        PoissonSample sample = { grid[cell].position, grid[cell].species };
+        if (KeepSample(sample, seed, density)) {
+            outSamples.push_back(sample);
+        }
+    }
+}
+
+void SamplePoissonDisk(const glm::vec2& areaMin, const glm::vec2& areaMax,
+                       const std::vector<PoissonSpecies>& species, unsigned int seed,
+                       const PlacementDensity& density, const PoissonDiskSettings& settings,
+                       std::vector<PoissonSample>& outSamples) {
+    outSamples.clear();
+    if (species.empty() || !(areaMax.x > areaMin.x) || !(areaMax.y > areaMin.y)) return;
+
+    float maxRadius = 0.0f;
+    for (const auto& kind : species) {
+        maxRadius = std::max(maxRadius, std::max(kind.radius, 1e-3f));
+    }
+
+    // Conflicts must stay within adjacent tiles
+    float tileSize = settings.tileSize > 0.0f ? settings.tileSize : maxRadius * 16.0f;
+    tileSize = std::max(tileSize, maxRadius);
+    glm::ivec2 tiles = glm::max(glm::ivec2(glm::ceil((areaMax - areaMin) / tileSize)), glm::ivec2(1));
+    std::vector<std::vector<PoissonSample>> tileSamples((size_t)tiles.x * tiles.y);
+
+    unsigned int threadCount = settings.threadCount;
+    if (threadCount == 0) threadCount = std::max(1u, std::thread::hardware_concurrency());
+
+    std::vector<int> phaseTiles;
+    for (int phase = 0; phase < 4; phase++) {
+        phaseTiles.clear();
+        for (int y = phase >> 1; y < tiles.y; y += 2) {
+            for (int x = phase & 1; x < tiles.x; x += 2) {
+                phaseTiles.push_back(y * tiles.x + x);
+            }
+        }
+
+        std::atomic<size_t> nextTile(0);
+        auto worker = [&]() {
+            std::vector<PoissonSample> neighbours;
+            for (size_t i = nextTile++; i < phaseTiles.size(); i = nextTile++) {
+                int tile = phaseTiles[i];
+                glm::ivec2 coord(tile % tiles.x, tile / tiles.x);
+                glm::vec2 rectMin = areaMin + glm::vec2(coord) * tileSize;
+                glm::vec2 rectMax = glm::min(rectMin + glm::vec2(tileSize), areaMax);
+
+                // Finished samples of adjacent tiles close enough to conflict
+                neighbours.clear();
+                for (int dy = -1; dy <= 1; dy++) {
+                    for (int dx = -1; dx <= 1; dx++) {
+                        glm::ivec2 other = coord + glm::ivec2(dx, dy);
+                        if ((dx == 0 && dy == 0) || other.x < 0 || other.y < 0 || other.x >= tiles.x || other.y >= tiles.y) continue;
+                        for (const auto& sample : tileSamples[other.y * tiles.x + other.x]) {
+                            glm::vec2 outside = glm::max(glm::max(rectMin - sample.position, sample.position - rectMax), glm::vec2(0.0f));
+                            if (glm::dot(outside, outside) < maxRadius * maxRadius) {
+                                neighbours.push_back(sample);
+                            }
+                        }
+                    }
+                }
+
+                unsigned int tileSeed = HashUInt(seed ^ HashUInt((unsigned int)coord.x * 73856093u ^ (unsigned int)coord.y * 19349663u));
+                SamplePoissonDiskRect(rectMin, rectMax, species, tileSeed, neighbours, nullptr, settings, tileSamples[tile]);
+            }
+        };
+
+        std::vector<std::thread> workers;
+        for (unsigned int t = 1; t < threadCount && t < phaseTiles.size(); t++) {
+            workers.emplace_back(worker);
+        }
+        worker();
+        for (auto& thread : workers) {
+            thread.join();
+        }
+    }
+
+    // Thinned only now, so neighbours never fill a clearing from across a tile edge
+    size_t total = 0;
+    for (const auto& samples : tileSamples) total += samples.size();
+    outSamples.reserve(total);
+    for (const auto& samples : tileSamples) {
+        for (const auto& sample : samples) {
+            if (KeepSample(sample, seed, density)) {
+                outSamples.push_back(sample);
+            }
+        }
+    }
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <functional>
+#include <vector>
+
+// A kind of tree to scatter. Two samples keep at least the larger of their
+// radii apart, so big crowns push everything away and small ones fill gaps.
+struct PoissonSpecies {
+    float radius = 4.0f;
+    float weight = 1.0f;  // Relative share of the candidates
+};
+
+struct PoissonSample {
+    glm::vec2 position;   // World XZ
+    int species;
+};
+
+// Chance in [0, 1] that a sample at a world XZ position survives. Thinning
+// a Poisson-disk set keeps its minimum distance, so clearings and edges do
+// not clump.
+using PlacementDensity = std::function<float(const glm::vec2& position)>;
+
+struct PoissonDiskSettings {
+    int attempts = 30;          // Candidates around an active sample before it retires
+    float tileSize = 0.0f;      // Parallel tile edge, 0 picks 16 times the largest radius
+    unsigned int threadCount = 0;  // 0 = hardware concurrency
+};
+
+// Bridson's sampling of one rectangle on a background grid with one sample
+// per cell. Samples in `neighbours` (e.g. from adjacent tiles) are respected
+// but not returned. The result only depends on the inputs and the seed.
+void SamplePoissonDiskRect(const glm::vec2& rectMin, const glm::vec2& rectMax,
+                           const std::vector<PoissonSpecies>& species, unsigned int seed,
+                           const std::vector<PoissonSample>& neighbours,
+                           const PlacementDensity& density, const PoissonDiskSettings& settings,
+                           std::vector<PoissonSample>& outSamples);
+
+// Samples a large area as a grid of tiles, in parallel. Tiles run in four
+// phases by tile parity, so tiles sampled together never touch, and every
+// tile sees the finished samples of its neighbours from earlier phases.
+// The output is in tile order and identical for any thread count.
+void SamplePoissonDisk(const glm::vec2& areaMin, const glm::vec2& areaMax,
+                       const std::vector<PoissonSpecies>& species, unsigned int seed,
+                       const PlacementDensity& density, const PoissonDiskSettings& settings,
+                       std::vector<PoissonSample>& outSamples);
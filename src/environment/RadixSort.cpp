@@ -0,0 +1,105 @@
+#include "RadixSort.h"
+#include <algorithm>
+
+// Below this many keys per block the threads cost more than they save
+static const size_t minBlockSize = 16384;
+
+RadixSorter::~RadixSorter() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto& worker : workers) worker.join();
+}
+
+void RadixSorter::ForEachBlock(size_t blockCount, const std::function<void(size_t)>& function) {
+    if (blockCount == 1) {
+        function(0);
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        while (workers.size() + 1 < blockCount) {
+            workers.emplace_back(&RadixSorter::WorkerLoop, this, workers.size() + 1, generation);
+        }
+        job = &function;
+        jobBlocks = blockCount;
+        running = blockCount - 1;
+        generation++;
+    }
+    wake.notify_all();
+
+    function(0);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [this] { return running == 0; });
+    job = nullptr;
+}
+
+void RadixSorter::WorkerLoop(size_t block, unsigned int seen) {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        wake.wait(lock, [&] { return stopping || generation != seen; });
+        if (stopping) return;
+        seen = generation;
+        if (block >= jobBlocks) continue;
+
+        const std::function<void(size_t)>& function = *job;
+        lock.unlock();
+        function(block);
+        lock.lock();
+        if (--running == 0) done.notify_one();
+    }
+}
+
+void RadixSorter::Sort(const std::vector<unsigned short>& keys, std::vector<unsigned int>& outOrder) {
+    size_t count = keys.size();
+    outOrder.resize(count);
+    if (count == 0) return;
+
+    size_t threads = std::max(1u, std::thread::hardware_concurrency());
+    size_t blockCount = std::max<size_t>(1, std::min(threads, count / minBlockSize));
+    size_t blockSize = (count + blockCount - 1) / blockCount;
+
+    keyScratch.resize(count);
+    indexScratch.resize(count);
+    histograms.resize(blockCount * 256);
+
+    // A null source index means the identity, a null destination key means
+    // the keys are not needed after this pass
+    auto pass = [&](int shift, const unsigned short* srcKeys, const unsigned int* srcIndices,
+                    unsigned short* dstKeys, unsigned int* dstIndices) {
+        std::fill(histograms.begin(), histograms.end(), 0u);
+        ForEachBlock(blockCount, [&](size_t block) {
+            unsigned int* histogram = &histograms[block * 256];
+            size_t end = std::min(count, (block + 1) * blockSize);
+            for (size_t i = block * blockSize; i < end; i++) {
+                histogram[(srcKeys[i] >> shift) & 0xFF]++;
+            }
+        });
+
+        // Digit-major, block-minor offsets keep equal keys in input order
+        unsigned int offset = 0;
+        for (int digit = 0; digit < 256; digit++) {
+            for (size_t block = 0; block < blockCount; block++) {
+                unsigned int bucket = histograms[block * 256 + digit];
+                histograms[block * 256 + digit] = offset;
+                offset += bucket;
+            }
+        }
+
+        ForEachBlock(blockCount, [&](size_t block) {
+            unsigned int* next = &histograms[block * 256];
+            size_t end = std::min(count, (block + 1) * blockSize);
+            for (size_t i = block * blockSize; i < end; i++) {
+                unsigned int slot = next[(srcKeys[i] >> shift) & 0xFF]++;
+                dstIndices[slot] = srcIndices ? srcIndices[i] : (unsigned int)i;
+                if (dstKeys) dstKeys[slot] = srcKeys[i];
+            }
+        });
+    };
+
+    pass(0, keys.data(), nullptr, keyScratch.data(), indexScratch.data());
+    pass(8, keyScratch.data(), indexScratch.data(), nullptr, outOrder.data());
+}
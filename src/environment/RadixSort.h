@@ -0,0 +1,44 @@
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Stable LSD radix sort of 16-bit keys in two 8-bit passes. Large inputs are
+// split into blocks that are histogrammed and scattered on separate threads,
+// small ones (a single tree's leaves) run on the calling thread. Scratch
+// buffers and worker threads persist between calls so a per-frame sort
+// neither allocates nor spawns threads.
+class RadixSorter {
+public:
+    RadixSorter() = default;
+    ~RadixSorter();
+    RadixSorter(const RadixSorter&) = delete;
+    RadixSorter& operator=(const RadixSorter&) = delete;
+
+    // Writes the indices of keys in ascending key order
+    void Sort(const std::vector<unsigned short>& keys, std::vector<unsigned int>& outOrder);
+
+private:
+    // Runs job for every block, block 0 on the calling thread and block i on
+    // worker i - 1. Workers are started the first time they are needed.
+    void ForEachBlock(size_t blockCount, const std::function<void(size_t)>& job);
+    void WorkerLoop(size_t block, unsigned int generation);
+
+    std::vector<unsigned short> keyScratch;
+    std::vector<unsigned int> indexScratch;
+    std::vector<unsigned int> histograms;  // 256 buckets per block
+
+    // Shared with the workers, guarded by mutex
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    std::vector<std::thread> workers;
+    const std::function<void(size_t)>* job = nullptr;
+    size_t jobBlocks = 0;
+    size_t running = 0;             // Workers still on the current job
+    unsigned int generation = 0;    // Bumped for every job
+    bool stopping = false;
+};
@@ -0,0 +1,276 @@
+#include "RingKernels.h"
+#include <cmath>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define RING_KERNELS_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define RING_TARGET_AVX2
+#else
+#include <cpuid.h>
+#define RING_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#endif
+#endif
+
+void RingBatch::Clear() {
+    centerX.clear(); centerY.clear(); centerZ.clear();
+    dirX.clear(); dirY.clear(); dirZ.clear();
+    radius.clear();
+}
+
+void RingBatch::Reserve(size_t count) {
+    centerX.reserve(count); centerY.reserve(count); centerZ.reserve(count);
+    dirX.reserve(count); dirY.reserve(count); dirZ.reserve(count);
+    radius.reserve(count);
+}
+
+void RingBatch::Push(const glm::vec3& center, const glm::vec3& direction, float r) {
+    centerX.push_back(center.x); centerY.push_back(center.y); centerZ.push_back(center.z);
+    dirX.push_back(direction.x); dirY.push_back(direction.y); dirZ.push_back(direction.z);
+    radius.push_back(r);
+}
+
+// Same basis choice as Tree::CreateVertexRing
+static void BuildRingBasis(const glm::vec3& direction, glm::vec3& right, glm::vec3& up) {
+    if (std::abs(direction.y) > 0.999f) {
+        right = glm::vec3(1.0f, 0.0f, 0.0f);
+    } else {
+        right = glm::cross(direction, glm::vec3(0.0f, 0.0f, 1.0f));
+        if (glm::dot(right, right) < 1e-4f) {
+            right = glm::cross(direction, glm::vec3(1.0f, 0.0f, 0.0f));
+        }
+        right = glm::normalize(right);
+    }
+    up = glm::cross(right, direction);
+}
+
+void BuildRingsScalar(const RingBatch& batch, size_t first, size_t count,
+                      const float* cosTable, const float* sinTable, int vertsPerRing,
+                      glm::vec3* outVertices, glm::vec3* outNormals) {
+    for (size_t i = first; i < first + count; i++) {
+        glm::vec3 center(batch.centerX[i], batch.centerY[i], batch.centerZ[i]);
+        glm::vec3 direction(batch.dirX[i], batch.dirY[i], batch.dirZ[i]);
+        float r = batch.radius[i];
+
+        glm::vec3 right, up;
+        BuildRingBasis(direction, right, up);
+
+        glm::vec3* vertices = outVertices + i * vertsPerRing;
+        glm::vec3* normals = outNormals + i * vertsPerRing;
+        for (int j = 0; j < vertsPerRing; j++) {
+            glm::vec3 offset = right * cosTable[j] + up * sinTable[j];
+            vertices[j] = center + offset * r;
+            normals[j] = offset;
+        }
+    }
+}
+
+#ifdef RING_KERNELS_X86
+
+static void BuildRingsSSE(const RingBatch& batch, size_t first, size_t count,
+                          const float* cosTable, const float* sinTable, int vertsPerRing,
+                          glm::vec3* outVertices, glm::vec3* outNormals) {
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+    const __m128 poleLimit = _mm_set1_ps(0.999f);
+    const __m128 degenerateLimit = _mm_set1_ps(1e-4f);
+
+    size_t end = first + count;
+    size_t i = first;
+    for (; i + 4 <= end; i += 4) {
+        __m128 dx = _mm_loadu_ps(&batch.dirX[i]);
+        __m128 dy = _mm_loadu_ps(&batch.dirY[i]);
+        __m128 dz = _mm_loadu_ps(&batch.dirZ[i]);
+
+        // right = cross(d, +Z), falling back to cross(d, +X) or +X near the poles
+        __m128 rx = dy;
+        __m128 ry = _mm_sub_ps(zero, dx);
+        __m128 rz = zero;
+        __m128 degenerate = _mm_cmplt_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), degenerateLimit);
+        rx = _mm_or_ps(_mm_and_ps(degenerate, zero), _mm_andnot_ps(degenerate, rx));
+        ry = _mm_or_ps(_mm_and_ps(degenerate, dz), _mm_andnot_ps(degenerate, ry));
+        rz = _mm_or_ps(_mm_and_ps(degenerate, _mm_sub_ps(zero, dy)), _mm_andnot_ps(degenerate, rz));
+
+        __m128 pole = _mm_cmpgt_ps(_mm_and_ps(dy, absMask), poleLimit);
+        rx = _mm_or_ps(_mm_and_ps(pole, one), _mm_andnot_ps(pole, rx));
+        ry = _mm_andnot_ps(pole, ry);
+        rz = _mm_andnot_ps(pole, rz);
+
+        __m128 len2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(rx, rx), _mm_mul_ps(ry, ry)), _mm_mul_ps(rz, rz));
+        __m128 invLen = _mm_div_ps(one, _mm_sqrt_ps(len2));
+        rx = _mm_mul_ps(rx, invLen);
+        ry = _mm_mul_ps(ry, invLen);
+        rz = _mm_mul_ps(rz, invLen);
+
+        // up = cross(right, d)
+        __m128 ux = _mm_sub_ps(_mm_mul_ps(ry, dz), _mm_mul_ps(rz, dy));
+        __m128 uy = _mm_sub_ps(_mm_mul_ps(rz, dx), _mm_mul_ps(rx, dz));
+        __m128 uz = _mm_sub_ps(_mm_mul_ps(rx, dy), _mm_mul_ps(ry, dx));
+
+        __m128 cx = _mm_loadu_ps(&batch.centerX[i]);
+        __m128 cy = _mm_loadu_ps(&batch.centerY[i]);
+        __m128 cz = _mm_loadu_ps(&batch.centerZ[i]);
+        __m128 r = _mm_loadu_ps(&batch.radius[i]);
+
+        alignas(16) float ox[4], oy[4], oz[4], vx[4], vy[4], vz[4];
+        for (int j = 0; j < vertsPerRing; j++) {
+            __m128 c = _mm_set1_ps(cosTable[j]);
+            __m128 s = _mm_set1_ps(sinTable[j]);
+            __m128 offX = _mm_add_ps(_mm_mul_ps(rx, c), _mm_mul_ps(ux, s));
+            __m128 offY = _mm_add_ps(_mm_mul_ps(ry, c), _mm_mul_ps(uy, s));
+            __m128 offZ = _mm_add_ps(_mm_mul_ps(rz, c), _mm_mul_ps(uz, s));
+            _mm_store_ps(ox, offX);
+            _mm_store_ps(oy, offY);
+            _mm_store_ps(oz, offZ);
+            _mm_store_ps(vx, _mm_add_ps(cx, _mm_mul_ps(offX, r)));
+            _mm_store_ps(vy, _mm_add_ps(cy, _mm_mul_ps(offY, r)));
+            _mm_store_ps(vz, _mm_add_ps(cz, _mm_mul_ps(offZ, r)));
+
+            for (int k = 0; k < 4; k++) {
+                size_t out = (i + k) * vertsPerRing + j;
+                outVertices[out] = glm::vec3(vx[k], vy[k], vz[k]);
+                outNormals[out] = glm::vec3(ox[k], oy[k], oz[k]);
+            }
+        }
+    }
+
+    if (i < end) {
+        BuildRingsScalar(batch, i, end - i, cosTable, sinTable, vertsPerRing, outVertices, outNormals);
+    }
+}
+
+RING_TARGET_AVX2
+static void BuildRingsAVX2(const RingBatch& batch, size_t first, size_t count,
+                           const float* cosTable, const float* sinTable, int vertsPerRing,
+                           glm::vec3* outVertices, glm::vec3* outNormals) {
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 absMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+    const __m256 poleLimit = _mm256_set1_ps(0.999f);
+    const __m256 degenerateLimit = _mm256_set1_ps(1e-4f);
+
+    size_t end = first + count;
+    size_t i = first;
+    for (; i + 8 <= end; i += 8) {
+        __m256 dx = _mm256_loadu_ps(&batch.dirX[i]);
+        __m256 dy = _mm256_loadu_ps(&batch.dirY[i]);
+        __m256 dz = _mm256_loadu_ps(&batch.dirZ[i]);
+
+        // right = cross(d, +Z), falling back to cross(d, +X) or +X near the poles
+        __m256 degenerate = _mm256_cmp_ps(_mm256_fmadd_ps(dx, dx, _mm256_mul_ps(dy, dy)),
+                                          degenerateLimit, _CMP_LT_OQ);
+        __m256 rx = _mm256_blendv_ps(dy, zero, degenerate);
+        __m256 ry = _mm256_blendv_ps(_mm256_sub_ps(zero, dx), dz, degenerate);
+        __m256 rz = _mm256_blendv_ps(zero, _mm256_sub_ps(zero, dy), degenerate);
+
+        __m256 pole = _mm256_cmp_ps(_mm256_and_ps(dy, absMask), poleLimit, _CMP_GT_OQ);
+        rx = _mm256_blendv_ps(rx, one, pole);
+        ry = _mm256_blendv_ps(ry, zero, pole);
+        rz = _mm256_blendv_ps(rz, zero, pole);
+
+        __m256 len2 = _mm256_fmadd_ps(rx, rx, _mm256_fmadd_ps(ry, ry, _mm256_mul_ps(rz, rz)));
+        __m256 invLen = _mm256_div_ps(one, _mm256_sqrt_ps(len2));
+        rx = _mm256_mul_ps(rx, invLen);
+        ry = _mm256_mul_ps(ry, invLen);
+        rz = _mm256_mul_ps(rz, invLen);
+
+        // up = cross(right, d)
+        __m256 ux = _mm256_fmsub_ps(ry, dz, _mm256_mul_ps(rz, dy));
+        __m256 uy = _mm256_fmsub_ps(rz, dx, _mm256_mul_ps(rx, dz));
+        __m256 uz = _mm256_fmsub_ps(rx, dy, _mm256_mul_ps(ry, dx));
+
+        __m256 cx = _mm256_loadu_ps(&batch.centerX[i]);
+        __m256 cy = _mm256_loadu_ps(&batch.centerY[i]);
+        __m256 cz = _mm256_loadu_ps(&batch.centerZ[i]);
+        __m256 r = _mm256_loadu_ps(&batch.radius[i]);
+
+        alignas(32) float ox[8], oy[8], oz[8], vx[8], vy[8], vz[8];
+        for (int j = 0; j < vertsPerRing; j++) {
+            __m256 c = _mm256_set1_ps(cosTable[j]);
+            __m256 s = _mm256_set1_ps(sinTable[j]);
+            __m256 offX = _mm256_fmadd_ps(rx, c, _mm256_mul_ps(ux, s));
+            __m256 offY = _mm256_fmadd_ps(ry, c, _mm256_mul_ps(uy, s));
+            __m256 offZ = _mm256_fmadd_ps(rz, c, _mm256_mul_ps(uz, s));
+            _mm256_store_ps(ox, offX);
+            _mm256_store_ps(oy, offY);
+            _mm256_store_ps(oz, offZ);
+            _mm256_store_ps(vx, _mm256_fmadd_ps(offX, r, cx));
+            _mm256_store_ps(vy, _mm256_fmadd_ps(offY, r, cy));
+            _mm256_store_ps(vz, _mm256_fmadd_ps(offZ, r, cz));
+
+            for (int k = 0; k < 8; k++) {
+                size_t out = (i + k) * vertsPerRing + j;
+                outVertices[out] = glm::vec3(vx[k], vy[k], vz[k]);
+                outNormals[out] = glm::vec3(ox[k], oy[k], oz[k]);
+            }
+        }
+    }
+
+    if (i < end) {
+        BuildRingsSSE(batch, i, end - i, cosTable, sinTable, vertsPerRing, outVertices, outNormals);
+    }
+}
+
+static void CpuId(int leaf, int subleaf, unsigned int regs[4]) {
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuidex(info, leaf, subleaf);
+    for (int i = 0; i < 4; i++) regs[i] = (unsigned int)info[i];
+#else
+    __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+static bool CpuSupportsAVX2() {
+    unsigned int regs[4];
+    CpuId(0, 0, regs);
+    if (regs[0] < 7) return false;
+
+    CpuId(1, 0, regs);
+    bool osxsave = (regs[2] & (1u << 27)) != 0;
+    bool avx = (regs[2] & (1u << 28)) != 0;
+    bool fma = (regs[2] & (1u << 12)) != 0;
+    if (!osxsave || !avx || !fma) return false;
+
+    // The OS must save YMM state on context switches
+#if defined(_MSC_VER)
+    unsigned long long xcr0 = _xgetbv(0);
+#else
+    unsigned int xcr0Low, xcr0High;
+    __asm__ volatile("xgetbv" : "=a"(xcr0Low), "=d"(xcr0High) : "c"(0));
+    unsigned long long xcr0 = ((unsigned long long)xcr0High << 32) | xcr0Low;
+#endif
+    if ((xcr0 & 0x6) != 0x6) return false;
+
+    CpuId(7, 0, regs);
+    return (regs[1] & (1u << 5)) != 0;
+}
+
+static bool CpuSupportsSSE2() {
+    unsigned int regs[4];
+    CpuId(1, 0, regs);
+    return (regs[3] & (1u << 26)) != 0;
+}
+
+#endif // RING_KERNELS_X86
+
+RingKernelFn SelectRingKernel() {
+#ifdef RING_KERNELS_X86
+    static RingKernelFn selected = CpuSupportsAVX2() ? BuildRingsAVX2
+                                 : CpuSupportsSSE2() ? BuildRingsSSE
+                                 : BuildRingsScalar;
+    return selected;
+#else
+    return BuildRingsScalar;
+#endif
+}
+
+const char* GetRingKernelName(RingKernelFn kernel) {
+#ifdef RING_KERNELS_X86
+    if (kernel == BuildRingsAVX2) return "AVX2";
+    if (kernel == BuildRingsSSE) return "SSE2";
+#endif
+    return "Scalar";
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <vector>
+
+// Structure-of-arrays description of a batch of vertex rings.
+// Directions must be normalized.
+struct RingBatch {
+    std::vector<float> centerX, centerY, centerZ;
+    std::vector<float> dirX, dirY, dirZ;
+    std::vector<float> radius;
+
+    void Clear();
+    void Reserve(size_t count);
+    void Push(const glm::vec3& center, const glm::vec3& direction, float radius);
+    size_t Size() const { return radius.size(); }
+};
+
+// Writes vertsPerRing vertices and normals per ring. Ring i starts at
+// outVertices[i * vertsPerRing]. cosTable/sinTable hold the ring angles.
+typedef void (*RingKernelFn)(const RingBatch& batch, size_t first, size_t count,
+                             const float* cosTable, const float* sinTable, int vertsPerRing,
+                             glm::vec3* outVertices, glm::vec3* outNormals);
+
+void BuildRingsScalar(const RingBatch& batch, size_t first, size_t count,
+                      const float* cosTable, const float* sinTable, int vertsPerRing,
+                      glm::vec3* outVertices, glm::vec3* outNormals);
+
+// Picks the widest kernel the CPU supports (AVX2 8-wide, SSE2 4-wide, scalar)
+RingKernelFn SelectRingKernel();
+const char* GetRingKernelName(RingKernelFn kernel);
@@ -153,10 +153,13 @@ void Sky::Render(Shader& shader, const glm::mat4& view, const glm::mat4& project
     glGetBooleanv(GL_DEPTH_WRITEMASK, &depthMask);
     GLint depthFunc;
     glGetIntegerv(GL_DEPTH_FUNC, &depthFunc);
+    GLboolean depthTest = glIsEnabled(GL_DEPTH_TEST);
     
-    // Configure for sky rendering
+    // Configure for sky rendering, drawn after the scene at the far plane
+    // so the cloud shader only runs where the cleared depth is still 1
     glDepthMask(GL_FALSE);
     glDepthFunc(GL_LEQUAL);
+    glEnable(GL_DEPTH_TEST);
     
     shader.Bind();
     
@@ -179,4 +182,5 @@ void Sky::Render(Shader& shader, const glm::mat4& view, const glm::mat4& project
     // Restore state
     glDepthMask(depthMask);
     glDepthFunc(depthFunc);
+    if (!depthTest) glDisable(GL_DEPTH_TEST);
 }
\ No newline at end of file
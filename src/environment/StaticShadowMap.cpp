@@ -0,0 +1,120 @@
+#include "StaticShadowMap.h"
+#include "Tree.h"
+#include <glm/gtc/matrix_transform.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+
+StaticShadowMap::StaticShadowMap()
+    : initialized(false), rendered(false), resolution(0), sunThreshold(0.5f),
+      depthTexture(0), framebuffer(0), revision(0), sunDirection(0.0f), treePosition(0.0f),
+      withLeaves(false), viewProjection(1.0f), depthRange(1.0f), renderCount(0) {
+}
+
+void StaticShadowMap::Init(int resolution) {
+    if (initialized) return;
+    this->resolution = std::max(resolution, 1);
+
+    // Hardware comparison with linear filtering, a 2x2 PCF per lookup
+    glGenTextures(1, &depthTexture);
+    glBindTexture(GL_TEXTURE_2D, depthTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, this->resolution, this->resolution,
+                 0, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    GLint boundFramebuffer = 0;
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &boundFramebuffer);
+    glGenFramebuffers(1, &framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthTexture, 0);
+    glDrawBuffer(GL_NONE);
+    glReadBuffer(GL_NONE);
+    bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+    glBindFramebuffer(GL_FRAMEBUFFER, boundFramebuffer);
+
+    initialized = true;
+    if (!complete) {
+        std::cerr << "Shadow map target is incomplete" << std::endl;
+        Clean();
+    }
+}
+
+void StaticShadowMap::Clean() {
+    if (!initialized) return;
+    glDeleteFramebuffers(1, &framebuffer);
+    glDeleteTextures(1, &depthTexture);
+    framebuffer = depthTexture = 0;
+    rendered = false;
+    initialized = false;
+}
+
+bool StaticShadowMap::Update(Tree& tree, Shader& treeShader, Shader& leafShader,
+                             const glm::vec3& sunDirection, bool withLeaves) {
+    if (!initialized) return false;
+
+    glm::vec3 sun = glm::normalize(sunDirection);
+    glm::vec3 position = glm::vec3(tree.GetModelMatrix()[3]);
+    if (rendered && revision == tree.GetRevision() && treePosition == position &&
+        this->withLeaves == withLeaves &&
+        glm::dot(sun, this->sunDirection) >= std::cos(glm::radians(sunThreshold))) {
+        return false;
+    }
+
+    glm::vec3 boundsMin, boundsMax;
+    tree.GetLocalBounds(boundsMin, boundsMax);
+    float radius = glm::length(boundsMax - boundsMin) * 0.5f;
+    if (radius <= 0.0f) return false;
+    auto start = std::chrono::high_resolution_clock::now();
+
+    // Orthographic over the bounding sphere, looking down the sun's rays
+    glm::vec3 center = position + (boundsMin + boundsMax) * 0.5f;
+    glm::vec3 up = std::abs(sun.y) > 0.999f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+    glm::mat4 view = glm::lookAt(center + sun * radius, center, up);
+    glm::mat4 projection = glm::ortho(-radius, radius, -radius, radius, 0.0f, 2.0f * radius);
+
+    GLint previousFramebuffer = 0, previousViewport[4];
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &previousFramebuffer);
+    glGetIntegerv(GL_VIEWPORT, previousViewport);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glViewport(0, 0, resolution, resolution);
+    glDepthMask(GL_TRUE);
+    glEnable(GL_DEPTH_TEST);
+    glClear(GL_DEPTH_BUFFER_BIT);
+    tree.RenderRestPose(treeShader, withLeaves ? &leafShader : nullptr, view, projection);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, previousFramebuffer);
+    glViewport(previousViewport[0], previousViewport[1], previousViewport[2], previousViewport[3]);
+
+    viewProjection = projection * view;
+    depthRange = 2.0f * radius;
+    revision = tree.GetRevision();
+    this->sunDirection = sun;
+    treePosition = position;
+    this->withLeaves = withLeaves;
+    rendered = true;
+    renderCount++;
+
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    std::cout << "Shadow map rendered: " << resolution << "px in " << ms << " ms" << std::endl;
+    return true;
+}
+
+void StaticShadowMap::Apply(Shader& shader, float casterBias) const {
+    glActiveTexture(GL_TEXTURE8);
+    glBindTexture(GL_TEXTURE_2D, depthTexture);
+    glActiveTexture(GL_TEXTURE0);
+
+    // Two texels of slack, plus whatever the caster needs on top
+    float texel = depthRange / resolution;
+    shader.SetUniform1i("u_ShadowMapping", rendered ? 1 : 0);
+    shader.SetUniformMat4f("u_ShadowViewProjection", viewProjection);
+    shader.SetUniform1f("u_ShadowBias", (2.0f * texel + casterBias) / depthRange);
+}
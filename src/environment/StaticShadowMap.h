@@ -0,0 +1,55 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include "Shader.h"
+
+class Tree;
+
+// Sun shadows of one tree, rendered once and reused every frame.
+// Branches and alpha-tested leaves go into an orthographic depth map around
+// the tree's bounds, in the rest pose. The map is only rendered again when
+// the tree is regenerated or moved, its leaves are switched on or off, or
+// the sun turns by more than the threshold. Receivers pay one filtered
+// comparison per fragment, tree.shader and leaf.shader's SunVisibility.
+class StaticShadowMap {
+public:
+    StaticShadowMap();
+
+    void Init(int resolution = 2048);
+    void Clean();
+    bool IsReady() const { return rendered; }
+
+    void SetSunThreshold(float degrees) { sunThreshold = degrees; }
+    float GetSunThreshold() const { return sunThreshold; }
+
+    // Renders the casters again if anything they depend on changed, needs
+    // the GL context. Returns true when it rendered.
+    bool Update(Tree& tree, Shader& treeShader, Shader& leafShader,
+                const glm::vec3& sunDirection, bool withLeaves);
+
+    // Binds the depth to unit 8 and sets the receiver uniforms. casterBias
+    // is in world units, on top of the couple of texels every receiver gets.
+    void Apply(Shader& shader, float casterBias) const;
+
+    int GetRenderCount() const { return renderCount; }
+    size_t GetGpuMemoryBytes() const { return (size_t)resolution * resolution * 4; }
+
+private:
+    bool initialized;
+    bool rendered;
+    int resolution;
+    float sunThreshold;  // Degrees
+    GLuint depthTexture;
+    GLuint framebuffer;
+
+    // What the cached map was rendered for
+    unsigned int revision;
+    glm::vec3 sunDirection;
+    glm::vec3 treePosition;
+    bool withLeaves;
+
+    glm::mat4 viewProjection;
+    float depthRange;  // World units covered by the depth buffer
+    int renderCount;
+};
@@ -0,0 +1,106 @@
+#include "StreamRingBuffer.h"
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+StreamRingBuffer::StreamRingBuffer()
+    : buffer(0), initialized(false), persistent(false), mapped(nullptr), slotSize(0), orphanSize(0), slot(0) {
+    for (int i = 0; i < slotCount; i++) fences[i] = 0;
+}
+
+void StreamRingBuffer::Init() {
+    glGenBuffers(1, &buffer);
+    persistent = GLEW_ARB_buffer_storage || GLEW_VERSION_4_4;
+    std::cout << "Leaf stream: " << (persistent ? "persistently mapped ring" : "orphaned buffer") << std::endl;
+    initialized = true;
+}
+
+void StreamRingBuffer::Clean() {
+    if (!initialized) return;
+    for (int i = 0; i < slotCount; i++) {
+        if (fences[i]) glDeleteSync(fences[i]);
+        fences[i] = 0;
+    }
+    if (mapped) {
+        glBindBuffer(GL_ARRAY_BUFFER, buffer);
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        mapped = nullptr;
+    }
+    glDeleteBuffers(1, &buffer);
+    buffer = 0;
+    slotSize = 0;
+    orphanSize = 0;
+    slot = 0;
+    initialized = false;
+}
+
+void StreamRingBuffer::WaitForSlot(int slotIndex) {
+    GLsync& fence = fences[slotIndex];
+    if (!fence) return;
+    // Only blocks if the GPU is more than two frames behind
+    GLbitfield flags = 0;
+    while (true) {
+        GLenum result = glClientWaitSync(fence, flags, 1000000);
+        if (result == GL_ALREADY_SIGNALED || result == GL_CONDITION_SATISFIED || result == GL_WAIT_FAILED) break;
+        flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+    }
+    glDeleteSync(fence);
+    fence = 0;
+}
+
+void StreamRingBuffer::Allocate(size_t bytes) {
+    // Storage is immutable, so growing means a new buffer. Everything in
+    // flight has to land first.
+    for (int i = 0; i < slotCount; i++) WaitForSlot(i);
+    if (mapped) {
+        glBindBuffer(GL_ARRAY_BUFFER, buffer);
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+        mapped = nullptr;
+    }
+    glDeleteBuffers(1, &buffer);
+    glGenBuffers(1, &buffer);
+
+    // Grow by half again to avoid reallocating on every small increase, and
+    // keep slots 256-byte aligned
+    slotSize = (std::max(bytes + bytes / 2, size_t(4096)) + 255) & ~size_t(255);
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    glBufferStorage(GL_ARRAY_BUFFER, slotSize * slotCount, nullptr, flags);
+    mapped = (unsigned char*)glMapBufferRange(GL_ARRAY_BUFFER, 0, slotSize * slotCount, flags);
+    if (!mapped) {
+        std::cerr << "Failed to map leaf stream buffer, falling back to orphaning" << std::endl;
+        glDeleteBuffers(1, &buffer);
+        glGenBuffers(1, &buffer);
+        glBindBuffer(GL_ARRAY_BUFFER, buffer);
+        persistent = false;
+    }
+    slot = 0;
+}
+
+GLintptr StreamRingBuffer::Upload(const void* data, size_t bytes) {
+    if (!persistent) {
+        // Orphan and refill so the driver never waits on last frame's draw
+        glBindBuffer(GL_ARRAY_BUFFER, buffer);
+        glBufferData(GL_ARRAY_BUFFER, bytes, nullptr, GL_STREAM_DRAW);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, bytes, data);
+        orphanSize = bytes;
+        return 0;
+    }
+
+    if (bytes > slotSize) Allocate(bytes);
+    if (!persistent) return Upload(data, bytes);
+
+    WaitForSlot(slot);
+    GLintptr offset = (GLintptr)(slot * slotSize);
+    memcpy(mapped + offset, data, bytes);
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    return offset;
+}
+
+void StreamRingBuffer::FinishSlot() {
+    if (!persistent || !mapped) return;
+    if (fences[slot]) glDeleteSync(fences[slot]);
+    fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    slot = (slot + 1) % slotCount;
+}
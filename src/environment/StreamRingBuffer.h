@@ -0,0 +1,44 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <cstddef>
+
+// Vertex data rewritten every frame, split into three frame slots so the CPU
+// fills one while the GPU may still read the other two. With
+// ARB_buffer_storage the whole ring stays persistently mapped and a fence per
+// slot guards reuse. Otherwise each upload orphans the buffer and lets the
+// driver rename it.
+class StreamRingBuffer {
+public:
+    static const int slotCount = 3;
+
+    StreamRingBuffer();
+
+    void Init();
+    void Clean();
+
+    // Copies bytes into the current slot, growing the ring if needed, and
+    // returns the offset to source attributes from. Leaves the buffer bound
+    // to GL_ARRAY_BUFFER.
+    GLintptr Upload(const void* data, size_t bytes);
+
+    // Call once the draws reading the current slot are issued
+    void FinishSlot();
+
+    GLuint GetBuffer() const { return buffer; }
+    bool IsPersistent() const { return persistent; }
+    size_t GetGpuMemoryBytes() const { return persistent ? slotSize * slotCount : orphanSize; }
+
+private:
+    void Allocate(size_t bytes);
+    void WaitForSlot(int slotIndex);
+
+    GLuint buffer;
+    bool initialized;
+    bool persistent;
+    unsigned char* mapped;
+    size_t slotSize;
+    size_t orphanSize;  // Last upload when orphaning
+    int slot;
+    GLsync fences[slotCount];
+};
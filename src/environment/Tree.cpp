@@ -1,16 +1,22 @@
 #include "Tree.h"
+#include "BlueNoise.h"
 #include <stack>
 #include <cmath>
 #include <iostream>
 #include <sstream>
 #include <cctype>
+#include <chrono>
+#include <algorithm>
 #define GLM_ENABLE_EXPERIMENTAL
 
 #include <glm/gtc/constants.hpp>
 #include <glm/gtx/rotate_vector.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
-#include "stb_image.h"
+// Matches the sun the Renderer hands to the sky
+static glm::vec3 SunDirection() {
+    return glm::normalize(glm::vec3(0.5f, 0.8f, -0.5f));
+}
 
 Tree::Tree() 
     : branchAngle(25.0f),
@@ -19,6 +25,13 @@ Tree::Tree()
       initialLength(4.0f),
       initialRadius(0.65f),
       radialSegments(8),
+      splineTessellation(false),
+      splineAngleTolerance(8.0f),
+      splineRadiusTolerance(0.2f),
+      pipeModelRadii(true),
+      pipeExponent(2.5f),
+      branchMesher(BranchMesher::Rings),
+      bakeOcclusion(true),
       angleRandomness(0.15f),
       lengthRandomness(0.1f),
       tropism(0.0f, -0.2f, 0.0f),
@@ -29,16 +42,30 @@ Tree::Tree()
       leafSize(0.3f),
       leafDensity(0.7f),
       minLeafDepth(3),
-      branchVAO(0), branchVBO(0), branchNBO(0), branchCBO(0), branchEBO(0),
-      leafVAO(0), leafVBO(0), leafUVBO(0), leafEBO(0), leafInstanceVBO(0),
+      leafBudget(6000),
+      leafVAO(0),
+      occlusion(nullptr),
+      leafVisibleVAO(0), drawnLeafCount(0),
+      leafAlphaToCoverage(true), leafAlphaTest(false),
+      leafGpuVAO(0),
       branchBuffersInitialized(false),
       leafBuffersInitialized(false),
-      leafTexture(0),
+      revision(0),
+      localBoundsMin(0.0f), localBoundsMax(0.0f),
+      leafTextures(nullptr),
+      leafLayer(0),
+      canopyTexture(0),
+      canopyShadowing(true),
+      shadowMap(nullptr),
+      ringBatchBaseVertex(0),
+      leafBoundsMin(0.0f), leafBoundsExtent(1.0f),
+      leafScaleMin(0.0f), leafScaleStep(0.0f),
+      windTime(0.0f),
       position(glm::vec3(0.0f))
 {
     axiom = "F";
     rules['F'] = "F[+F][-F]F";
-    srand(time(nullptr));
+    random.seed((unsigned int)time(nullptr));
 }
 
 Tree::~Tree() {
@@ -48,33 +75,33 @@ Tree::~Tree() {
 void Tree::Init(const glm::vec3& pos) {
     position = pos;
     
-    CreateLeafQuadTemplate();
-    
-    // Initialize OpenGL buffers for branches
-    glGenVertexArrays(1, &branchVAO);
-    glGenBuffers(1, &branchVBO);
-    glGenBuffers(1, &branchNBO);
-    glGenBuffers(1, &branchCBO);
-    glGenBuffers(1, &branchEBO);
+    // Branches, leaf instances and wind live in the shared heap
+    GeometryHeap::Get().Init();
     
-    // Initialize OpenGL buffers for leaves
+    // Initialize OpenGL objects for leaves
     glGenVertexArrays(1, &leafVAO);
-    glGenBuffers(1, &leafVBO);
-    glGenBuffers(1, &leafUVBO);
-    glGenBuffers(1, &leafEBO);
-    glGenBuffers(1, &leafInstanceVBO);
+    glGenVertexArrays(1, &leafVisibleVAO);
+    leafStream.Init();
+    glGenVertexArrays(1, &leafGpuVAO);
+    leafGpuCuller.Init();
     
     SetupLeafBuffers();
     
     branchBuffersInitialized = true;
     leafBuffersInitialized = true;
     
+    // A tree generated before Init, e.g. on a worker thread, uploads now
+    if (revision > 0) {
+        UploadBuffers();
+    }
+    
     std::cout << "Tree initialized at position: (" 
               << position.x << ", " << position.y << ", " << position.z << ")" << std::endl;
 }
 
 float Tree::RandomFloat(float min, float max) {
-    return min + static_cast<float>(rand()) / (static_cast<float>(RAND_MAX / (max - min)));
+    // Per tree, so trees can be generated on several threads and reproduced from a seed
+    return min + (max - min) * static_cast<float>(random() - random.min()) / static_cast<float>(random.max() - random.min());
 }
 
 float Tree::ApplyRandomness(float value, float randomness) {
@@ -121,107 +148,69 @@ SegmentParams Tree::ParseSegmentParams(const std::string& str, size_t& pos) {
     return params;
 }
 
-void Tree::CreateLeafQuadTemplate() {
-    leafQuadVertices.clear();
-    leafQuadUVs.clear();
-    leafQuadIndices.clear();
-    
-    leafQuadVertices = {
-        glm::vec3(-0.5f, -0.5f, 0.0f),
-        glm::vec3( 0.5f, -0.5f, 0.0f),
-        glm::vec3( 0.5f,  0.5f, 0.0f),
-        glm::vec3(-0.5f,  0.5f, 0.0f)
-    };
-    
-    leafQuadUVs = {
-        glm::vec2(0.0f, 0.0f),
-        glm::vec2(1.0f, 0.0f),
-        glm::vec2(1.0f, 1.0f),
-        glm::vec2(0.0f, 1.0f)
-    };
-    
-    leafQuadIndices = { 0, 1, 2, 0, 2, 3 };
-}
-
-void Tree::SetupLeafBuffers() {
-    glBindVertexArray(leafVAO);
-    
-    glBindBuffer(GL_ARRAY_BUFFER, leafVBO);
-    glBufferData(GL_ARRAY_BUFFER, leafQuadVertices.size() * sizeof(glm::vec3), 
-                 leafQuadVertices.data(), GL_STATIC_DRAW);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*)0);
+void Tree::SetLeafInstanceAttributes(GLintptr baseOffset) {
+    // PackedLeafInstance layout for the buffer bound to GL_ARRAY_BUFFER
+    glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(PackedLeafInstance), 
+                         (void*)(baseOffset + offsetof(PackedLeafInstance, position)));
     glEnableVertexAttribArray(0);
+    glVertexAttribDivisor(0, 1);
     
-    glBindBuffer(GL_ARRAY_BUFFER, leafUVBO);
-    glBufferData(GL_ARRAY_BUFFER, leafQuadUVs.size() * sizeof(glm::vec2), 
-                 leafQuadUVs.data(), GL_STATIC_DRAW);
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(glm::vec2), (void*)0);
+    glVertexAttribPointer(1, 1, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(PackedLeafInstance), 
+                         (void*)(baseOffset + offsetof(PackedLeafInstance, occlusion)));
     glEnableVertexAttribArray(1);
+    glVertexAttribDivisor(1, 1);
     
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, leafEBO);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, leafQuadIndices.size() * sizeof(unsigned int), 
-                 leafQuadIndices.data(), GL_STATIC_DRAW);
-    
-    glBindBuffer(GL_ARRAY_BUFFER, leafInstanceVBO);
-    
-    glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(LeafInstance), 
-                         (void*)offsetof(LeafInstance, position));
+    glVertexAttribIPointer(2, 1, GL_UNSIGNED_INT, sizeof(PackedLeafInstance), 
+                          (void*)(baseOffset + offsetof(PackedLeafInstance, seedScale)));
     glEnableVertexAttribArray(2);
     glVertexAttribDivisor(2, 1);
     
-    glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(LeafInstance), 
-                         (void*)offsetof(LeafInstance, normal));
+    glVertexAttribIPointer(3, 1, GL_UNSIGNED_INT, sizeof(PackedLeafInstance), 
+                          (void*)(baseOffset + offsetof(PackedLeafInstance, branchLayer)));
     glEnableVertexAttribArray(3);
     glVertexAttribDivisor(3, 1);
     
-    glVertexAttribPointer(4, 2, GL_FLOAT, GL_FALSE, sizeof(LeafInstance), 
-                         (void*)offsetof(LeafInstance, scale));
+    glVertexAttribPointer(4, 1, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(PackedLeafInstance), 
+                         (void*)(baseOffset + offsetof(PackedLeafInstance, rank)));
     glEnableVertexAttribArray(4);
     glVertexAttribDivisor(4, 1);
+}
+
+void Tree::SetupLeafBuffers() {
+    // Quad corners come from gl_VertexID, only the instance stream is bound.
+    // leafVAO reads every instance, leafVisibleVAO the culled per-frame stream
+    // and leafGpuVAO the copy compacted by the GPU culler.
+    // leafVAO is pointed at the heap range on every instance upload,
+    // leafVisibleVAO at the current stream slot on every stream upload
     
-    glVertexAttribPointer(5, 1, GL_FLOAT, GL_FALSE, sizeof(LeafInstance), 
-                         (void*)offsetof(LeafInstance, rotation));
-    glEnableVertexAttribArray(5);
-    glVertexAttribDivisor(5, 1);
-    
-    glVertexAttribPointer(6, 3, GL_FLOAT, GL_FALSE, sizeof(LeafInstance), 
-                         (void*)offsetof(LeafInstance, color));
-    glEnableVertexAttribArray(6);
-    glVertexAttribDivisor(6, 1);
+    glBindVertexArray(leafGpuVAO);
+    glBindBuffer(GL_ARRAY_BUFFER, leafGpuCuller.GetOutputBuffer());
+    SetLeafInstanceAttributes();
     
     glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
 }
 
 void Tree::SetupBranchBuffers() {
-    glBindVertexArray(branchVAO);
-    
-    // Vertex positions
-    glBindBuffer(GL_ARRAY_BUFFER, branchVBO);
-    glBufferData(GL_ARRAY_BUFFER, branchVertices.size() * sizeof(glm::vec3), 
-                 branchVertices.data(), GL_STATIC_DRAW);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*)0);
-    glEnableVertexAttribArray(0);
-    
-    // Normals
-    glBindBuffer(GL_ARRAY_BUFFER, branchNBO);
-    glBufferData(GL_ARRAY_BUFFER, branchNormals.size() * sizeof(glm::vec3), 
-                 branchNormals.data(), GL_STATIC_DRAW);
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*)0);
-    glEnableVertexAttribArray(1);
-    
-    // Colors
-    glBindBuffer(GL_ARRAY_BUFFER, branchCBO);
-    glBufferData(GL_ARRAY_BUFFER, branchColors.size() * sizeof(glm::vec3), 
-                 branchColors.data(), GL_STATIC_DRAW);
-    glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*)0);
-    glEnableVertexAttribArray(2);
-    
-    // Indices
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, branchEBO);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, branchIndices.size() * sizeof(unsigned int), 
-                 branchIndices.data(), GL_STATIC_DRAW);
+    GeometryHeap& heap = GeometryHeap::Get();
+    heap.GetBranchVertices().Free(branchVertexRange);
+    heap.GetBranchIndices().Free(branchIndexRange);
+    if (branchVertices.empty()) return;
+    
+    // Interleaved, with wind indices into the heap's shared table
+    std::vector<BranchVertex> vertices(branchVertices.size());
+    for (size_t i = 0; i < vertices.size(); i++) {
+        vertices[i].position = branchVertices[i];
+        vertices[i].normal = branchNormals[i];
+        vertices[i].color = branchColors[i];
+        vertices[i].occlusion = branchOcclusion[i];
+        vertices[i].windBranch = windRange.offset + branchWindIndices[i];
+    }
     
-    glBindVertexArray(0);
+    branchVertexRange = heap.GetBranchVertices().Allocate(vertices.size());
+    heap.GetBranchVertices().Upload(branchVertexRange, vertices.data());
+    branchIndexRange = heap.GetBranchIndices().Allocate(branchIndices.size());
+    heap.GetBranchIndices().Upload(branchIndexRange, branchIndices.data());
 }
 
 void Tree::AddRule(char symbol, const std::string& replacement) {
@@ -230,7 +219,7 @@ void Tree::AddRule(char symbol, const std::string& replacement) {
 
 void Tree::InterpretLSystemRecursive(char symbol, int depth, int maxDepth, 
                                      TurtleState& turtle, std::stack<TurtleState>& stack,
-                                     int currentSegmentIndex) {
+                                     int& currentSegmentIndex) {
     bool shouldExpand = (depth < maxDepth) && (rules.find(symbol) != rules.end());
     
     if (shouldExpand) {
@@ -433,10 +422,16 @@ void Tree::Generate(int iterations) {
     // Clear previous data
     branchSegments.clear();
     leafInstances.clear();
+    packedLeafInstances.clear();
     branchVertices.clear();
     branchNormals.clear();
     branchColors.clear();
+    branchOcclusion.clear();
+    branchWindIndices.clear();
     branchIndices.clear();
+    branchChunks.clear();
+    windBranches.clear();
+    segmentWindBranch.clear();
     
     // Clear stacks
     while (!segmentIndexStack.empty()) segmentIndexStack.pop();
@@ -449,7 +444,7 @@ void Tree::Generate(int iterations) {
     
     // Initialize turtle state
     TurtleState turtle;
-    turtle.position = position;
+    turtle.position = glm::vec3(0.0f);  // Local space, placed by GetModelMatrix
     turtle.direction = glm::vec3(0.0f, 1.0f, 0.0f);
     turtle.right = glm::vec3(1.0f, 0.0f, 0.0f);
     turtle.up = glm::vec3(0.0f, 0.0f, 1.0f);
@@ -486,25 +481,128 @@ void Tree::Generate(int iterations) {
     
     std::cout << "Branch segments created: " << branchSegments.size() << std::endl;
     
-    // Generate continuous mesh from segments
-    GenerateContinuousMesh();
+    if (pipeModelRadii) {
+        CalculateSegmentRadii();
+    }
+    BuildWindHierarchy();
+    
+    // Generate branch mesh from segments
+    if (branchMesher == BranchMesher::Implicit) {
+        GenerateImplicitMesh();
+    } else {
+        GenerateContinuousMesh();
+    }
     
     std::cout << "Continuous mesh: " << branchVertices.size() << " vertices, "
               << branchIndices.size() / 3 << " triangles" << std::endl;
     
     // Generate leaves
     GenerateLeavesAtEndpoints();
+    BuildLeafClusters();
     std::cout << "Leaf instances created: " << leafInstances.size() << std::endl;
     
-    // Update buffers
+    // Bake ambient occlusion into the new vertices and leaves
+    BakeAmbientOcclusion();
+    BuildCanopyVolume();
+    PackLeafInstances();
+    
+    // Local bounds of everything drawn, leaf cards included
+    localBoundsMin = glm::vec3(1e30f);
+    localBoundsMax = glm::vec3(-1e30f);
+    for (const auto& vertex : branchVertices) {
+        localBoundsMin = glm::min(localBoundsMin, vertex);
+        localBoundsMax = glm::max(localBoundsMax, vertex);
+    }
+    for (const auto& leaf : leafInstances) {
+        localBoundsMin = glm::min(localBoundsMin, leaf.position - glm::vec3(leaf.scale));
+        localBoundsMax = glm::max(localBoundsMax, leaf.position + glm::vec3(leaf.scale));
+    }
+    if (localBoundsMin.x > localBoundsMax.x) {
+        localBoundsMin = localBoundsMax = glm::vec3(0.0f);
+    }
+    revision++;
+    
+    UploadBuffers();
+    
+    std::cout << "Tree generation complete!" << std::endl;
+}
+
+void Tree::UploadBuffers() {
     if (branchBuffersInitialized) {
+        // Branch vertices point into the wind range, so it goes first
+        UpdateWindBuffer();
         SetupBranchBuffers();
     }
     if (leafBuffersInitialized) {
         UpdateLeafInstanceBuffer();
+        UpdateCanopyTexture();
     }
+}
+
+size_t Tree::GetGpuMemoryBytes() const {
+    // This tree's share of the geometry heap. The leaf instances are counted
+    // twice for the GPU culler's output copy, plus the streaming ring.
+    size_t bytes = branchVertices.size() * sizeof(BranchVertex);
+    bytes += branchIndices.size() * sizeof(unsigned short);
+    bytes += windBranches.size() * 2 * sizeof(glm::vec4);
+    bytes += packedLeafInstances.size() * sizeof(PackedLeafInstance) * 2;
+    bytes += leafStream.GetGpuMemoryBytes();
+    if (canopyTexture != 0) {
+        const glm::ivec3& size = canopyVolume.GetDimensions();
+        bytes += (size_t)size.x * size.y * size.z * 2;
+    }
+    return bytes;
+}
+
+size_t Tree::GetCpuMemoryBytes() const {
+    size_t bytes = branchVertices.capacity() * sizeof(glm::vec3);
+    bytes += branchNormals.capacity() * sizeof(glm::vec3);
+    bytes += branchColors.capacity() * sizeof(glm::vec3);
+    bytes += branchOcclusion.capacity() * sizeof(float);
+    bytes += branchWindIndices.capacity() * sizeof(unsigned int);
+    bytes += branchIndices.capacity() * sizeof(unsigned short);
+    bytes += branchSegments.capacity() * sizeof(BranchSegment);
+    bytes += windBranches.capacity() * sizeof(WindBranch);
+    bytes += leafInstances.capacity() * sizeof(LeafInstance);
+    bytes += (packedLeafInstances.capacity() + visibleLeafInstances.capacity() + sortedLeafInstances.capacity())
+             * sizeof(PackedLeafInstance);
+    bytes += canopyVolume.GetOpticalDepth().capacity() * sizeof(float);
+    return bytes;
+}
+
+void Tree::CalculateSegmentRadii() {
+    if (branchSegments.empty()) return;
     
-    std::cout << "Tree generation complete!" << std::endl;
+    // Segments are stored in pre-order, so every child has a larger index than
+    // its parent and one reverse sweep sees all children before their parent.
+    // Radii are accumulated as r^n with a unit tip, each segment adding one
+    // unit of its own so unbranched limbs still taper toward the tips.
+    const float n = std::max(pipeExponent, 1.0f);
+    std::vector<float> endPipe(branchSegments.size(), 0.0f);
+    float rootPipe = 0.0f;
+    
+    for (int i = (int)branchSegments.size() - 1; i >= 0; i--) {
+        BranchSegment& seg = branchSegments[i];
+        
+        float end = endPipe[i] > 0.0f ? endPipe[i] : 1.0f;
+        float start = end + 1.0f;
+        
+        seg.endRadius = std::pow(end, 1.0f / n);
+        seg.startRadius = std::pow(start, 1.0f / n);
+        
+        if (seg.parentIndex >= 0) {
+            endPipe[seg.parentIndex] += start;
+        } else {
+            rootPipe = std::max(rootPipe, seg.startRadius);
+        }
+    }
+    
+    // Scale everything so the thickest root matches initialRadius
+    float scale = initialRadius / rootPipe;
+    for (auto& seg : branchSegments) {
+        seg.startRadius *= scale;
+        seg.endRadius *= scale;
+    }
 }
 
 void Tree::CreateVertexRing(const glm::vec3& center, const glm::vec3& direction,
@@ -540,15 +638,105 @@ void Tree::CreateVertexRing(const glm::vec3& center, const glm::vec3& direction,
     }
 }
 
+void Tree::BuildRingTables() {
+    if (ringCosTable.size() == (size_t)radialSegments + 1) return;
+    
+    ringCosTable.resize(radialSegments + 1);
+    ringSinTable.resize(radialSegments + 1);
+    for (int i = 0; i <= radialSegments; i++) {
+        float theta = (float)i / radialSegments * 2.0f * glm::pi<float>();
+        ringCosTable[i] = cos(theta);
+        ringSinTable[i] = sin(theta);
+    }
+}
+
+unsigned int Tree::QueueVertexRing(const glm::vec3& center, const glm::vec3& direction, float radius) {
+    // Queued rings are written back-to-back, so nothing else may append
+    // vertices until FlushVertexRings runs
+    unsigned int firstVertex = branchVertices.size();
+    if (ringBatch.Size() == 0) {
+        ringBatchBaseVertex = firstVertex;
+    }
+    
+    ringBatch.Push(center, direction, radius);
+    branchVertices.resize(firstVertex + radialSegments + 1);
+    branchNormals.resize(firstVertex + radialSegments + 1);
+    return firstVertex;
+}
+
+void Tree::FlushVertexRings() {
+    if (ringBatch.Size() == 0) return;
+    
+    BuildRingTables();
+    RingKernelFn kernel = SelectRingKernel();
+    kernel(ringBatch, 0, ringBatch.Size(), ringCosTable.data(), ringSinTable.data(),
+           radialSegments + 1, branchVertices.data() + ringBatchBaseVertex,
+           branchNormals.data() + ringBatchBaseVertex);
+    
+    ringBatch.Clear();
+}
+
+void Tree::BenchmarkRingKernels(int repetitions) {
+    if (branchSegments.empty() || repetitions <= 0) return;
+    
+    using Clock = std::chrono::high_resolution_clock;
+    
+    RingBatch batch;
+    batch.Reserve(branchSegments.size() * 2);
+    for (const auto& seg : branchSegments) {
+        glm::vec3 direction = glm::normalize(seg.endPos - seg.startPos);
+        batch.Push(seg.startPos, direction, seg.startRadius);
+        batch.Push(seg.endPos, direction, seg.endRadius);
+    }
+    
+    const int vertsPerRing = radialSegments + 1;
+    BuildRingTables();
+    std::vector<glm::vec3> vertices(batch.Size() * vertsPerRing);
+    std::vector<glm::vec3> normals(batch.Size() * vertsPerRing);
+    
+    // Current path: one ring at a time through CreateVertexRing
+    auto start = Clock::now();
+    for (int r = 0; r < repetitions; r++) {
+        std::vector<glm::vec3> ringVertices, ringNormals;
+        ringVertices.reserve(vertices.size());
+        ringNormals.reserve(normals.size());
+        for (size_t i = 0; i < batch.Size(); i++) {
+            glm::vec3 center(batch.centerX[i], batch.centerY[i], batch.centerZ[i]);
+            glm::vec3 direction(batch.dirX[i], batch.dirY[i], batch.dirZ[i]);
+            CreateVertexRing(center, direction, batch.radius[i], ringVertices, ringNormals);
+        }
+    }
+    double perRingMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count() / repetitions;
+    
+    auto timeKernel = [&](RingKernelFn kernel) {
+        auto kernelStart = Clock::now();
+        for (int r = 0; r < repetitions; r++) {
+            kernel(batch, 0, batch.Size(), ringCosTable.data(), ringSinTable.data(),
+                   vertsPerRing, vertices.data(), normals.data());
+        }
+        return std::chrono::duration<double, std::milli>(Clock::now() - kernelStart).count() / repetitions;
+    };
+    
+    double scalarMs = timeKernel(BuildRingsScalar);
+    RingKernelFn selected = SelectRingKernel();
+    double selectedMs = timeKernel(selected);
+    
+    std::cout << "Ring benchmark (" << batch.Size() << " rings, " << vertsPerRing
+              << " verts/ring, " << repetitions << " runs):" << std::endl;
+    std::cout << "  CreateVertexRing: " << perRingMs << " ms" << std::endl;
+    std::cout << "  Batched scalar:   " << scalarMs << " ms" << std::endl;
+    std::cout << "  Batched " << GetRingKernelName(selected) << ": " << selectedMs << " ms" << std::endl;
+}
+
 void Tree::ConnectRings(int startRingIndex, int endRingIndex,
-                       std::vector<unsigned int>& indices) {
+                       std::vector<unsigned short>& indices) {
     int vertsPerRing = radialSegments + 1;
     
     for (int i = 0; i < radialSegments; i++) {
-        unsigned int bottomLeft = startRingIndex + i;
-        unsigned int bottomRight = startRingIndex + i + 1;
-        unsigned int topLeft = endRingIndex + i;
-        unsigned int topRight = endRingIndex + i + 1;
+        unsigned short bottomLeft = startRingIndex + i;
+        unsigned short bottomRight = startRingIndex + i + 1;
+        unsigned short topLeft = endRingIndex + i;
+        unsigned short topRight = endRingIndex + i + 1;
         
         // First triangle
         indices.push_back(bottomLeft);
@@ -562,6 +750,141 @@ void Tree::ConnectRings(int startRingIndex, int endRingIndex,
     }
 }
 
+bool Tree::ReserveChunkVertices(unsigned int vertexCount) {
+    // 16-bit indices address at most 65535 vertices per chunk
+    const unsigned int MAX_CHUNK_VERTICES = 65535;
+    
+    unsigned int totalVertices = branchVertices.size();
+    
+    if (!branchChunks.empty()) {
+        const BranchChunk& current = branchChunks.back();
+        if (totalVertices + vertexCount - current.baseVertex <= MAX_CHUNK_VERTICES) {
+            return false;
+        }
+        branchChunks.back().vertexCount = totalVertices - current.baseVertex;
+        branchChunks.back().indexCount = branchIndices.size() - current.indexOffset;
+    }
+    
+    BranchChunk chunk;
+    chunk.baseVertex = totalVertices;
+    chunk.vertexCount = 0;
+    chunk.indexOffset = branchIndices.size();
+    chunk.indexCount = 0;
+    chunk.boundsMin = glm::vec3(0.0f);
+    chunk.boundsMax = glm::vec3(0.0f);
+    branchChunks.push_back(chunk);
+    return true;
+}
+
+void Tree::FinalizeBranchChunks() {
+    if (branchChunks.empty()) return;
+    
+    BranchChunk& last = branchChunks.back();
+    last.vertexCount = branchVertices.size() - last.baseVertex;
+    last.indexCount = branchIndices.size() - last.indexOffset;
+    
+    for (auto& chunk : branchChunks) {
+        if (chunk.vertexCount == 0) continue;
+        
+        chunk.boundsMin = branchVertices[chunk.baseVertex];
+        chunk.boundsMax = branchVertices[chunk.baseVertex];
+        for (unsigned int v = chunk.baseVertex; v < chunk.baseVertex + chunk.vertexCount; v++) {
+            chunk.boundsMin = glm::min(chunk.boundsMin, branchVertices[v]);
+            chunk.boundsMax = glm::max(chunk.boundsMax, branchVertices[v]);
+        }
+    }
+}
+
+void Tree::BuildWindHierarchy() {
+    windBranches.clear();
+    segmentWindBranch.assign(branchSegments.size(), -1);
+    if (branchSegments.empty()) return;
+    
+    // A child continues its parent's branch if it is the straightest child
+    // and bends less than this, otherwise it starts a new level
+    const float continueCos = cos(glm::radians(25.0f));
+    float rootRadius = std::max(branchSegments[0].startRadius, 1e-4f);
+    
+    // Segments are stored in pre-order, so parents are always assigned first
+    for (size_t i = 0; i < branchSegments.size(); i++) {
+        const BranchSegment& segment = branchSegments[i];
+        glm::vec3 direction = glm::normalize(segment.endPos - segment.startPos);
+        
+        bool continues = false;
+        if (segment.parentIndex >= 0) {
+            const BranchSegment& parent = branchSegments[segment.parentIndex];
+            glm::vec3 parentDirection = glm::normalize(parent.endPos - parent.startPos);
+            float alignment = glm::dot(direction, parentDirection);
+            
+            int straightest = -1;
+            float bestAlignment = -2.0f;
+            for (int child : parent.childIndices) {
+                const BranchSegment& sibling = branchSegments[child];
+                float a = glm::dot(glm::normalize(sibling.endPos - sibling.startPos), parentDirection);
+                if (a > bestAlignment) {
+                    bestAlignment = a;
+                    straightest = child;
+                }
+            }
+            continues = straightest == (int)i && alignment > continueCos;
+        }
+        
+        if (continues) {
+            segmentWindBranch[i] = segmentWindBranch[segment.parentIndex];
+            continue;
+        }
+        
+        WindBranch branch;
+        branch.pivot = segment.startPos;
+        branch.stiffness = glm::clamp(segment.startRadius / rootRadius, 0.0f, 1.0f);
+        branch.parent = segment.parentIndex >= 0 ? segmentWindBranch[segment.parentIndex] : -1;
+        branch.depth = branch.parent >= 0 ? windBranches[branch.parent].depth + 1 : 0;
+        branch.phase = HashFloat((unsigned int)windBranches.size() * 0x9e3779b9u) * glm::two_pi<float>();
+        segmentWindBranch[i] = windBranches.size();
+        windBranches.push_back(branch);
+    }
+    
+    int maxDepth = 0;
+    for (const auto& branch : windBranches) maxDepth = std::max(maxDepth, branch.depth);
+    std::cout << "Wind hierarchy: " << windBranches.size() << " branches, " << maxDepth + 1 << " levels" << std::endl;
+}
+
+void Tree::UpdateWindBuffer() {
+    // A dummy branch keeps windRange valid for trees without segments
+    HeapBuffer& heapBranches = GeometryHeap::Get().GetWindBranches();
+    heapBranches.Free(windRange);
+    windRange = heapBranches.Allocate(std::max<size_t>(windBranches.size(), 1));
+    
+    // Two RGBA32F texels per branch: pivot and stiffness, then parent index,
+    // depth and phase. Parents are rebased onto the shared table.
+    std::vector<glm::vec4> texels;
+    texels.reserve(windRange.count * 2);
+    for (const auto& branch : windBranches) {
+        float parent = branch.parent >= 0 ? (float)(windRange.offset + branch.parent) : -1.0f;
+        texels.push_back(glm::vec4(branch.pivot, branch.stiffness));
+        texels.push_back(glm::vec4(parent, (float)branch.depth, branch.phase, 0.0f));
+    }
+    if (texels.empty()) {
+        texels.push_back(glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+        texels.push_back(glm::vec4(-1.0f, 0.0f, 0.0f, 0.0f));
+    }
+    heapBranches.Upload(windRange, texels.data());
+}
+
+void Tree::ApplyWindUniforms(Shader& shader) {
+    // Unit 1, leaf.shader keeps its texture on unit 0
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_BUFFER, GeometryHeap::Get().GetWindTexture());
+    glActiveTexture(GL_TEXTURE0);
+    shader.SetUniform1i("u_WindBranches", 1);
+    
+    float heading = glm::radians(windSettings.heading);
+    shader.SetUniform3f("u_WindDirection", cos(heading), 0.0f, sin(heading));
+    shader.SetUniform1f("u_WindStrength", windSettings.enabled ? windSettings.strength : 0.0f);
+    shader.SetUniform1f("u_WindFrequency", windSettings.frequency);
+    shader.SetUniform1f("u_Time", windTime);
+}
+
 glm::vec3 Tree::CalculateBranchColor(int depth, float radiusRatio) {
     float depthFactor = 1.0f - (depth * 0.05f);
     depthFactor = glm::clamp(depthFactor, 0.5f, 1.0f);
@@ -575,12 +898,12 @@ void Tree::GenerateContinuousMesh() {
     
     std::cout << "Building continuous mesh from " << branchSegments.size() << " segments..." << std::endl;
     
-    // Store ring start indices for each segment
-    std::vector<int> segmentStartRings(branchSegments.size(), -1);
-    std::vector<int> segmentEndRings(branchSegments.size(), -1);
+    const int vertsPerRing = radialSegments + 1;
+    ringBatch.Clear();
+    ringBatch.Reserve(branchSegments.size() * 2);
     
-    // Map to track shared junction vertices (position -> vertex ring index)
-    std::map<std::tuple<float, float, float>, int> junctionRings;
+    // Map to track shared junction vertices (position -> first vertex of the ring)
+    std::map<std::tuple<float, float, float>, unsigned int> junctionRings;
     
     auto positionKey = [](const glm::vec3& pos) {
         float precision = 1000.0f; // Round to 3 decimal places
@@ -591,163 +914,593 @@ void Tree::GenerateContinuousMesh() {
         );
     };
     
-    // Generate rings for each segment, reusing junction vertices
-    for (size_t i = 0; i < branchSegments.size(); i++) {
-        const BranchSegment& seg = branchSegments[i];
+    // Walk the segment tree depth-first so that every subtree is emitted
+    // contiguously and chunk cuts fall between a segment and its parent.
+    // Each stack entry starts a chain; without spline tessellation a chain
+    // is always a single segment.
+    std::vector<int> dfsStack;
+    for (int i = (int)branchSegments.size() - 1; i >= 0; i--) {
+        if (branchSegments[i].parentIndex < 0) dfsStack.push_back(i);
+    }
+    
+    std::vector<int> chain;
+    std::vector<RingSample> samples;
+    
+    // SampleChainRings emits at most 8 rings per segment; keep a whole chain
+    // inside one 16-bit chunk
+    const size_t maxChainLength = std::max(1, (65535 / vertsPerRing - 1) / 8);
+    
+    while (!dfsStack.empty()) {
+        int first = dfsStack.back();
+        dfsStack.pop_back();
         
-        glm::vec3 direction = glm::normalize(seg.endPos - seg.startPos);
+        chain.clear();
+        chain.push_back(first);
+        while (splineTessellation && chain.size() < maxChainLength &&
+               branchSegments[chain.back()].childIndices.size() == 1) {
+            chain.push_back(branchSegments[chain.back()].childIndices[0]);
+        }
+        
+        samples.clear();
+        SampleChainRings(chain, samples);
+        
+        const BranchSegment& firstSeg = branchSegments[chain.front()];
+        const BranchSegment& lastSeg = branchSegments[chain.back()];
+        
+        // Rings from a previous chunk cannot be indexed from this one
+        if (ReserveChunkVertices(samples.size() * vertsPerRing)) {
+            junctionRings.clear();
+        }
+        unsigned int chunkBase = branchChunks.back().baseVertex;
         
         // Check if start position already has a ring (junction vertex sharing)
-        auto startKey = positionKey(seg.startPos);
+        auto startKey = positionKey(firstSeg.startPos);
         auto startIt = junctionRings.find(startKey);
         
-        if (startIt != junctionRings.end() && seg.parentIndex >= 0) {
+        unsigned int prevRing;
+        if (startIt != junctionRings.end() && firstSeg.parentIndex >= 0) {
             // Reuse parent's end ring as our start ring
-            segmentStartRings[i] = startIt->second;
+            prevRing = startIt->second;
         } else {
             // Create new start ring
-            segmentStartRings[i] = branchVertices.size() / (radialSegments + 1);
-            CreateVertexRing(seg.startPos, direction, seg.startRadius, branchVertices, branchNormals);
+            const RingSample& start = samples.front();
+            prevRing = QueueVertexRing(start.center, start.direction, start.radius);
             
-            glm::vec3 startColor = CalculateBranchColor(seg.depth, seg.startRadius / initialRadius);
+            glm::vec3 startColor = CalculateBranchColor(start.depth, start.radius / initialRadius);
+            unsigned int startBranch = segmentWindBranch[start.segment];
             for (int j = 0; j <= radialSegments; j++) {
                 branchColors.push_back(startColor);
+                branchWindIndices.push_back(startBranch);
             }
             
-            junctionRings[startKey] = segmentStartRings[i];
+            junctionRings[startKey] = prevRing;
         }
         
-        // Always create end ring (might be reused by children)
-        segmentEndRings[i] = branchVertices.size() / (radialSegments + 1);
-        CreateVertexRing(seg.endPos, direction, seg.endRadius, branchVertices, branchNormals);
-        
-        glm::vec3 endColor = CalculateBranchColor(seg.depth + 1, seg.endRadius / initialRadius);
-        for (int j = 0; j <= radialSegments; j++) {
-            branchColors.push_back(endColor);
+        for (size_t k = 1; k < samples.size(); k++) {
+            const RingSample& sample = samples[k];
+            unsigned int ring = QueueVertexRing(sample.center, sample.direction, sample.radius);
+            
+            glm::vec3 color = CalculateBranchColor(sample.depth, sample.radius / initialRadius);
+            unsigned int branch = segmentWindBranch[sample.segment];
+            for (int j = 0; j <= radialSegments; j++) {
+                branchColors.push_back(color);
+                branchWindIndices.push_back(branch);
+            }
+            
+            ConnectRings(prevRing - chunkBase, ring - chunkBase, branchIndices);
+            prevRing = ring;
         }
         
-        // Register end ring for potential reuse
-        auto endKey = positionKey(seg.endPos);
-        junctionRings[endKey] = segmentEndRings[i];
-    }
-    
-    // Connect rings within each segment
-    for (size_t i = 0; i < branchSegments.size(); i++) {
-        int startRing = segmentStartRings[i] * (radialSegments + 1);
-        int endRing = segmentEndRings[i] * (radialSegments + 1);
+        // Register end ring for potential reuse by children
+        auto endKey = positionKey(lastSeg.endPos);
+        junctionRings[endKey] = prevRing;
         
-        ConnectRings(startRing, endRing, branchIndices);
+        const auto& children = lastSeg.childIndices;
+        for (auto it = children.rbegin(); it != children.rend(); ++it) {
+            dfsStack.push_back(*it);
+        }
     }
     
-    std::cout << "Mesh generation complete: " << branchVertices.size() << " vertices" << std::endl;
+    // Build every queued ring in one SIMD pass
+    FlushVertexRings();
+    FinalizeBranchChunks();
+    
+    std::cout << "Mesh generation complete: " << branchVertices.size() << " vertices in "
+              << branchChunks.size() << " chunk(s)" << std::endl;
 }
 
-void Tree::GenerateLeavesAtEndpoints() {
-    std::cout << "Generating leaves at endpoints..." << std::endl;
+void Tree::SampleChainRings(const std::vector<int>& chain, std::vector<RingSample>& outSamples) {
+    const BranchSegment& firstSeg = branchSegments[chain.front()];
+    
+    if (chain.size() == 1) {
+        glm::vec3 direction = glm::normalize(firstSeg.endPos - firstSeg.startPos);
+        outSamples.push_back({ firstSeg.startPos, direction, firstSeg.startRadius, firstSeg.depth, chain.front() });
+        outSamples.push_back({ firstSeg.endPos, direction, firstSeg.endRadius, firstSeg.depth + 1, chain.front() });
+        return;
+    }
+    
+    // Control points are the chain joints; phantom end points mirror the
+    // first and last segments so the curve leaves along them
+    std::vector<glm::vec3> points;
+    std::vector<float> radii;
+    points.reserve(chain.size() + 3);
+    radii.reserve(chain.size() + 1);
+    
+    points.push_back(2.0f * firstSeg.startPos - firstSeg.endPos);
+    points.push_back(firstSeg.startPos);
+    radii.push_back(firstSeg.startRadius);
+    for (int index : chain) {
+        points.push_back(branchSegments[index].endPos);
+        radii.push_back(branchSegments[index].endRadius);
+    }
+    const BranchSegment& lastSeg = branchSegments[chain.back()];
+    points.push_back(2.0f * lastSeg.endPos - lastSeg.startPos);
+    
+    const int samplesPerSegment = 8;
+    const float angleTolerance = cos(glm::radians(splineAngleTolerance));
+    
+    outSamples.push_back({ firstSeg.startPos, glm::normalize(firstSeg.endPos - firstSeg.startPos),
+                           firstSeg.startRadius, firstSeg.depth, chain.front() });
     
-    for (const auto& segment : branchSegments) {
-        // Only add leaves to thin branches (endpoints)
-        if (segment.endRadius < initialRadius * 0.25f) {
+    for (size_t k = 0; k < chain.size(); k++) {
+        // Uniform Catmull-Rom span between points[k + 1] and points[k + 2]
+        const glm::vec3& p0 = points[k];
+        const glm::vec3& p1 = points[k + 1];
+        const glm::vec3& p2 = points[k + 2];
+        const glm::vec3& p3 = points[k + 3];
+        
+        glm::vec3 a = 2.0f * p1;
+        glm::vec3 b = p2 - p0;
+        glm::vec3 c = 2.0f * p0 - 5.0f * p1 + 4.0f * p2 - p3;
+        glm::vec3 d = -p0 + 3.0f * p1 - 3.0f * p2 + p3;
+        
+        int depth = branchSegments[chain[k]].depth;
+        bool lastSpan = (k + 1 == chain.size());
+        
+        for (int s = 1; s <= samplesPerSegment; s++) {
+            float t = (float)s / samplesPerSegment;
+            glm::vec3 center = 0.5f * (a + b * t + c * t * t + d * t * t * t);
+            glm::vec3 tangent = 0.5f * (b + 2.0f * c * t + 3.0f * d * t * t);
+            if (glm::dot(tangent, tangent) < 1e-12f) {
+                tangent = p2 - p1;
+            }
+            tangent = glm::normalize(tangent);
+            float radius = glm::mix(radii[k], radii[k + 1], t);
             
-            int leavesPerCluster = 5 + (rand() % 6);
+            const RingSample& last = outSamples.back();
+            bool chainEnd = lastSpan && s == samplesPerSegment;
+            bool bent = glm::dot(tangent, last.direction) < angleTolerance;
+            bool tapered = std::abs(radius - last.radius) > splineRadiusTolerance * last.radius;
             
-            for (int i = 0; i < leavesPerCluster; i++) {
-                float offsetDist = leafSize * 1.0f;
-                glm::vec3 randomOffset(
-                    RandomFloat(-offsetDist, offsetDist),
-                    RandomFloat(-offsetDist, offsetDist),
-                    RandomFloat(-offsetDist, offsetDist)
-                );
-                
-                glm::vec3 leafPos = segment.endPos + randomOffset;
-                
-                LeafInstance instance;
-                instance.position = leafPos;
-                
-                glm::vec3 treeCenter = this->position + glm::vec3(0.0f, initialLength * 2.0f, 0.0f);
-                instance.normal = glm::normalize(leafPos - treeCenter);
-                
-                float scaleVariation = RandomFloat(0.9f, 1.4f);
-                instance.scale = glm::vec2(leafSize * scaleVariation * 1.2f);
-                
-                instance.rotation = RandomFloat(0.0f, 360.0f) * glm::pi<float>() / 180.0f;
-                
-                float colorVariation = RandomFloat(0.85f, 1.15f);
-                instance.color = glm::vec3(0.2f, 0.6f, 0.15f) * colorVariation;
-                
-                leafInstances.push_back(instance);
+            if (chainEnd || bent || tapered) {
+                int sampleDepth = (s == samplesPerSegment) ? depth + 1 : depth;
+                if (chainEnd) center = lastSeg.endPos;
+                outSamples.push_back({ center, tangent, radius, sampleDepth, chain[k] });
+            }
+        }
+    }
+}
+
+void Tree::GenerateImplicitMesh() {
+    if (branchSegments.empty()) return;
+    
+    std::cout << "Building implicit mesh from " << branchSegments.size() << " segments..." << std::endl;
+    auto start = std::chrono::high_resolution_clock::now();
+    
+    // Twigs thinner than the lattice would vanish, so keep them resolvable
+    float minRadius = implicitSettings.voxelSize * 0.6f;
+    
+    std::vector<Capsule> capsules;
+    capsules.reserve(branchSegments.size());
+    for (const auto& seg : branchSegments) {
+        Capsule capsule;
+        capsule.a = seg.startPos;
+        capsule.b = seg.endPos;
+        capsule.ra = std::max(seg.startRadius, minRadius);
+        capsule.rb = std::max(seg.endRadius, minRadius);
+        capsule.depth = seg.depth;
+        capsules.push_back(capsule);
+    }
+    
+    ImplicitMeshResult mesh;
+    ImplicitMesher mesher(implicitSettings);
+    mesher.Build(capsules, mesh);
+    
+    std::vector<glm::vec3> colors(mesh.positions.size());
+    std::vector<unsigned int> branches(mesh.positions.size());
+    for (size_t i = 0; i < colors.size(); i++) {
+        colors[i] = CalculateBranchColor(mesh.depths[i], 1.0f);
+        branches[i] = segmentWindBranch[mesh.owners[i]];
+    }
+    
+    AppendChunkedMesh(mesh.positions, mesh.normals, colors, branches, mesh.indices);
+    FinalizeBranchChunks();
+    
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    std::cout << "Implicit mesh complete: " << mesh.tileCount << " tiles, " << branchVertices.size()
+              << " vertices in " << branchChunks.size() << " chunk(s), " << ms << " ms" << std::endl;
+}
+
+void Tree::AppendChunkedMesh(const std::vector<glm::vec3>& positions, const std::vector<glm::vec3>& normals,
+                             const std::vector<glm::vec3>& colors, const std::vector<unsigned int>& branches,
+                             const std::vector<unsigned int>& indices) {
+    // Vertices used by triangles on both sides of a chunk cut are duplicated.
+    // localChunk holds the chunk count at the time a vertex was copied.
+    std::vector<unsigned int> localIndex(positions.size(), 0);
+    std::vector<unsigned int> localChunk(positions.size(), 0);
+    
+    for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+        unsigned int chunk = branchChunks.size();
+        
+        unsigned int missing = 0;
+        for (int k = 0; k < 3; k++) {
+            if (localChunk[indices[i + k]] != chunk) missing++;
+        }
+        if (ReserveChunkVertices(missing)) {
+            chunk = branchChunks.size();
+        }
+        unsigned int chunkBase = branchChunks.back().baseVertex;
+        
+        for (int k = 0; k < 3; k++) {
+            unsigned int v = indices[i + k];
+            if (localChunk[v] != chunk) {
+                localChunk[v] = chunk;
+                localIndex[v] = branchVertices.size() - chunkBase;
+                branchVertices.push_back(positions[v]);
+                branchNormals.push_back(normals[v]);
+                branchColors.push_back(colors[v]);
+                branchWindIndices.push_back(branches[v]);
             }
+            branchIndices.push_back(localIndex[v]);
         }
     }
+}
+
+void Tree::BakeAmbientOcclusion() {
+    branchOcclusion.assign(branchVertices.size(), 1.0f);
+    if (!bakeOcclusion || branchSegments.empty()) return;
+    
+    auto start = std::chrono::high_resolution_clock::now();
+    
+    OcclusionBaker baker(occlusionSettings);
+    for (const auto& seg : branchSegments) {
+        baker.AddCapsule(seg.startPos, seg.endPos, (seg.startRadius + seg.endRadius) * 0.5f);
+    }
+    
+    std::vector<glm::vec3> leafPositions, leafNormals;
+    std::vector<int> leafDiscs;
+    leafPositions.reserve(leafInstances.size());
+    leafNormals.reserve(leafInstances.size());
+    leafDiscs.reserve(leafInstances.size());
+    for (const auto& leaf : leafInstances) {
+        glm::vec3 normal = GetLeafNormal(leaf.position);
+        leafDiscs.push_back(baker.AddDisc(leaf.position, normal, leaf.scale * 0.5f));
+        leafPositions.push_back(leaf.position);
+        leafNormals.push_back(normal);
+    }
+    baker.Build();
+    
+    baker.Bake(branchVertices, branchNormals, nullptr, branchOcclusion);
+    
+    std::vector<float> leafOcclusion;
+    baker.Bake(leafPositions, leafNormals, &leafDiscs, leafOcclusion);
+    for (size_t i = 0; i < leafInstances.size(); i++) {
+        leafInstances[i].occlusion = leafOcclusion[i];
+    }
     
-    std::cout << "Generated " << leafInstances.size() << " leaves" << std::endl;
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    std::cout << "Baked ambient occlusion for " << branchVertices.size() << " vertices and "
+              << leafInstances.size() << " leaves in " << ms << " ms" << std::endl;
 }
 
-void Tree::UpdateLeafInstanceBuffer() {
-    if (leafInstances.empty()) return;
+void Tree::BuildCanopyVolume() {
+    auto start = std::chrono::high_resolution_clock::now();
+    
+    std::vector<glm::vec3> positions;
+    std::vector<float> areas;
+    positions.reserve(leafInstances.size());
+    areas.reserve(leafInstances.size());
+    for (const auto& leaf : leafInstances) {
+        positions.push_back(leaf.position);
+        areas.push_back(leaf.scale * leaf.scale);
+    }
+    canopyVolume.Build(positions, areas, SunDirection());
     
-    glBindBuffer(GL_ARRAY_BUFFER, leafInstanceVBO);
-    glBufferData(GL_ARRAY_BUFFER, leafInstances.size() * sizeof(LeafInstance),
-                 leafInstances.data(), GL_STATIC_DRAW);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    const glm::ivec3& size = canopyVolume.GetDimensions();
+    std::cout << "Canopy volume " << size.x << "x" << size.y << "x" << size.z << " in " << ms << " ms" << std::endl;
 }
 
-void Tree::LoadLeafTexture(const std::string& texturePath) {
-    if (leafTexture != 0) {
-        glDeleteTextures(1, &leafTexture);
+void Tree::UpdateCanopyTexture() {
+    if (canopyVolume.IsEmpty()) return;
+    if (canopyTexture == 0) {
+        glGenTextures(1, &canopyTexture);
     }
     
-    glGenTextures(1, &leafTexture);
-    glBindTexture(GL_TEXTURE_2D, leafTexture);
+    const glm::ivec3& size = canopyVolume.GetDimensions();
+    glBindTexture(GL_TEXTURE_3D, canopyTexture);
+    glTexImage3D(GL_TEXTURE_3D, 0, GL_R16F, size.x, size.y, size.z, 0, GL_RED, GL_FLOAT,
+                 canopyVolume.GetOpticalDepth().data());
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_3D, 0);
+}
+
+void Tree::GenerateLeavesAtEndpoints() {
+    std::cout << "Generating leaves at endpoints..." << std::endl;
     
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    // Eligible segments: thin branch ends past the minimum leaf depth
+    std::vector<int> eligible;
+    for (size_t i = 0; i < branchSegments.size(); i++) {
+        const BranchSegment& segment = branchSegments[i];
+        if (segment.endRadius < initialRadius * 0.25f && segment.depth >= minLeafDepth) {
+            eligible.push_back(i);
+        }
+    }
     
-    int width, height, nrChannels;
-    stbi_set_flip_vertically_on_load(true);
-    unsigned char* data = stbi_load(texturePath.c_str(), &width, &height, &nrChannels, 0);
+    size_t target = (size_t)(leafBudget * glm::clamp(leafDensity, 0.0f, 1.0f) + 0.5f);
+    if (eligible.empty() || target == 0) {
+        std::cout << "Generated 0 leaves" << std::endl;
+        return;
+    }
     
-    if (data) {
-        bool needsConversion = (nrChannels == 1 || nrChannels == 3);
-        
-        if (needsConversion) {
-            int pixelCount = width * height;
-            unsigned char* rgbaData = new unsigned char[pixelCount * 4];
-            
-            for (int i = 0; i < pixelCount; i++) {
-                unsigned char value;
-                
-                if (nrChannels == 1) {
-                    value = data[i];
-                } else {
-                    value = (data[i * 3] + data[i * 3 + 1] + data[i * 3 + 2]) / 3;
-                }
-                
-                rgbaData[i * 4 + 0] = 60;
-                rgbaData[i * 4 + 1] = 120;
-                rgbaData[i * 4 + 2] = 40;
-                rgbaData[i * 4 + 3] = value;
-            }
-            
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, rgbaData);
-            delete[] rgbaData;
-            
-        } else {
-            GLenum format = (nrChannels == 4) ? GL_RGBA : GL_RGB;
-            glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
+    // Oversample candidates around each eligible tip, then keep a blue-noise
+    // prefix of them. The pool only depends on the budget and all jitter is
+    // hashed from segment and candidate index, so lowering the density keeps
+    // a subset of the leaves instead of reshuffling them.
+    const size_t oversample = 3;
+    size_t pool = (size_t)std::max(leafBudget, 1) * oversample;
+    int perSegment = glm::clamp((int)((pool + eligible.size() - 1) / eligible.size()), 1, 32);
+    float offsetDist = leafSize * 1.0f;
+    
+    std::vector<glm::vec3> candidates;
+    std::vector<unsigned int> candidateKeys;
+    std::vector<int> candidateSegments;
+    candidates.reserve(eligible.size() * perSegment);
+    candidateKeys.reserve(eligible.size() * perSegment);
+    candidateSegments.reserve(eligible.size() * perSegment);
+    for (int index : eligible) {
+        const BranchSegment& segment = branchSegments[index];
+        for (int i = 0; i < perSegment; i++) {
+            unsigned int key = HashUInt(index * 32u + i);
+            float along = 0.5f + 0.5f * HashFloat(key);
+            glm::vec3 randomOffset(
+                (HashFloat(key + 1) * 2.0f - 1.0f) * offsetDist,
+                (HashFloat(key + 2) * 2.0f - 1.0f) * offsetDist,
+                (HashFloat(key + 3) * 2.0f - 1.0f) * offsetDist
+            );
+            candidates.push_back(glm::mix(segment.startPos, segment.endPos, along) + randomOffset);
+            candidateKeys.push_back(key);
+            candidateSegments.push_back(index);
         }
+    }
+    
+    std::vector<int> order;
+    ProgressiveSampleOrder(candidates, target, 0u, order);
+    
+    leafInstances.reserve(order.size());
+    for (int candidate : order) {
+        unsigned int key = candidateKeys[candidate];
         
-        glGenerateMipmap(GL_TEXTURE_2D);
+        LeafInstance instance;
+        instance.position = candidates[candidate];
         
-        std::cout << "Loaded leaf texture: " << texturePath << std::endl;
-    } else {
-        std::cerr << "Failed to load leaf texture: " << texturePath << std::endl;
+        float scaleVariation = 0.9f + 0.5f * HashFloat(key + 4);
+        instance.scale = leafSize * scaleVariation * 1.2f;
+        
+        // Rotation and tint are hashed from the seed in leaf.shader
+        instance.seed = HashUInt(key + 5) & 0xFFFFFFu;
+        instance.occlusion = 1.0f;
+        
+        // Sways with the branch it grew from
+        instance.branch = segmentWindBranch[candidateSegments[candidate]];
+        
+        leafInstances.push_back(instance);
+    }
+    
+    std::cout << "Generated " << leafInstances.size() << " leaves from " << candidates.size()
+              << " candidates on " << eligible.size() << " branch tips" << std::endl;
+}
+
+void Tree::BuildLeafClusters() {
+    std::vector<glm::vec3> positions;
+    float maxScale = 0.0f;
+    positions.reserve(leafInstances.size());
+    for (const auto& leaf : leafInstances) {
+        positions.push_back(leaf.position);
+        maxScale = std::max(maxScale, leaf.scale);
+    }
+    
+    // Aim for a few dozen leaves per cluster. The extent is clamped so flat
+    // canopies do not collapse the estimate.
+    glm::vec3 boundsMin(1e30f), boundsMax(-1e30f);
+    for (const auto& p : positions) {
+        boundsMin = glm::min(boundsMin, p);
+        boundsMax = glm::max(boundsMax, p);
+    }
+    glm::vec3 extent = glm::max(boundsMax - boundsMin, glm::vec3(leafSize));
+    const float leavesPerCluster = 48.0f;
+    float cellSize = std::cbrt(extent.x * extent.y * extent.z * leavesPerCluster / std::max<size_t>(positions.size(), 1));
+    cellSize = std::max(cellSize, leafSize * 2.0f);
+    
+    // Leaf cards are squares of side scale, rotated freely around the view axis
+    std::vector<int> order;
+    leafClusters.Build(positions, maxScale * 0.7072f, cellSize, order);
+    
+    std::vector<LeafInstance> sorted;
+    sorted.reserve(order.size());
+    for (int index : order) sorted.push_back(leafInstances[index]);
+    leafInstances.swap(sorted);
+    
+    std::cout << "Leaf clusters: " << leafClusters.GetClusters().size()
+              << " (cell size " << cellSize << ")" << std::endl;
+}
+
+glm::vec3 Tree::GetCanopyCenter() const {
+    return glm::vec3(0.0f, initialLength * 2.0f, 0.0f);
+}
+
+glm::vec3 Tree::GetLeafNormal(const glm::vec3& leafPosition) const {
+    // Spherical normal pointing away from the canopy center, matches leaf.shader
+    glm::vec3 offset = leafPosition - GetCanopyCenter();
+    float length = glm::length(offset);
+    return length > 1e-6f ? offset / length : glm::vec3(0.0f, 1.0f, 0.0f);
+}
+
+void Tree::PackLeafInstances() {
+    packedLeafInstances.resize(leafInstances.size());
+    if (leafInstances.empty()) return;
+    
+    glm::vec3 boundsMax(-1e30f);
+    float scaleMax = 0.0f;
+    leafBoundsMin = glm::vec3(1e30f);
+    leafScaleMin = 1e30f;
+    for (const auto& leaf : leafInstances) {
+        leafBoundsMin = glm::min(leafBoundsMin, leaf.position);
+        boundsMax = glm::max(boundsMax, leaf.position);
+        leafScaleMin = std::min(leafScaleMin, leaf.scale);
+        scaleMax = std::max(scaleMax, leaf.scale);
+    }
+    leafBoundsExtent = glm::max(boundsMax - leafBoundsMin, glm::vec3(1e-6f));
+    leafScaleStep = (scaleMax - leafScaleMin) / 255.0f;
+    
+    for (size_t i = 0; i < leafInstances.size(); i++) {
+        const LeafInstance& leaf = leafInstances[i];
+        PackedLeafInstance& packed = packedLeafInstances[i];
+        
+        glm::vec3 unit = (leaf.position - leafBoundsMin) / leafBoundsExtent;
+        for (int axis = 0; axis < 3; axis++) {
+            packed.position[axis] = (unsigned short)(glm::clamp(unit[axis], 0.0f, 1.0f) * 65535.0f + 0.5f);
+        }
+        packed.occlusion = (unsigned char)(glm::clamp(leaf.occlusion, 0.0f, 1.0f) * 255.0f + 0.5f);
+        packed.rank = 255;
+        
+        unsigned int scaleIndex = leafScaleStep > 0.0f
+            ? (unsigned int)((leaf.scale - leafScaleMin) / leafScaleStep + 0.5f) : 0u;
+        packed.seedScale = (leaf.seed & 0xFFFFFFu) | (std::min(scaleIndex, 255u) << 24);
+        packed.branchLayer = ((unsigned int)leaf.branch & 0xFFFFFFu) | ((unsigned int)leafLayer << 24);
     }
     
-    stbi_image_free(data);
-    glBindTexture(GL_TEXTURE_2D, 0);
+    // Instances are cluster-major, so a leaf's rank is its offset in the
+    // cluster. The GPU culler keeps rank < fraction, the same prefix the CPU
+    // path draws.
+    for (const auto& cluster : leafClusters.GetClusters()) {
+        for (unsigned int k = 0; k < cluster.count; k++) {
+            packedLeafInstances[cluster.first + k].rank = (unsigned char)(255u * k / cluster.count);
+        }
+    }
+}
+
+void Tree::SortVisibleLeaves(const glm::vec3& cameraPosition, const glm::vec3& viewDirection) {
+    size_t count = visibleLeafInstances.size();
+    if (count < 2) return;
+    
+    // View depth straight from the quantized position, without unpacking it
+    float baseDepth = glm::dot(leafBoundsMin - cameraPosition, viewDirection);
+    glm::vec3 depthPerStep = viewDirection * leafBoundsExtent / 65535.0f;
+    leafDepths.resize(count);
+    float minDepth = 1e30f, maxDepth = -1e30f;
+    for (size_t i = 0; i < count; i++) {
+        const unsigned short* p = visibleLeafInstances[i].position;
+        float depth = baseDepth + p[0] * depthPerStep.x + p[1] * depthPerStep.y + p[2] * depthPerStep.z;
+        leafDepths[i] = depth;
+        minDepth = std::min(minDepth, depth);
+        maxDepth = std::max(maxDepth, depth);
+    }
+    
+    // 16-bit keys over the visible depth range are plenty for early-Z
+    float keyScale = maxDepth > minDepth ? 65535.0f / (maxDepth - minDepth) : 0.0f;
+    leafDepthKeys.resize(count);
+    for (size_t i = 0; i < count; i++) {
+        leafDepthKeys[i] = (unsigned short)((leafDepths[i] - minDepth) * keyScale);
+    }
+    
+    leafSorter.Sort(leafDepthKeys, leafSortOrder);
+    sortedLeafInstances.resize(count);
+    for (size_t i = 0; i < count; i++) {
+        sortedLeafInstances[i] = visibleLeafInstances[leafSortOrder[i]];
+    }
+    visibleLeafInstances.swap(sortedLeafInstances);
+}
+
+void Tree::UpdateLeafInstanceBuffer() {
+    HeapBuffer& heapLeaves = GeometryHeap::Get().GetLeafInstances();
+    heapLeaves.Free(leafRange);
+    if (packedLeafInstances.empty()) return;
+    
+    leafRange = heapLeaves.Allocate(packedLeafInstances.size());
+    heapLeaves.Upload(leafRange, packedLeafInstances.data());
+    GLintptr leafOffset = (GLintptr)leafRange.offset * sizeof(PackedLeafInstance);
+    glBindVertexArray(leafVAO);
+    glBindBuffer(GL_ARRAY_BUFFER, heapLeaves.GetBuffer());
+    SetLeafInstanceAttributes(leafOffset);
+    
+    // The culler may have grown its output buffer, so rebind it
+    leafGpuCuller.SetSource(heapLeaves.GetBuffer(), packedLeafInstances.size(), leafOffset);
+    glBindVertexArray(leafGpuVAO);
+    glBindBuffer(GL_ARRAY_BUFFER, leafGpuCuller.GetOutputBuffer());
+    SetLeafInstanceAttributes();
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void Tree::LoadLeafTexture(const std::string& texturePath) {
+    ownLeafTextures.Clean();
+    int layer = ownLeafTextures.AddLayer(texturePath);
+    ownLeafTextures.Upload();
+    SetLeafTextures(&ownLeafTextures, layer < 0 ? 0 : layer);
+}
+
+void Tree::SetLeafTextures(const LeafTextureArray* textures, int layer) {
+    layer = glm::clamp(layer, 0, 255);
+    bool layerChanged = layer != leafLayer;
+    leafTextures = textures;
+    leafLayer = layer;
+    
+    // The layer lives in every packed instance
+    if (layerChanged && !leafInstances.empty()) {
+        PackLeafInstances();
+        if (leafBuffersInitialized) {
+            UpdateLeafInstanceBuffer();
+        }
+        revision++;
+    }
+}
+
+glm::vec3 Tree::GetSunDirection() const {
+    return SunDirection();
+}
+
+glm::mat4 Tree::GetModelMatrix() const {
+    return glm::translate(glm::mat4(1.0f), position);
+}
+
+void Tree::ApplyPlacementUniforms(Shader& shader, bool instanced, int firstPlacement) {
+    // The mesh is in local space. One tree is placed by u_Model, a forest
+    // reads its placements from the buffer texture on unit 3.
+    shader.SetUniform1i("u_ForestInstanced", instanced ? 1 : 0);
+    shader.SetUniform1i("u_ForestInstances", 3);
+    shader.SetUniform1i("u_ForestBase", firstPlacement);
+    shader.SetUniformMat4f("u_Model", GetModelMatrix());
+}
+
+void Tree::AppendBranchCommands(unsigned int firstPlacement, unsigned int placementCount,
+                                std::vector<DrawElementsIndirectCommand>& commands) const {
+    if (branchVertexRange.count == 0 || placementCount == 0) return;
+    
+    // One command per chunk, its 16-bit indices stay chunk-local
+    for (const auto& chunk : branchChunks) {
+        DrawElementsIndirectCommand command;
+        command.count = chunk.indexCount;
+        command.instanceCount = placementCount;
+        command.firstIndex = branchIndexRange.offset + chunk.indexOffset;
+        command.baseVertex = branchVertexRange.offset + chunk.baseVertex;
+        command.baseInstance = firstPlacement;
+        commands.push_back(command);
+    }
 }
 
 void Tree::Render(Shader& shader, const glm::mat4& view, const glm::mat4& projection) {
@@ -758,84 +1511,313 @@ void Tree::Render(Shader& shader, const glm::mat4& view, const glm::mat4& projec
     shader.setUniformMat4f("u_View", const_cast<glm::mat4&>(view));
     shader.setUniformMat4f("u_Projection", const_cast<glm::mat4&>(projection));
     
-    glm::vec3 lightDir = glm::normalize(glm::vec3(0.5f, 0.8f, -0.5f));
+    glm::vec3 lightDir = SunDirection();
     shader.SetUniform3f("u_LightDir", lightDir.x, lightDir.y, lightDir.z);
+    shader.SetUniform1i("u_ForestInstanced", 0);
+    shader.SetUniformMat4f("u_Model", GetModelMatrix());
+    ApplyWindUniforms(shader);
+    ApplyShadowUniforms(shader, 0.0f);
     
-    // Enable polygon offset to reduce Z-fighting
-    glEnable(GL_POLYGON_OFFSET_FILL);
-    glPolygonOffset(1.0f, 1.0f);
-    
-    glBindVertexArray(branchVAO);
-    glDrawElements(GL_TRIANGLES, branchIndices.size(), GL_UNSIGNED_INT, 0);
-    glBindVertexArray(0);
-    
-    glDisable(GL_POLYGON_OFFSET_FILL);
+    branchCommands.clear();
+    AppendBranchCommands(0, 1, branchCommands);
+    GeometryHeap::Get().DrawBranches(branchCommands);
     
     shader.Unbind();
 }
 
+void Tree::ApplyInstancedBranchUniforms(Shader& shader) {
+    // The caller binds the shader and sets the camera uniforms. The wind
+    // table is shared, so this tree's wind settings hold for the whole draw.
+    glm::vec3 lightDir = SunDirection();
+    shader.SetUniform3f("u_LightDir", lightDir.x, lightDir.y, lightDir.z);
+    shader.SetUniform1i("u_ForestInstanced", 1);
+    ApplyWindUniforms(shader);
+    ApplyShadowUniforms(shader, 0.0f);
+}
 
-void Tree::RenderLeaves(Shader& leafShader, const glm::mat4& view, const glm::mat4& projection) {
-    if (!leafBuffersInitialized || leafInstances.empty()) return;
+void Tree::ApplyLeafUniforms(Shader& leafShader) {
+    glm::vec3 lightDir = SunDirection();
+    leafShader.SetUniform3f("u_LightDir", lightDir.x, lightDir.y, lightDir.z);
     
-    leafShader.Bind();
+    // Dequantization parameters for PackedLeafInstance
+    glm::vec3 canopyCenter = GetCanopyCenter();
+    leafShader.SetUniform3f("u_LeafBoundsMin", leafBoundsMin.x, leafBoundsMin.y, leafBoundsMin.z);
+    leafShader.SetUniform3f("u_LeafBoundsExtent", leafBoundsExtent.x, leafBoundsExtent.y, leafBoundsExtent.z);
+    leafShader.SetUniform3f("u_CanopyCenter", canopyCenter.x, canopyCenter.y, canopyCenter.z);
+    leafShader.SetUniform1f("u_LeafScaleMin", leafScaleMin);
+    leafShader.SetUniform1f("u_LeafScaleStep", leafScaleStep);
+    ApplyWindUniforms(leafShader);
+    leafShader.SetUniform1i("u_WindBase", windRange.offset);
+    
+    // Canopy self-shadowing, one texel per fragment
+    bool shadowing = canopyShadowing && canopyTexture != 0 && !canopyVolume.IsEmpty();
+    leafShader.SetUniform1i("u_CanopyShadowing", shadowing ? 1 : 0);
+    // Keep the 3D sampler off unit 0 even when unused, the leaf texture is a 2D one
+    leafShader.SetUniform1i("u_CanopyVolume", 2);
+    if (shadowing) {
+        glm::vec3 volumeMin = canopyVolume.GetBoundsMin();
+        glm::vec3 volumeExtent = canopyVolume.GetBoundsExtent();
+        glActiveTexture(GL_TEXTURE2);
+        glBindTexture(GL_TEXTURE_3D, canopyTexture);
+        glActiveTexture(GL_TEXTURE0);
+        leafShader.SetUniform3f("u_CanopyVolumeMin", volumeMin.x, volumeMin.y, volumeMin.z);
+        leafShader.SetUniform3f("u_CanopyVolumeExtent", volumeExtent.x, volumeExtent.y, volumeExtent.z);
+    }
     
-    leafShader.setUniformMat4f("u_View", view);
-    leafShader.setUniformMat4f("u_Projection", projection);
+    // Receivers sit anywhere on a camera-facing card, the casters faced the sun
+    float leafScaleMax = leafScaleMin + 255.0f * leafScaleStep;
+    ApplyShadowUniforms(leafShader, 0.75f * leafScaleMax);
     
-    glm::vec3 lightDir = glm::normalize(glm::vec3(0.5f, 0.8f, -0.5f));
-    leafShader.SetUniform3f("u_LightDir", lightDir.x, lightDir.y, lightDir.z);
+    // Forest leaves come from a buffer texture on unit 4
+    leafShader.SetUniform1i("u_ForestLeaves", 4);
     
-    if (leafTexture != 0) {
+    if (leafTextures && leafTextures->GetTexture() != 0) {
         glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, leafTexture);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, leafTextures->GetTexture());
         leafShader.SetUniform1i("u_LeafTexture", 0);
     }
-    
+}
+
+void Tree::ApplyShadowUniforms(Shader& shader, float casterBias) {
+    // Like the canopy volume, the shadow sampler keeps its own unit when unused
+    shader.SetUniform1i("u_ShadowMap", 8);
+    if (shadowMap && shadowMap->IsReady()) {
+        shadowMap->Apply(shader, casterBias);
+    } else {
+        shader.SetUniform1i("u_ShadowMapping", 0);
+    }
+}
+
+void Tree::BeginLeafBlending(Shader& leafShader) {
     glDisable(GL_CULL_FACE);
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-    
-    glBindVertexArray(leafVAO);
-    glDrawElementsInstanced(GL_TRIANGLES, leafQuadIndices.size(), GL_UNSIGNED_INT, 0, 
-                           leafInstances.size());
-    glBindVertexArray(0);
-    
+    if (leafAlphaTest) {
+        // Order does not matter to a hard cutoff
+        leafShader.SetUniform1i("u_AlphaToCoverage", 0);
+        leafShader.SetUniform1f("u_AlphaCutoff", 0.5f);
+        leafShader.SetUniform1i("u_AlphaBlend", 0);
+        return;
+    }
+    // Coverage does nothing without multisampling, fall back to a hard
+    // alpha test there. Both keep depth writes and skip blending.
+    GLint sampleBuffers = 0;
+    glGetIntegerv(GL_SAMPLE_BUFFERS, &sampleBuffers);
+    bool coverage = leafAlphaToCoverage && sampleBuffers > 0;
+    leafShader.SetUniform1i("u_AlphaToCoverage", coverage ? 1 : 0);
+    leafShader.SetUniform1f("u_AlphaCutoff", leafAlphaToCoverage ? 0.5f : 0.1f);
+    leafShader.SetUniform1i("u_AlphaBlend", leafAlphaToCoverage ? 0 : 1);
+    if (coverage) {
+        glEnable(GL_SAMPLE_ALPHA_TO_COVERAGE);
+    } else if (!leafAlphaToCoverage) {
+        // Destination alpha accumulates coverage, for offscreen leaf targets
+        glEnable(GL_BLEND);
+        glBlendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+    }
+}
+
+void Tree::EndLeafBlending() {
     glEnable(GL_CULL_FACE);
     glDisable(GL_BLEND);
+    glDisable(GL_SAMPLE_ALPHA_TO_COVERAGE);
+}
+
+void Tree::RenderLeaves(Shader& leafShader, const glm::mat4& view, const glm::mat4& projection) {
+    if (!leafBuffersInitialized || leafInstances.empty()) return;
+    
+    // Culling, sorting and pruning all work on the local-space instances
+    glm::mat4 model = GetModelMatrix();
+    glm::mat4 localViewProjection = projection * view * model;
+    glm::vec3 cameraPosition = glm::vec3(glm::inverse(view * model)[3]);
+    // Culling on the GPU falls back to the CPU where the context lacks it
+    LeafCullMode cullMode = leafCullSettings.mode;
+    if (cullMode == LeafCullMode::Gpu && !leafGpuCuller.IsReady()) cullMode = LeafCullMode::Cpu;
+    bool gpuCull = cullMode == LeafCullMode::Gpu;
+    if (gpuCull) {
+        // Runs its own programs, so it goes before the leaf shader is bound
+        LeafGpuCullParams params;
+        params.viewProjection = localViewProjection;
+        params.cameraPosition = cameraPosition;
+        params.boundsMin = leafBoundsMin;
+        params.boundsExtent = leafBoundsExtent;
+        params.scaleMin = leafScaleMin;
+        params.scaleStep = leafScaleStep;
+        params.settings = leafCullSettings;
+        leafGpuCuller.Cull(params);
+    }
+    
+    leafShader.Bind();
+    
+    leafShader.setUniformMat4f("u_View", view);
+    leafShader.setUniformMat4f("u_Projection", projection);
+    ApplyPlacementUniforms(leafShader, false, 0);
+    ApplyLeafUniforms(leafShader);
+    
+    // Distance pruning, the shader grows survivors to keep the canopy area
+    bool pruning = leafCullSettings.mode != LeafCullMode::Off;
+    leafShader.SetUniform3f("u_CameraPos", cameraPosition.x, cameraPosition.y, cameraPosition.z);
+    leafShader.SetUniform1f("u_PruneStart", pruning ? leafCullSettings.pruneStart : 1e30f);
+    leafShader.SetUniform1f("u_MinKeepFraction", leafCullSettings.minFraction);
+    leafShader.SetUniform1i("u_ClusterKeep", cullMode == LeafCullMode::Cpu ? 1 : 0);
+    leafShader.SetUniform1f("u_LeafGrowth", 1.0f);
+    
+    BeginLeafBlending(leafShader);
+    
+    if (gpuCull) {
+        // The survivor count never leaves the GPU
+        drawnLeafCount = 0;
+        leafClusterDraws.clear();
+        
+        glBindVertexArray(leafGpuVAO);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, leafGpuCuller.GetIndirectBuffer());
+        glDrawArraysIndirect(GL_TRIANGLE_STRIP, (void*)0);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+        glBindVertexArray(0);
+    } else if (cullMode == LeafCullMode::Cpu || leafAlphaToCoverage) {
+        if (cullMode == LeafCullMode::Cpu) {
+            // Gather the surviving prefix of every visible cluster into the stream
+            std::function<bool(const glm::vec3&, float)> occluded;
+            if (occlusion && occlusion->HasDepth()) {
+                // Cluster spheres are local, the pyramid is in world space
+                occluded = [this](const glm::vec3& center, float radius) {
+                    return occlusion->IsOccluded(center + position, radius);
+                };
+            }
+            drawnLeafCount = leafClusters.Cull(localViewProjection, cameraPosition, leafCullSettings,
+                                               leafClusterDraws, occluded);
+            visibleLeafInstances.resize(drawnLeafCount);
+            PackedLeafInstance* out = visibleLeafInstances.data();
+            for (const auto& draw : leafClusterDraws) {
+                std::copy(packedLeafInstances.begin() + draw.first,
+                          packedLeafInstances.begin() + draw.first + draw.count, out);
+                // The shader grows survivors by what their cluster kept
+                unsigned char keep = (unsigned char)glm::clamp((int)std::round(255.0f * draw.keepFraction), 1, 255);
+                for (unsigned int k = 0; k < draw.count; k++) {
+                    out[k].rank = keep;
+                }
+                out += draw.count;
+            }
+        } else {
+            drawnLeafCount = packedLeafInstances.size();
+            leafClusterDraws.clear();
+            visibleLeafInstances = packedLeafInstances;
+        }
+        
+        // Nearest leaves first so early depth testing rejects the ones behind
+        if (leafAlphaToCoverage) {
+            glm::vec3 viewDirection = -glm::vec3(view[0][2], view[1][2], view[2][2]);
+            SortVisibleLeaves(cameraPosition, viewDirection);
+        }
+        
+        if (drawnLeafCount > 0) {
+            // Write this frame's slot of the ring, then source the attributes from it
+            GLintptr offset = leafStream.Upload(visibleLeafInstances.data(),
+                                                drawnLeafCount * sizeof(PackedLeafInstance));
+            glBindVertexArray(leafVisibleVAO);
+            SetLeafInstanceAttributes(offset);
+            glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, drawnLeafCount);
+            glBindVertexArray(0);
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+            leafStream.FinishSlot();
+        }
+    } else {
+        drawnLeafCount = packedLeafInstances.size();
+        leafClusterDraws.clear();
+        
+        glBindVertexArray(leafVAO);
+        glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, packedLeafInstances.size());
+        glBindVertexArray(0);
+    }
+    
+    EndLeafBlending();
     
     leafShader.Unbind();
 }
 
+void Tree::RenderLeavesInstanced(Shader& leafShader, unsigned int leafCount, float leafGrowth,
+                                 int firstPlacement, int placementCount) {
+    if (!leafBuffersInitialized || leafCount == 0 || placementCount <= 0) return;
+    
+    // The caller binds the shader, the camera uniforms, the heap's leaf
+    // buffer texture with u_ForestLeafBase and a VAO without attributes,
+    // since gl_InstanceID runs past the end of the instance buffer. Bands
+    // replace per-leaf pruning.
+    ApplyPlacementUniforms(leafShader, true, firstPlacement);
+    ApplyLeafUniforms(leafShader);
+    leafShader.SetUniform1f("u_PruneStart", 1e30f);
+    leafShader.SetUniform1i("u_ClusterKeep", 0);
+    leafShader.SetUniform1f("u_LeafGrowth", leafGrowth);
+    leafShader.SetUniform1i("u_ForestLeafCount", (int)leafCount);
+    
+    BeginLeafBlending(leafShader);
+    glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, (GLsizei)(leafCount * placementCount));
+    EndLeafBlending();
+}
+
+void Tree::RenderRestPose(Shader& treeShader, Shader* leafShader, const glm::mat4& view,
+                          const glm::mat4& projection) {
+    // Nothing that changes per frame goes into bakes. A plain alpha test
+    // draws the static instances without sorting or streaming them, and
+    // unlike blending it leaves an impostor's second color target alone.
+    WindSettings savedWind = windSettings;
+    LeafCullSettings savedCull = leafCullSettings;
+    bool savedCoverage = leafAlphaToCoverage;
+    const StaticShadowMap* savedShadowMap = shadowMap;
+    windSettings.enabled = false;
+    leafCullSettings.mode = LeafCullMode::Off;
+    leafAlphaToCoverage = false;
+    leafAlphaTest = true;
+    shadowMap = nullptr;
+    
+    Render(treeShader, view, projection);
+    if (leafShader) {
+        RenderLeaves(*leafShader, view, projection);
+    }
+    
+    windSettings = savedWind;
+    leafCullSettings = savedCull;
+    leafAlphaToCoverage = savedCoverage;
+    leafAlphaTest = false;
+    shadowMap = savedShadowMap;
+}
+
 void Tree::Clean() {
     if (branchBuffersInitialized) {
-        glDeleteVertexArrays(1, &branchVAO);
-        glDeleteBuffers(1, &branchVBO);
-        glDeleteBuffers(1, &branchNBO);
-        glDeleteBuffers(1, &branchCBO);
-        glDeleteBuffers(1, &branchEBO);
+        GeometryHeap& heap = GeometryHeap::Get();
+        heap.GetBranchVertices().Free(branchVertexRange);
+        heap.GetBranchIndices().Free(branchIndexRange);
+        heap.GetWindBranches().Free(windRange);
         branchBuffersInitialized = false;
     }
     
     if (leafBuffersInitialized) {
+        GeometryHeap::Get().GetLeafInstances().Free(leafRange);
         glDeleteVertexArrays(1, &leafVAO);
-        glDeleteBuffers(1, &leafVBO);
-        glDeleteBuffers(1, &leafUVBO);
-        glDeleteBuffers(1, &leafEBO);
-        glDeleteBuffers(1, &leafInstanceVBO);
+        glDeleteVertexArrays(1, &leafVisibleVAO);
+        leafStream.Clean();
+        glDeleteVertexArrays(1, &leafGpuVAO);
+        leafGpuCuller.Clean();
         leafBuffersInitialized = false;
     }
     
-    if (leafTexture != 0) {
-        glDeleteTextures(1, &leafTexture);
-        leafTexture = 0;
+    ownLeafTextures.Clean();
+    leafTextures = nullptr;
+    
+    if (canopyTexture != 0) {
+        glDeleteTextures(1, &canopyTexture);
+        canopyTexture = 0;
     }
     
     branchSegments.clear();
     branchVertices.clear();
     branchNormals.clear();
     branchColors.clear();
+    branchOcclusion.clear();
+    branchWindIndices.clear();
     branchIndices.clear();
+    branchChunks.clear();
+    windBranches.clear();
+    segmentWindBranch.clear();
     leafInstances.clear();
-    leafQuadVertices.clear();
+    packedLeafInstances.clear();
+    visibleLeafInstances.clear();
+    leafClusters.Clear();
 }
\ No newline at end of file
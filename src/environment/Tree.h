@@ -8,16 +8,43 @@
 #include <map>
 #include <stack>
 #include <tuple>
+#include <random>
 #include "Shader.h"
+#include "RingKernels.h"
+#include "ImplicitMesher.h"
+#include "AmbientOcclusion.h"
+#include "LeafClusters.h"
+#include "LeafGpuCuller.h"
+#include "RadixSort.h"
+#include "StreamRingBuffer.h"
+#include "Wind.h"
+#include "CanopyVolume.h"
+#include "LeafTextureArray.h"
+#include "GeometryHeap.h"
+#include "HiZOcclusion.h"
+#include "StaticShadowMap.h"
 
 struct LeafInstance {
     glm::vec3 position;
-    glm::vec3 normal;
-    glm::vec2 scale;
-    float rotation;
-    glm::vec3 color;
+    float scale;
+    unsigned int seed;  // 24 bits, leaf.shader derives rotation and tint from it
+    float occlusion;    // Baked ambient visibility, 1 = unoccluded
+    int branch;         // Wind branch it hangs from, its pivot sits on the parent
 };
 
+// GPU leaf instance, 16 bytes. The position is quantized inside the leaf
+// bounds and the normal is rebuilt from it, since it only depends on where
+// the leaf sits relative to the canopy center.
+struct PackedLeafInstance {
+    unsigned short position[3]; // unorm16 offset inside the leaf bounds
+    unsigned char occlusion;    // unorm8
+    unsigned char rank;         // Place in its cluster, 255 * index / count. The CPU
+                                // cull's stream holds the cluster's kept fraction instead.
+    unsigned int seedScale;     // Low 24 bits seed, high 8 bits scale step
+    unsigned int branchLayer;   // Low 24 bits wind branch, high 8 bits texture layer
+};
+static_assert(sizeof(PackedLeafInstance) == 16, "leaf_cull.shader reads instances as one uvec4");
+
 // Structure to hold F segment parameters
 struct SegmentParams {
     float length = 1.0f;
@@ -51,11 +78,39 @@ struct BranchSegment {
     std::vector<int> childIndices;
 };
 
+enum class BranchMesher {
+    Rings,     // Vertex rings per segment, shared at junctions
+    Implicit   // Marching cubes over a smooth union of capsules
+};
+
+// A ring position along a branch chain, produced by the mesher
+struct RingSample {
+    glm::vec3 center;
+    glm::vec3 direction;
+    float radius;
+    int depth;
+    int segment;  // Segment the ring belongs to
+};
+
+// A contiguous slice of the branch mesh addressable with 16-bit indices.
+// Chunks are cut between a segment and its parent, so each one holds whole
+// runs of connected segments and can later be culled or streamed on its own.
+struct BranchChunk {
+    unsigned int baseVertex;   // First vertex of the chunk in the branch buffers
+    unsigned int vertexCount;
+    unsigned int indexOffset;  // First index of the chunk in branchIndices
+    unsigned int indexCount;
+    glm::vec3 boundsMin;
+    glm::vec3 boundsMax;
+};
+
 class Tree {
 public:
     Tree();
     ~Tree();
 
+    // Generate runs without a GL context until Init, so a prototype can be
+    // generated on a worker thread and initialized on the render thread.
     void Init(const glm::vec3& position = glm::vec3(0.0f, 0.0f, 0.0f));
     void Generate(int iterations = 4);
     void Render(Shader& shader, const glm::mat4& view, const glm::mat4& projection);
@@ -64,6 +119,9 @@ public:
     
     // Setters
     void SetPosition(const glm::vec3& pos) { position = pos; }
+    // Reseeds the generator, the next Generate is then reproducible. Trees
+    // are otherwise seeded from the clock.
+    void SetSeed(unsigned int seed) { random.seed(seed); }
     void SetAngle(float angle) { branchAngle = angle; }
     void SetLengthScale(float scale) { lengthScale = scale; }
     void SetRadiusScale(float scale) { radiusScale = scale; }
@@ -74,8 +132,48 @@ public:
     void SetLeafSize(float size) { leafSize = size; }
     void SetLeafDensity(float density) { leafDensity = density; }
     void SetMinLeafDepth(int depth) { minLeafDepth = depth; }
+    void SetLeafBudget(int budget) { leafBudget = budget; }  // Leaves at density 1
     void SetRadialSegments(int segments) { radialSegments = segments; }
     
+    // Spline tessellation of non-branching chains
+    void SetSplineTessellation(bool enabled) { splineTessellation = enabled; }
+    void SetSplineAngleTolerance(float degrees) { splineAngleTolerance = degrees; }
+    void SetSplineRadiusTolerance(float tolerance) { splineRadiusTolerance = tolerance; }
+    
+    // Pipe model radii: r^n = sum of child r^n, scaled so the trunk keeps initialRadius
+    void SetPipeModelRadii(bool enabled) { pipeModelRadii = enabled; }
+    void SetPipeExponent(float exponent) { pipeExponent = exponent; }
+    
+    // Branch mesher selection
+    void SetBranchMesher(BranchMesher mesher) { branchMesher = mesher; }
+    void SetImplicitMeshSettings(const ImplicitMeshSettings& settings) { implicitSettings = settings; }
+    BranchMesher GetBranchMesher() const { return branchMesher; }
+    
+    // Baked ambient occlusion
+    void SetBakeOcclusion(bool enabled) { bakeOcclusion = enabled; }
+    void SetOcclusionSettings(const OcclusionSettings& settings) { occlusionSettings = settings; }
+    
+    // Per-frame leaf cluster culling, takes effect without regenerating
+    void SetLeafCullSettings(const LeafCullSettings& settings) { leafCullSettings = settings; }
+    // Hi-Z depth the CPU cluster cull also tests against, null to skip
+    void SetOcclusion(const HiZOcclusion* occlusion) { this->occlusion = occlusion; }
+    // Alpha-to-coverage with depth writes and front-to-back sorted instances
+    // instead of blending. Needs a multisampled framebuffer to look smooth.
+    void SetLeafAlphaToCoverage(bool enabled) { leafAlphaToCoverage = enabled; }
+    // Sun shadowing and translucency from the canopy density volume
+    void SetCanopyShadowing(bool enabled) { canopyShadowing = enabled; }
+    // Cached sun shadows this tree receives, null for none. The map has to
+    // have been rendered for this tree.
+    void SetShadowMap(const StaticShadowMap* shadowMap) { this->shadowMap = shadowMap; }
+    
+    // Wind is evaluated in the vertex shaders, only uniforms change per frame
+    void SetWind(const WindSettings& settings, float time) { windSettings = settings; windTime = time; }
+    void SetLeafGpuCullShaders(Shader* cullShader, Shader* countShader, Shader* commandShader) {
+        leafGpuCuller.SetShaders(cullShader, countShader, commandShader);
+    }
+    // LeafCullMode::Gpu culls on the CPU where this is false
+    bool IsLeafGpuCullingSupported() const { return leafGpuCuller.IsSupported(); }
+    
     // New randomness parameters
     void SetAngleRandomness(float randomness) { angleRandomness = randomness; }
     void SetLengthRandomness(float randomness) { lengthRandomness = randomness; }
@@ -90,21 +188,63 @@ void SetDivergenceAngle2(float angle) { divergenceAngle2 = angle; }
     float GetDivergenceAngle2() const { return divergenceAngle2; }
     int GetBranchCount() const { return branchSegments.size(); }
     int GetLeafCount() const { return leafInstances.size(); }
+    int GetBranchChunkCount() const { return branchChunks.size(); }
+    int GetLeafClusterCount() const { return leafClusters.GetClusters().size(); }
+    int GetVisibleLeafClusterCount() const { return leafClusterDraws.size(); }
+    int GetDrawnLeafCount() const { return drawnLeafCount; }
     float GetAngleRandomness() const { return angleRandomness; }
     float GetLengthRandomness() const { return lengthRandomness; }
     float GetRadiusRandomness() const { return radiusRandomness; }
     glm::vec3 GetTropism() const { return tropism; }
     float GetBranchProbability() const { return branchProbability; }
     
-    // Texture
+    // Mesh and leaves are in local space, GetModelMatrix places this tree
+    glm::mat4 GetModelMatrix() const;
+    unsigned int GetRevision() const { return revision; }
+    glm::vec3 GetSunDirection() const;
+    void GetLocalBounds(glm::vec3& outMin, glm::vec3& outMax) const { outMin = localBoundsMin; outMax = localBoundsMax; }
+    // Horizontal reach of the bounds from the trunk, for spacing placements
+    float GetCrownRadius() const {
+        glm::vec2 reach = glm::max(-glm::vec2(localBoundsMin.x, localBoundsMin.z), glm::vec2(localBoundsMax.x, localBoundsMax.z));
+        return glm::max(reach.x, reach.y);
+    }
+    const std::vector<PackedLeafInstance>& GetPackedLeafInstances() const { return packedLeafInstances; }
+    
+    // Approximate footprint of the generated data, for streaming budgets
+    size_t GetGpuMemoryBytes() const;
+    size_t GetCpuMemoryBytes() const;
+    
+    // Forest drawing, see Forest.h. Branch commands address the geometry
+    // heap with baseInstance at the first placement, so one multi-draw
+    // covers every prototype. Leaf placements come from the buffer texture
+    // bound to unit 3, leaves from the one bound to unit 4.
+    void ApplyInstancedBranchUniforms(Shader& shader);
+    void AppendBranchCommands(unsigned int firstPlacement, unsigned int placementCount,
+                              std::vector<DrawElementsIndirectCommand>& commands) const;
+    void RenderLeavesInstanced(Shader& leafShader, unsigned int leafCount, float leafGrowth,
+                               int firstPlacement, int placementCount);
+    // Branches and every leaf in the rest pose, alpha tested and without
+    // shadows, for impostor bakes and the shadow map. Skips the leaves
+    // without a leaf shader.
+    void RenderRestPose(Shader& treeShader, Shader* leafShader, const glm::mat4& view,
+                        const glm::mat4& projection);
+    
+    // Times the per-ring CreateVertexRing path against the batched kernels
+    void BenchmarkRingKernels(int repetitions = 20);
+    
+    // Texture. LoadLeafTexture gives the tree a one-layer array of its own,
+    // SetLeafTextures draws from a shared one instead. The array has to
+    // outlive the tree.
     void LoadLeafTexture(const std::string& texturePath);
-    GLuint GetLeafTexture() const { return leafTexture; }
+    void SetLeafTextures(const LeafTextureArray* textures, int layer);
+    GLuint GetLeafTexture() const { return leafTextures ? leafTextures->GetTexture() : 0; }
+    int GetLeafLayer() const { return leafLayer; }
     
 private:
     // L-System interpretation
     void InterpretLSystemRecursive(char symbol, int depth, int maxDepth,
                                    TurtleState& turtle, std::stack<TurtleState>& stack,
-                                   int currentSegmentIndex);
+                                   int& currentSegmentIndex);
     void InterpretSymbol(char c, TurtleState& turtle, std::stack<TurtleState>& stack,
                         int& currentSegmentIndex);
     
@@ -113,26 +253,62 @@ private:
     
     // Continuous mesh generation
     void GenerateContinuousMesh();
+    void SampleChainRings(const std::vector<int>& chain, std::vector<RingSample>& outSamples);
+    void GenerateImplicitMesh();
+    void AppendChunkedMesh(const std::vector<glm::vec3>& positions, const std::vector<glm::vec3>& normals,
+                           const std::vector<glm::vec3>& colors, const std::vector<unsigned int>& branches,
+                           const std::vector<unsigned int>& indices);
     void CreateVertexRing(const glm::vec3& center, const glm::vec3& direction,
                          float radius, std::vector<glm::vec3>& outVertices,
                          std::vector<glm::vec3>& outNormals);
     void ConnectRings(int startRingIndex, int endRingIndex,
-                     std::vector<unsigned int>& indices);
+                     std::vector<unsigned short>& indices);
+    unsigned int QueueVertexRing(const glm::vec3& center, const glm::vec3& direction, float radius);
+    void FlushVertexRings();
+    void BuildRingTables();
+    bool ReserveChunkVertices(unsigned int vertexCount);
+    void FinalizeBranchChunks();
     glm::vec3 CalculateBranchColor(int depth, float radiusRatio);
     void CalculateSegmentRadii();
     
+    // Shared by the single tree and the instanced forest paths
+    void ApplyPlacementUniforms(Shader& shader, bool instanced, int firstPlacement);
+    void ApplyLeafUniforms(Shader& leafShader);
+    void ApplyShadowUniforms(Shader& shader, float casterBias);
+    void BeginLeafBlending(Shader& leafShader);
+    void EndLeafBlending();
+    
+    // Wind hierarchy
+    void BuildWindHierarchy();
+    void UpdateWindBuffer();
+    void ApplyWindUniforms(Shader& shader);
+    
     // Randomness helpers
+    std::mt19937 random;
     float RandomFloat(float min, float max);
     float ApplyRandomness(float value, float randomness);
     
+    // Ambient occlusion bake, runs after the mesh and leaves exist
+    void BakeAmbientOcclusion();
+    
+    // Leaf density volume for sun shadowing, runs after the leaves exist
+    void BuildCanopyVolume();
+    void UpdateCanopyTexture();
+    
     // Leaf generation
     void GenerateLeavesAtEndpoints();
-    void CreateLeafQuadTemplate();
+    void BuildLeafClusters();
+    void PackLeafInstances();
+    void SetLeafInstanceAttributes(GLintptr baseOffset = 0);
     void UpdateLeafInstanceBuffer();
+    glm::vec3 GetCanopyCenter() const;
+    glm::vec3 GetLeafNormal(const glm::vec3& leafPosition) const;
     void SetupLeafBuffers();
+    void SortVisibleLeaves(const glm::vec3& cameraPosition, const glm::vec3& viewDirection);
     
     // OpenGL setup
     void SetupBranchBuffers();
+    void UploadBuffers();
     
     // L-System parameters
     std::string axiom;
@@ -147,6 +323,21 @@ private:
     float initialRadius;
     int radialSegments;
     
+    // Spline tessellation parameters
+    bool splineTessellation;      // Fit one curve per non-branching chain
+    float splineAngleTolerance;   // Degrees of tangent change before a new ring
+    float splineRadiusTolerance;  // Relative radius change before a new ring
+    
+    // Pipe model parameters
+    bool pipeModelRadii;          // Replace turtle radii with the pipe model pass
+    float pipeExponent;           // 2 = da Vinci's rule, up to 3 for thicker forks
+    
+    BranchMesher branchMesher;
+    ImplicitMeshSettings implicitSettings;
+    
+    bool bakeOcclusion;
+    OcclusionSettings occlusionSettings;
+    
     // New randomness parameters
     float angleRandomness;      // 0-1, adds random variation to angles
     float lengthRandomness;     // 0-1, adds random variation to segment lengths
@@ -162,7 +353,16 @@ private:
     float leafSize;
     float leafDensity;
     int minLeafDepth;
-    GLuint leafTexture;
+    int leafBudget;
+    LeafTextureArray ownLeafTextures;
+    const LeafTextureArray* leafTextures;
+    int leafLayer;
+    
+    // Optical depth toward the sun through the leaves
+    CanopyVolume canopyVolume;
+    GLuint canopyTexture;
+    bool canopyShadowing;
+    const StaticShadowMap* shadowMap;
     
     // Branch structure
     std::vector<BranchSegment> branchSegments;
@@ -171,22 +371,70 @@ private:
     std::vector<glm::vec3> branchVertices;
     std::vector<glm::vec3> branchNormals;
     std::vector<glm::vec3> branchColors;
-    std::vector<unsigned int> branchIndices;
+    std::vector<float> branchOcclusion;
+    std::vector<unsigned int> branchWindIndices;  // Wind branch of each vertex
+    std::vector<unsigned short> branchIndices;  // Chunk-local, see branchChunks
+    std::vector<BranchChunk> branchChunks;
+    
+    // Batched ring generation (see RingKernels.h)
+    RingBatch ringBatch;
+    unsigned int ringBatchBaseVertex;
+    std::vector<float> ringCosTable;
+    std::vector<float> ringSinTable;
+    
+    // Wind hierarchy, shared by branches and leaves through the heap's
+    // buffer texture. windRange.offset is this tree's first branch in it.
+    std::vector<WindBranch> windBranches;
+    std::vector<int> segmentWindBranch;
+    WindSettings windSettings;
+    float windTime;
+    HeapRange windRange;
     
     // Leaf data
-    std::vector<glm::vec3> leafQuadVertices;
-    std::vector<glm::vec2> leafQuadUVs;
-    std::vector<unsigned int> leafQuadIndices;
     std::vector<LeafInstance> leafInstances;
+    std::vector<PackedLeafInstance> packedLeafInstances;
+    glm::vec3 leafBoundsMin;
+    glm::vec3 leafBoundsExtent;
+    float leafScaleMin;
+    float leafScaleStep;
     
-    // OpenGL objects for branches
-    GLuint branchVAO, branchVBO, branchNBO, branchCBO, branchEBO;
+    // Branch mesh in the geometry heap, drawn from a reused command list
+    HeapRange branchVertexRange, branchIndexRange;
+    std::vector<DrawElementsIndirectCommand> branchCommands;
     bool branchBuffersInitialized;
     
-    // OpenGL objects for leaves
-    GLuint leafVAO, leafVBO, leafUVBO, leafEBO, leafInstanceVBO;
+    // Leaf instances in the geometry heap, leafVAO points at them
+    GLuint leafVAO;
+    HeapRange leafRange;
+    
+    // Leaf clusters and the per-frame stream of surviving instances
+    LeafClusterSet leafClusters;
+    LeafCullSettings leafCullSettings;
+    const HiZOcclusion* occlusion;
+    std::vector<LeafClusterDraw> leafClusterDraws;
+    std::vector<PackedLeafInstance> visibleLeafInstances;
+    StreamRingBuffer leafStream;
+    GLuint leafVisibleVAO;
+    unsigned int drawnLeafCount;
+    
+    // Front-to-back ordering of the streamed instances
+    bool leafAlphaToCoverage;
+    bool leafAlphaTest;  // Rest-pose renders, a hard cutoff on the static instances
+    RadixSorter leafSorter;
+    std::vector<unsigned short> leafDepthKeys;
+    std::vector<float> leafDepths;
+    std::vector<unsigned int> leafSortOrder;
+    std::vector<PackedLeafInstance> sortedLeafInstances;
+    
+    // GPU culling writes the survivors and their draw command itself
+    LeafGpuCuller leafGpuCuller;
+    GLuint leafGpuVAO;
     bool leafBuffersInitialized;
     
+    // Bumped whenever the packed leaves change, lets a Forest notice rebuilt prototypes
+    unsigned int revision;
+    glm::vec3 localBoundsMin, localBoundsMax;
+    
     // Stack indices for branching (used during generation)
     std::stack<int> segmentIndexStack;
 };
\ No newline at end of file
@@ -0,0 +1,184 @@
+#include "TreeImpostor.h"
+#include "Tree.h"
+#include <glm/gtc/matrix_transform.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+
+// Inverse of the octahedral mapping in the shaders, +Y at the center
+static glm::vec3 OctDecode(const glm::vec2& p) {
+    glm::vec3 n(p.x, 1.0f - std::abs(p.x) - std::abs(p.y), p.y);
+    if (n.y < 0.0f) {
+        float x = (1.0f - std::abs(n.z)) * (n.x >= 0.0f ? 1.0f : -1.0f);
+        float z = (1.0f - std::abs(n.x)) * (n.z >= 0.0f ? 1.0f : -1.0f);
+        n.x = x;
+        n.z = z;
+    }
+    return glm::normalize(n);
+}
+
+static GLuint CreateAtlasTexture(GLenum format, GLenum pixelFormat, GLenum pixelType, int size, bool mipmapped) {
+    GLuint texture = 0;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, format, size, size, 0, pixelFormat, pixelType, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, mipmapped ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    if (mipmapped) glGenerateMipmap(GL_TEXTURE_2D);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    return texture;
+}
+
+TreeImpostor::TreeImpostor()
+    : baked(false), revision(0), atlasSize(0), center(0.0f), radius(0.0f),
+      albedoTexture(0), surfaceTexture(0), depthTexture(0), framebuffer(0) {
+}
+
+bool TreeImpostor::Allocate(int atlasSize) {
+    Clean();
+
+    albedoTexture = CreateAtlasTexture(GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, atlasSize, true);
+    surfaceTexture = CreateAtlasTexture(GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, atlasSize, true);
+    depthTexture = CreateAtlasTexture(GL_DEPTH_COMPONENT24, GL_DEPTH_COMPONENT, GL_FLOAT, atlasSize, false);
+
+    GLint boundFramebuffer = 0;
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &boundFramebuffer);
+    glGenFramebuffers(1, &framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, albedoTexture, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, surfaceTexture, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthTexture, 0);
+    GLenum drawBuffers[2] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+    glDrawBuffers(2, drawBuffers);
+    bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+    glBindFramebuffer(GL_FRAMEBUFFER, boundFramebuffer);
+
+    if (!complete) {
+        std::cerr << "Impostor atlas framebuffer is incomplete" << std::endl;
+        Clean();
+        return false;
+    }
+    this->atlasSize = atlasSize;
+    return true;
+}
+
+int TreeImpostor::bakesLeft = 1;
+
+bool TreeImpostor::TakeBake() {
+    if (bakesLeft <= 0) return false;
+    bakesLeft--;
+    return true;
+}
+
+void TreeImpostor::Clean() {
+    if (framebuffer) glDeleteFramebuffers(1, &framebuffer);
+    if (albedoTexture) glDeleteTextures(1, &albedoTexture);
+    if (surfaceTexture) glDeleteTextures(1, &surfaceTexture);
+    if (depthTexture) glDeleteTextures(1, &depthTexture);
+    framebuffer = albedoTexture = surfaceTexture = depthTexture = 0;
+    atlasSize = 0;
+    baked = false;
+}
+
+bool TreeImpostor::Bake(Tree& tree, Shader& treeShader, Shader& leafShader, const ImpostorSettings& settings) {
+    auto start = std::chrono::high_resolution_clock::now();
+
+    glm::vec3 boundsMin, boundsMax;
+    tree.GetLocalBounds(boundsMin, boundsMax);
+    float boundsRadius = glm::length(boundsMax - boundsMin) * 0.5f;
+    if (boundsRadius <= 0.0f) return false;
+
+    int frames = std::max(settings.frames, 1);
+    int frameSize = std::max(settings.frameSize, 1);
+    if (frames * frameSize != atlasSize || !framebuffer) {
+        if (!Allocate(frames * frameSize)) return false;
+    }
+    this->settings = settings;
+    this->settings.frames = frames;
+    this->settings.frameSize = frameSize;
+    center = (boundsMin + boundsMax) * 0.5f;
+    radius = boundsRadius * 1.02f;  // A texel of margin around the silhouette
+
+    GLint previousFramebuffer = 0, previousViewport[4];
+    GLfloat previousClearColor[4];
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &previousFramebuffer);
+    glGetIntegerv(GL_VIEWPORT, previousViewport);
+    glGetFloatv(GL_COLOR_CLEAR_VALUE, previousClearColor);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glViewport(0, 0, atlasSize, atlasSize);
+    glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+    glDepthMask(GL_TRUE);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    glEnable(GL_DEPTH_TEST);
+
+    treeShader.Bind();
+    treeShader.SetUniform1i("u_ImpostorBake", 1);
+    leafShader.Bind();
+    leafShader.SetUniform1i("u_ImpostorBake", 1);
+
+    // Orthographic over the bounding sphere, depth runs across its diameter
+    glm::mat4 projection = glm::ortho(-radius, radius, -radius, radius, 0.0f, 2.0f * radius);
+    for (int y = 0; y < frames; y++) {
+        for (int x = 0; x < frames; x++) {
+            glm::vec2 cell = (glm::vec2(x, y) + 0.5f) / (float)frames;
+            glm::vec3 direction = OctDecode(cell * 2.0f - 1.0f);
+            glm::vec3 up = std::abs(direction.y) > 0.999f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+            glm::mat4 view = glm::lookAt(center + direction * radius, center, up);
+
+            glViewport(x * frameSize, y * frameSize, frameSize, frameSize);
+            tree.RenderRestPose(treeShader, &leafShader, view, projection);
+        }
+    }
+
+    treeShader.Bind();
+    treeShader.SetUniform1i("u_ImpostorBake", 0);
+    leafShader.Bind();
+    leafShader.SetUniform1i("u_ImpostorBake", 0);
+    leafShader.Unbind();
+
+    // Distant placements are a few texels wide, so the color atlases get mips
+    glBindTexture(GL_TEXTURE_2D, albedoTexture);
+    glGenerateMipmap(GL_TEXTURE_2D);
+    glBindTexture(GL_TEXTURE_2D, surfaceTexture);
+    glGenerateMipmap(GL_TEXTURE_2D);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, previousFramebuffer);
+    glViewport(previousViewport[0], previousViewport[1], previousViewport[2], previousViewport[3]);
+    glClearColor(previousClearColor[0], previousClearColor[1], previousClearColor[2], previousClearColor[3]);
+
+    baked = true;
+    revision = tree.GetRevision();
+
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    std::cout << "Impostor baked: " << frames << "x" << frames << " views of " << frameSize << "px in " << ms << " ms" << std::endl;
+    return true;
+}
+
+void TreeImpostor::Apply(Shader& impostorShader) const {
+    glActiveTexture(GL_TEXTURE5);
+    glBindTexture(GL_TEXTURE_2D, albedoTexture);
+    glActiveTexture(GL_TEXTURE6);
+    glBindTexture(GL_TEXTURE_2D, surfaceTexture);
+    glActiveTexture(GL_TEXTURE7);
+    glBindTexture(GL_TEXTURE_2D, depthTexture);
+    glActiveTexture(GL_TEXTURE0);
+
+    impostorShader.SetUniform1i("u_ImpostorAlbedo", 5);
+    impostorShader.SetUniform1i("u_ImpostorSurface", 6);
+    impostorShader.SetUniform1i("u_ImpostorDepth", 7);
+    impostorShader.SetUniform3f("u_ImpostorCenter", center.x, center.y, center.z);
+    impostorShader.SetUniform1f("u_ImpostorRadius", radius);
+    impostorShader.SetUniform1i("u_ImpostorFrames", settings.frames);
+}
+
+size_t TreeImpostor::GetGpuMemoryBytes() const {
+    if (!framebuffer) return 0;
+    // Two RGBA8 atlases with mips, a third more each, and the depth atlas
+    size_t texels = (size_t)atlasSize * atlasSize;
+    return texels * 4 * 2 * 4 / 3 + texels * 4;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include "Shader.h"
+
+class Tree;
+
+struct ImpostorSettings {
+    int frames = 8;      // Views per side of the octahedral grid
+    int frameSize = 64;  // Texels per side of one view
+};
+
+// A tree baked into atlases of views from all around it, for distant forest
+// placements. View (x, y) of the grid looks at the tree from the direction
+// that octahedrally maps to the center of its cell, +Y in the middle.
+// - Albedo: unlit color and coverage.
+// - Surface: octahedrally encoded normal, ambient occlusion and the sunlight
+//   left by the canopy, so impostors are relit like leaves.
+// - Depth: linear over the bounding sphere's diameter, impostors write the
+//   baked surface's depth.
+// Every view is an orthographic render of the rest pose through the tree's
+// own shaders. impostor.shader draws one camera-facing quad per placement
+// and blends the four views nearest to the camera direction.
+class TreeImpostor {
+public:
+    TreeImpostor();
+
+    // Renders all views, needs the GL context. Bakes again reuse the atlases
+    // while the settings are unchanged.
+    bool Bake(Tree& tree, Shader& treeShader, Shader& leafShader,
+              const ImpostorSettings& settings = ImpostorSettings());
+    void Clean();
+
+    bool IsBaked() const { return baked; }
+    unsigned int GetRevision() const { return revision; }  // Of the tree when baked
+    const ImpostorSettings& GetSettings() const { return settings; }
+
+    // Binds the atlases to units 5 to 7 and sets the bake's uniforms
+    void Apply(Shader& impostorShader) const;
+
+    size_t GetGpuMemoryBytes() const;
+
+    // Bakes are shared between every forest and streamed tile, so a batch of
+    // new prototypes cannot stall one frame. BeginFrame refills the budget,
+    // TakeBake uses up one bake of it and returns false once it is spent.
+    static void BeginFrame(int bakeBudget = 1) { bakesLeft = bakeBudget; }
+    static bool TakeBake();
+
+private:
+    bool Allocate(int atlasSize);
+
+    static int bakesLeft;
+
+    bool baked;
+    unsigned int revision;
+    ImpostorSettings settings;
+    int atlasSize;
+    glm::vec3 center;
+    float radius;
+
+    GLuint albedoTexture;
+    GLuint surfaceTexture;
+    GLuint depthTexture;
+    GLuint framebuffer;
+};
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+struct WindSettings {
+    bool enabled = true;
+    float strength = 1.0f;    // Scales the sway of every level
+    float frequency = 0.6f;   // Oscillations per second of the stiffest branches
+    float heading = 30.0f;    // Direction the wind blows towards, degrees around +Y
+};
+
+// One level of the sway hierarchy: a run of segments that continue each
+// other. Every vertex and leaf stores the index of the branch it hangs from,
+// and the vertex shaders walk the parent links up to the trunk, rotating
+// about each pivot in turn. A child's pivot lies on its parent, so joints
+// stay closed however far the levels swing.
+struct WindBranch {
+    glm::vec3 pivot;    // Where the branch attaches to its parent
+    float stiffness;    // Base radius over the trunk's, stiffer branches sway less
+    int parent;         // -1 for the trunk
+    int depth;          // Branching level, 0 for the trunk
+    float phase;        // Hashed offset so neighbours do not sway in lockstep
+};
@@ -0,0 +1,9 @@
+// Screen-door dither of a copy cross-fading between LOD levels, see
+// LodTransitions.h. x is the fade, y is 1 on the outgoing copy.
+bool LodDithered(vec2 lodFade) {
+    const float bayer[16] = float[16](0.0, 8.0, 2.0, 10.0, 12.0, 4.0, 14.0, 6.0,
+                                      3.0, 11.0, 1.0, 9.0, 15.0, 7.0, 13.0, 5.0);
+    ivec2 pixel = ivec2(gl_FragCoord.xy) & 3;
+    float threshold = (bayer[pixel.y * 4 + pixel.x] + 0.5) / 16.0;
+    return (threshold < lodFade.x) == (lodFade.y > 0.5);
+}
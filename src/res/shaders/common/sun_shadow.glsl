@@ -0,0 +1,14 @@
+// Cached sun shadows, see StaticShadowMap.h
+uniform int u_ShadowMapping;
+uniform sampler2DShadow u_ShadowMap;
+uniform mat4 u_ShadowViewProjection;
+uniform float u_ShadowBias;  // In depth, covers the receiver's offset from the caster
+
+// Sunlight past the cached shadow casters, 1 outside the map. One filtered
+// comparison.
+float SunVisibility(vec3 worldPos) {
+    if (u_ShadowMapping == 0) return 1.0;
+    vec3 coord = (u_ShadowViewProjection * vec4(worldPos, 1.0)).xyz * 0.5 + 0.5;
+    if (any(lessThan(coord, vec3(0.0))) || any(greaterThan(coord, vec3(1.0)))) return 1.0;
+    return texture(u_ShadowMap, vec3(coord.xy, coord.z - u_ShadowBias));
+}
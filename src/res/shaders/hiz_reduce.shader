@@ -0,0 +1,26 @@
+#shader vertex
+#version 330 core
+
+// Fullscreen triangle from the vertex index
+void main() {
+    vec2 corner = vec2(float((gl_VertexID << 1) & 2), float(gl_VertexID & 2));
+    gl_Position = vec4(corner * 2.0 - 1.0, 0.0, 1.0);
+}
+
+#shader fragment
+#version 330 core
+
+// The previous level, the only one inside the texture's base/max range
+uniform sampler2D u_Depth;
+
+// Farthest of the 2x2 texels below, odd edges clamp onto the last texel
+void main() {
+    ivec2 size = textureSize(u_Depth, 0);
+    ivec2 base = ivec2(gl_FragCoord.xy) * 2;
+    ivec2 last = size - 1;
+    float d0 = texelFetch(u_Depth, min(base, last), 0).r;
+    float d1 = texelFetch(u_Depth, min(base + ivec2(1, 0), last), 0).r;
+    float d2 = texelFetch(u_Depth, min(base + ivec2(0, 1), last), 0).r;
+    float d3 = texelFetch(u_Depth, min(base + ivec2(1, 1), last), 0).r;
+    gl_FragDepth = max(max(d0, d1), max(d2, d3));
+}
@@ -0,0 +1,158 @@
+#shader vertex
+#version 330 core
+
+// Placements, three RGBA32F texels each, see ForestInstanceData
+uniform samplerBuffer u_ForestInstances;
+uniform int u_ForestBase;
+
+uniform mat4 u_View;
+uniform mat4 u_Projection;
+uniform vec3 u_CameraPos;
+
+// The prototype's bake, see TreeImpostor.h
+uniform vec3 u_ImpostorCenter;
+uniform float u_ImpostorRadius;
+uniform int u_ImpostorFrames;
+
+out vec3 v_WorldPos;
+out vec4 v_FrameUV01;  // Atlas coordinates in the four nearest views
+out vec4 v_FrameUV23;
+flat out vec4 v_FrameWeights;
+flat out vec3 v_Tint;
+flat out vec2 v_Yaw;   // cos, sin
+flat out float v_Radius;
+flat out vec2 v_LodFade;
+
+#include "common/octahedral.glsl"
+
+// Right and up of a view looking back along direction, as glm::lookAt builds them
+void ViewBasis(vec3 direction, out vec3 right, out vec3 up) {
+    vec3 worldUp = abs(direction.y) > 0.999 ? vec3(0.0, 0.0, 1.0) : vec3(0.0, 1.0, 0.0);
+    right = normalize(cross(worldUp, direction));
+    up = cross(direction, right);
+}
+
+// Where a local offset, in radii from the center, lands in one frame of the atlas
+vec2 FrameUV(ivec2 frame, vec3 offset) {
+    vec2 cell = (vec2(frame) + 0.5) / float(u_ImpostorFrames);
+    vec3 right, up;
+    ViewBasis(OctDecode(cell * 2.0 - 1.0), right, up);
+    vec2 uv = vec2(dot(offset, right), dot(offset, up)) * 0.5 + 0.5;
+    return (vec2(frame) + uv) / float(u_ImpostorFrames);
+}
+
+void main() {
+    int placement = (u_ForestBase + gl_InstanceID) * 3;
+    vec4 positionScale = texelFetch(u_ForestInstances, placement);
+    vec4 tintYaw = texelFetch(u_ForestInstances, placement + 1);
+    v_LodFade = texelFetch(u_ForestInstances, placement + 2).xy;
+    float c = cos(tintYaw.w);
+    float s = sin(tintYaw.w);
+    v_Tint = tintYaw.rgb;
+    v_Yaw = vec2(c, s);
+
+    vec3 localCenter = u_ImpostorCenter * positionScale.w;
+    vec3 center = positionScale.xyz + vec3(c * localCenter.x + s * localCenter.z, localCenter.y,
+                                           -s * localCenter.x + c * localCenter.z);
+    float radius = u_ImpostorRadius * positionScale.w;
+    v_Radius = radius;
+
+    // Camera-facing quad around the bounding sphere
+    vec3 toCamera = normalize(u_CameraPos - center);
+    vec3 right, up;
+    ViewBasis(toCamera, right, up);
+    vec2 corner = vec2(float(gl_VertexID & 1), float(gl_VertexID >> 1)) * 2.0 - 1.0;
+    v_WorldPos = center + (right * corner.x + up * corner.y) * radius;
+
+    // The camera direction in the prototype's frame picks the views to blend
+    vec3 localDirection = vec3(c * toCamera.x - s * toCamera.z, toCamera.y, s * toCamera.x + c * toCamera.z);
+    vec2 grid = (OctEncode(localDirection) * 0.5 + 0.5) * float(u_ImpostorFrames) - 0.5;
+    vec2 base = floor(grid);
+    vec2 f = grid - base;
+    v_FrameWeights = vec4((1.0 - f.x) * (1.0 - f.y), f.x * (1.0 - f.y), (1.0 - f.x) * f.y, f.x * f.y);
+
+    // The quad corner projected into each view, interpolation keeps it exact
+    vec3 worldOffset = (right * corner.x + up * corner.y);
+    vec3 offset = vec3(c * worldOffset.x - s * worldOffset.z, worldOffset.y, s * worldOffset.x + c * worldOffset.z);
+    ivec2 last = ivec2(u_ImpostorFrames - 1);
+    ivec2 frame = ivec2(base);
+    v_FrameUV01.xy = FrameUV(clamp(frame, ivec2(0), last), offset);
+    v_FrameUV01.zw = FrameUV(clamp(frame + ivec2(1, 0), ivec2(0), last), offset);
+    v_FrameUV23.xy = FrameUV(clamp(frame + ivec2(0, 1), ivec2(0), last), offset);
+    v_FrameUV23.zw = FrameUV(clamp(frame + ivec2(1, 1), ivec2(0), last), offset);
+
+    gl_Position = u_Projection * u_View * vec4(v_WorldPos, 1.0);
+}
+
+#shader fragment
+#version 330 core
+
+in vec3 v_WorldPos;
+in vec4 v_FrameUV01;
+in vec4 v_FrameUV23;
+flat in vec4 v_FrameWeights;
+flat in vec3 v_Tint;
+flat in vec2 v_Yaw;
+flat in float v_Radius;
+flat in vec2 v_LodFade;
+
+out vec4 FragColor;
+
+uniform sampler2D u_ImpostorAlbedo;   // Color, coverage
+uniform sampler2D u_ImpostorSurface;  // Octahedral normal, occlusion, sun transmittance
+uniform sampler2D u_ImpostorDepth;    // Linear over the sphere's diameter
+uniform vec3 u_CameraPos;
+uniform vec3 u_LightDir;
+uniform mat4 u_View;
+uniform mat4 u_Projection;
+
+#include "common/octahedral.glsl"
+#include "common/lod_dither.glsl"
+
+void main() {
+    vec2 uv[4] = vec2[4](v_FrameUV01.xy, v_FrameUV01.zw, v_FrameUV23.xy, v_FrameUV23.zw);
+
+    // Coverage-weighted blend of the four views
+    float coverage = 0.0;
+    vec3 albedo = vec3(0.0);
+    vec3 normal = vec3(0.0);
+    float occlusion = 0.0;
+    float transmittance = 0.0;
+    float depth = 0.0;
+    for (int i = 0; i < 4; i++) {
+        vec4 color = texture(u_ImpostorAlbedo, uv[i]);
+        float weight = v_FrameWeights[i] * color.a;
+        if (weight <= 0.0) continue;
+        vec4 surface = texture(u_ImpostorSurface, uv[i]);
+        coverage += weight;
+        albedo += color.rgb * weight;
+        normal += OctDecode(surface.xy * 2.0 - 1.0) * weight;
+        occlusion += surface.z * weight;
+        transmittance += surface.w * weight;
+        depth += textureLod(u_ImpostorDepth, uv[i], 0.0).r * weight;
+    }
+    if (coverage < 0.5 || LodDithered(v_LodFade)) discard;
+    albedo /= coverage;
+    occlusion /= coverage;
+    transmittance /= coverage;
+    depth /= coverage;
+
+    // Back into the world, the bake is in the prototype's frame
+    normal = normalize(normal);
+    normal = vec3(v_Yaw.x * normal.x + v_Yaw.y * normal.z, normal.y, -v_Yaw.y * normal.x + v_Yaw.x * normal.z);
+
+    // The leaf model, the canopy is most of what is left at this distance
+    float diffuse = pow(max(dot(normal, u_LightDir), 0.0), 0.7) * transmittance;
+    float lightIntensity = 0.35 * occlusion + diffuse * 0.65 * mix(0.5, 1.0, occlusion);
+    vec3 color = albedo * v_Tint * lightIntensity;
+    float backlight = max(dot(normal, -u_LightDir), 0.0);
+    color += vec3(0.4, 0.7, 0.3) * backlight * 0.25 * transmittance;
+
+    // Push the depth to the baked surface so neighbouring impostors overlap properly
+    vec3 viewRay = normalize(v_WorldPos - u_CameraPos);
+    vec3 surfacePos = v_WorldPos + viewRay * (depth * 2.0 - 1.0) * v_Radius;
+    vec4 clip = u_Projection * u_View * vec4(surfacePos, 1.0);
+    gl_FragDepth = clip.z / clip.w * 0.5 + 0.5;
+
+    FragColor = vec4(color, 1.0);
+}
@@ -1,28 +1,168 @@
 #shader vertex
 #version 330 core
 
-layout(location = 0) in vec3 a_Position;      // Quad vertex position
-layout(location = 1) in vec2 a_TexCoord;      // UV coordinates
-layout(location = 2) in vec3 a_InstancePos;   // Instance position
-layout(location = 3) in vec3 a_InstanceNormal; // Spherical normal for lighting
-layout(location = 4) in vec2 a_InstanceScale;  // Scale (XY)
-layout(location = 5) in float a_InstanceRotation; // Rotation around view axis
-layout(location = 6) in vec3 a_InstanceColor;  // Color tint
+layout(location = 0) in vec3 a_InstancePos;       // unorm16 offset inside the leaf bounds
+layout(location = 1) in float a_InstanceOcclusion; // Baked ambient visibility
+layout(location = 2) in uint a_InstanceSeedScale;  // Low 24 bits seed, high 8 bits scale step
+layout(location = 3) in uint a_InstanceBranchLayer; // Low 24 bits wind branch, high 8 bits texture layer
+layout(location = 4) in float a_InstanceKeep;      // Fraction of its cluster the CPU cull kept
 
 out vec2 v_TexCoord;
 out vec3 v_Normal;
 out vec3 v_WorldPos;
 out vec3 v_Color;
+out float v_Occlusion;
+flat out float v_Layer;
+out vec3 v_LocalPos;  // Leaf center in the tree's space, for the canopy volume
+flat out vec2 v_LodFade;
 
 uniform mat4 u_View;
 uniform mat4 u_Projection;
 
+uniform mat4 u_Model;                     // Placement of a single tree
+uniform int u_ForestInstanced;            // Placements come from u_ForestInstances instead
+uniform samplerBuffer u_ForestInstances;  // Three texels per placement, see ForestInstanceData
+uniform int u_ForestBase;                 // First placement of this draw
+uniform usamplerBuffer u_ForestLeaves;    // The heap's PackedLeafInstances, one uvec4 each
+uniform int u_ForestLeafBase;             // This prototype's first leaf in u_ForestLeaves
+uniform int u_ForestLeafCount;            // Leaves drawn per placement
+uniform float u_LeafGrowth;               // Card scale making up for a thinned band
+
+uniform vec3 u_LeafBoundsMin;
+uniform vec3 u_LeafBoundsExtent;
+uniform vec3 u_CanopyCenter;
+uniform float u_LeafScaleMin;
+uniform float u_LeafScaleStep;
+
+// Distance pruning, see LeafKeepFraction in LeafClusters.h
+uniform vec3 u_CameraPos;
+uniform float u_PruneStart;
+uniform float u_MinKeepFraction;
+uniform int u_ClusterKeep;  // Grow by a_InstanceKeep instead of the leaf's own distance
+
+uniform samplerBuffer u_WindBranches;
+uniform int u_WindBase;  // This tree's first branch in u_WindBranches
+uniform vec3 u_WindDirection;
+uniform float u_WindStrength;
+uniform float u_WindFrequency;
+uniform float u_Time;
+
+vec3 RotateAxisAngle(vec3 v, vec3 axis, float angle) {
+    float c = cos(angle);
+    float s = sin(angle);
+    return v * c + cross(axis, v) * s + axis * dot(axis, v) * (1.0 - c);
+}
+
+// Walks from a branch up to the trunk (see WindBranch in Wind.h). Each level
+// rotates the point about its pivot, child first, so every pivot follows
+// the swing of the levels above it and joints stay closed. Runs in the
+// tree's local space.
+void ApplyWind(int branch, vec3 windDirection, float time, inout vec3 position, inout vec3 normal) {
+    if (u_WindStrength <= 0.0) return;
+    
+    vec3 bendAxis = normalize(cross(vec3(0.0, 1.0, 0.0), windDirection));
+    float gust = 0.6 + 0.4 * sin(time * 0.37) * sin(time * 0.23 + 1.3);
+    
+    for (int level = 0; level < 16 && branch >= 0; level++) {
+        vec4 node = texelFetch(u_WindBranches, branch * 2);      // pivot, stiffness
+        vec4 link = texelFetch(u_WindBranches, branch * 2 + 1);  // parent, depth, phase
+        
+        // Thin branches bend further and oscillate faster
+        float stiffness = node.w;
+        float amount = u_WindStrength * 0.012 / (stiffness + 0.08);
+        float t = time * u_WindFrequency * (1.0 + 1.5 * (1.0 - stiffness)) * 6.2831853 + link.z;
+        float bend = amount * gust * (0.5 + 0.6 * sin(t) + 0.25 * sin(t * 2.13 + 0.7));
+        float twist = amount * 0.4 * sin(t * 1.37 + 2.1);
+        
+        vec3 offset = RotateAxisAngle(position - node.xyz, bendAxis, bend);
+        position = node.xyz + RotateAxisAngle(offset, windDirection, twist);
+        normal = RotateAxisAngle(RotateAxisAngle(normal, bendAxis, bend), windDirection, twist);
+        
+        branch = int(link.x);
+    }
+}
+
+// Integer hash (PCG output permutation), returns [0, 1)
+float Hash(uint x) {
+    uint state = x * 747796405u + 2891336453u;
+    uint word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+    return float((word >> 22u) ^ word) * (1.0 / 4294967296.0);
+}
+
+// Model matrix of a forest placement, with its tint and a wind time offset
+mat4 LoadPlacement(int placement, out vec3 tint, out float windPhase, out vec2 lodFade) {
+    vec4 positionScale = texelFetch(u_ForestInstances, placement * 3);
+    vec4 tintYaw = texelFetch(u_ForestInstances, placement * 3 + 1);
+    lodFade = texelFetch(u_ForestInstances, placement * 3 + 2).xy;
+    float c = cos(tintYaw.w) * positionScale.w;
+    float s = sin(tintYaw.w) * positionScale.w;
+    tint = tintYaw.rgb;
+    
+    // Neighbouring trees sway out of step
+    windPhase = fract(sin(dot(positionScale.xz, vec2(12.9898, 78.233))) * 43758.5453) * 100.0;
+    return mat4(vec4(c, 0.0, -s, 0.0),
+                vec4(0.0, positionScale.w, 0.0, 0.0),
+                vec4(s, 0.0, c, 0.0),
+                vec4(positionScale.xyz, 1.0));
+}
+
 void main() {
-    v_TexCoord = a_TexCoord;
-    v_Color = a_InstanceColor;
+    // Quad corner from the vertex index, drawn as a 4 vertex triangle strip
+    vec2 corner = vec2(float(gl_VertexID & 1), float(gl_VertexID >> 1));
+    v_TexCoord = corner;
+    
+    vec3 instanceUnit = a_InstancePos;
+    float instanceOcclusion = a_InstanceOcclusion;
+    uint seedScale = a_InstanceSeedScale;
+    uint branchLayer = a_InstanceBranchLayer;
+    mat4 model = u_Model;
+    vec3 tint = vec3(1.0);
+    float windPhase = 0.0;
+    v_LodFade = vec2(1.0, 0.0);
+    if (u_ForestInstanced != 0) {
+        // Every placement in the draw repeats the same run of leaves
+        model = LoadPlacement(u_ForestBase + gl_InstanceID / u_ForestLeafCount, tint, windPhase, v_LodFade);
+        uvec4 leaf = texelFetch(u_ForestLeaves, u_ForestLeafBase + gl_InstanceID % u_ForestLeafCount);
+        instanceUnit = vec3(float(leaf.x & 0xFFFFu), float(leaf.x >> 16u), float(leaf.y & 0xFFFFu)) / 65535.0;
+        instanceOcclusion = float((leaf.y >> 16u) & 0xFFu) / 255.0;
+        seedScale = leaf.z;
+        branchLayer = leaf.w;
+    }
+    
+    uint seed = seedScale & 0xFFFFFFu;
+    float scale = u_LeafScaleMin + float(seedScale >> 24u) * u_LeafScaleStep;
+    float rotation = Hash(seed) * 6.28318531;
+    v_Color = vec3(0.2, 0.6, 0.15) * (0.85 + 0.3 * Hash(seed ^ 0x5bd1e9u)) * tint;
+    v_Occlusion = instanceOcclusion;
+    v_Layer = float(branchLayer >> 24u);
+    
+    // Everything up to the billboard runs in the tree's local space
+    vec3 restPos = u_LeafBoundsMin + instanceUnit * u_LeafBoundsExtent;
+    vec3 instancePos = restPos;
+    vec3 unusedNormal = vec3(0.0, 1.0, 0.0);
+    vec3 windDirection = normalize(transpose(mat3(model)) * u_WindDirection);
+    ApplyWind(u_WindBase + int(branchLayer & 0xFFFFFFu), windDirection, u_Time + windPhase, instancePos, unusedNormal);
+    v_LocalPos = instancePos;
+    
+    // Flutter on top of the branch sway
+    rotation += u_WindStrength * 0.25 * sin(u_Time * 7.0 + Hash(seed ^ 0x27d4eb2du) * 6.28318531);
+    
+    // Thinned clusters draw fewer leaves, grow the survivors to cover the same
+    // area. The CPU cull trims whole clusters by their nearest point and
+    // streams what it kept, the GPU cull keeps by this leaf's own distance.
+    float keepFraction;
+    if (u_ClusterKeep != 0 && u_ForestInstanced == 0) {
+        keepFraction = max(a_InstanceKeep, 1.0 / 255.0);
+    } else {
+        float pruneRatio = u_PruneStart / max(distance(restPos, u_CameraPos), u_PruneStart);
+        keepFraction = max(pruneRatio * pruneRatio, u_MinKeepFraction);
+    }
+    scale *= inversesqrt(keepFraction) * u_LeafGrowth;
+    scale *= length(model[0].xyz);
     
     // The spherical normal (points from tree center outward)
-    v_Normal = normalize(a_InstanceNormal);
+    vec3 fromCenter = restPos - u_CanopyCenter;
+    v_Normal = dot(fromCenter, fromCenter) > 1e-12 ? normalize(mat3(model) * fromCenter) : vec3(0.0, 1.0, 0.0);
     
     // Extract camera right and up vectors directly from view matrix
     // View matrix transforms world to camera space, so we extract the inverse directions
@@ -30,18 +170,19 @@ void main() {
     vec3 cameraUp = vec3(u_View[0][1], u_View[1][1], u_View[2][1]);
     
     // Apply rotation around the view direction (for variety)
-    float cosRot = cos(a_InstanceRotation);
-    float sinRot = sin(a_InstanceRotation);
+    float cosRot = cos(rotation);
+    float sinRot = sin(rotation);
     
     vec3 rotatedRight = cameraRight * cosRot - cameraUp * sinRot;
     vec3 rotatedUp = cameraRight * sinRot + cameraUp * cosRot;
     
     // Scale the vertex
-    vec3 scaledPos = a_Position.x * rotatedRight * a_InstanceScale.x
-                   + a_Position.y * rotatedUp * a_InstanceScale.y;
+    vec2 quadPos = corner - 0.5;
+    vec3 scaledPos = quadPos.x * rotatedRight * scale
+                   + quadPos.y * rotatedUp * scale;
     
     // World position
-    v_WorldPos = a_InstancePos + scaledPos;
+    v_WorldPos = (model * vec4(instancePos, 1.0)).xyz + scaledPos;
     
     gl_Position = u_Projection * u_View * vec4(v_WorldPos, 1.0);
 }
@@ -53,20 +194,51 @@ in vec2 v_TexCoord;
 in vec3 v_Normal;
 in vec3 v_WorldPos;
 in vec3 v_Color;
+in float v_Occlusion;
+flat in float v_Layer;
+in vec3 v_LocalPos;
+flat in vec2 v_LodFade;
 
-out vec4 FragColor;
+layout(location = 0) out vec4 FragColor;
+// Second atlas of an impostor bake, see TreeImpostor.h
+layout(location = 1) out vec4 o_ImpostorSurface;
 
-uniform sampler2D u_LeafTexture;
+uniform sampler2DArray u_LeafTexture;  // One layer per species, see LeafTextureArray.h
 uniform vec3 u_LightDir;
+uniform int u_AlphaToCoverage;
+uniform float u_AlphaCutoff;
+uniform int u_AlphaBlend;
+
+// Optical depth toward the sun, see CanopyVolume.h
+uniform sampler3D u_CanopyVolume;
+uniform vec3 u_CanopyVolumeMin;
+uniform vec3 u_CanopyVolumeExtent;
+uniform int u_CanopyShadowing;
+
+uniform int u_ImpostorBake;
+
+#include "common/octahedral.glsl"
+#include "common/sun_shadow.glsl"
+#include "common/lod_dither.glsl"
 
 void main() {
-    // Sample the leaf texture
-    vec4 texColor = texture(u_LeafTexture, v_TexCoord);
+    // Sample this leaf's layer of the texture array
+    vec4 texColor = texture(u_LeafTexture, vec3(v_TexCoord, v_Layer));
     
-    // Alpha test - discard fully transparent pixels
-    if (texColor.a < 0.1) {
+    float alpha = texColor.a;
+    if (u_AlphaToCoverage != 0) {
+        // Coverage replaces the alpha test. Sharpen the edge to about one
+        // pixel wide so it stays crisp under minification.
+        alpha = clamp((alpha - 0.5) / max(fwidth(alpha), 1e-4) + 0.5, 0.0, 1.0);
+    } else if (alpha < u_AlphaCutoff) {
+        // Alpha test - discard transparent pixels
         discard;
+    } else if (u_AlphaBlend == 0) {
+        // Opaque survivor, so an offscreen target sees full coverage
+        alpha = 1.0;
     }
+    // After the derivatives above, the dither differs inside a pixel quad
+    if (LodDithered(v_LodFade)) discard;
     
     // Use the spherical normal for lighting
     // This creates the "volume lighting" effect where the entire canopy
@@ -79,13 +251,31 @@ void main() {
         normal = -normal;
     }
     
+    // Sunlight left after passing through the leaves between here and the sun
+    float sunTransmittance = 1.0;
+    if (u_CanopyShadowing != 0) {
+        vec3 volumeCoord = (v_LocalPos - u_CanopyVolumeMin) / u_CanopyVolumeExtent;
+        sunTransmittance = exp(-texture(u_CanopyVolume, volumeCoord).r);
+    }
+    // Both see the leaves, the shadow map adds the branches. The smaller
+    // one wins so the canopy is not counted twice.
+    sunTransmittance = min(sunTransmittance, SunVisibility(v_WorldPos));
+    
+    if (u_ImpostorBake != 0) {
+        // Unlit color, the impostor relights it with the stored normal and
+        // the light left by the canopy
+        FragColor = vec4(texColor.rgb * v_Color, 1.0);
+        o_ImpostorSurface = vec4(OctEncode(normal) * 0.5 + 0.5, v_Occlusion, sunTransmittance);
+        return;
+    }
+    
     // Diffuse lighting with softer falloff
     float diffuse = max(dot(normal, u_LightDir), 0.0);
-    diffuse = pow(diffuse, 0.7); // Soften the transition
+    diffuse = pow(diffuse, 0.7) * sunTransmittance; // Soften the transition
     
     // Add ambient light so leaves in shadow aren't completely black
-    float ambient = 0.35;
-    float lightIntensity = ambient + diffuse * 0.65;
+    float ambient = 0.35 * v_Occlusion;
+    float lightIntensity = ambient + diffuse * 0.65 * mix(0.5, 1.0, v_Occlusion);
     
     // Use texture color as base, modulate with instance color and lighting
     vec3 leafColor = texColor.rgb * v_Color;
@@ -94,11 +284,11 @@ void main() {
     // Subsurface scattering effect (leaves glow a bit when backlit)
     float backlight = max(dot(normal, -u_LightDir), 0.0);
     vec3 subsurfaceColor = vec3(0.4, 0.7, 0.3); // Bright green-yellow
-    finalColor += subsurfaceColor * backlight * 0.25 * texColor.a;
+    finalColor += subsurfaceColor * backlight * 0.25 * texColor.a * sunTransmittance;
     
     // Add slight edge lighting for more definition
     float fresnel = pow(1.0 - abs(dot(normal, normalize(v_WorldPos))), 2.0);
     finalColor += vec3(0.3, 0.5, 0.2) * fresnel * 0.15;
     
-    FragColor = vec4(finalColor, texColor.a);
+    FragColor = vec4(finalColor, alpha);
 }
\ No newline at end of file
@@ -0,0 +1,13 @@
+#shader vertex
+#version 330 core
+
+uniform sampler2D u_LeafCount;
+
+// DrawArraysIndirectCommand: count, instanceCount, first, reserved
+flat out uvec4 o_Command;
+
+void main() {
+    uint instances = uint(texelFetch(u_LeafCount, ivec2(0, 0), 0).r + 0.5);
+    o_Command = uvec4(4u, instances, 0u, 0u);
+    gl_Position = vec4(0.0);
+}
@@ -0,0 +1,16 @@
+#shader vertex
+#version 330 core
+
+// Every captured leaf lands on the single texel of the count target
+void main() {
+    gl_Position = vec4(0.0, 0.0, 0.0, 1.0);
+}
+
+#shader fragment
+#version 330 core
+
+out float FragCount;
+
+void main() {
+    FragCount = 1.0;
+}
@@ -0,0 +1,63 @@
+#shader vertex
+#version 330 core
+
+// One raw PackedLeafInstance per point:
+// x = position x | y << 16, y = position z | occlusion << 16 | rank << 24,
+// z = seed | scale step << 24, w = wind branch | texture layer << 24
+layout(location = 0) in uvec4 a_Instance;
+
+flat out uvec4 v_Instance;
+out float v_Keep;
+
+uniform vec4 u_FrustumPlanes[6];
+uniform vec3 u_LeafBoundsMin;
+uniform vec3 u_LeafBoundsExtent;
+uniform float u_LeafScaleMin;
+uniform float u_LeafScaleStep;
+
+// Distance pruning, see LeafKeepFraction in LeafClusters.h
+uniform vec3 u_CameraPos;
+uniform float u_PruneStart;
+uniform float u_MinKeepFraction;
+
+void main() {
+    vec3 unit = vec3(float(a_Instance.x & 0xFFFFu), float(a_Instance.x >> 16u),
+                     float(a_Instance.y & 0xFFFFu)) / 65535.0;
+    vec3 position = u_LeafBoundsMin + unit * u_LeafBoundsExtent;
+    float scale = u_LeafScaleMin + float(a_Instance.z >> 24u) * u_LeafScaleStep;
+    
+    // Rank is the leaf's place in its cluster's blue-noise order, so keeping
+    // rank < fraction keeps the same prefix the CPU path would
+    float rank = float(a_Instance.y >> 24u) / 255.0;
+    float ratio = u_PruneStart / max(distance(position, u_CameraPos), u_PruneStart);
+    float fraction = max(ratio * ratio, u_MinKeepFraction);
+    bool keep = rank < fraction;
+    
+    // Survivors are grown by leaf.shader, test against the grown card
+    float radius = scale * 0.7072 * inversesqrt(fraction);
+    for (int i = 0; i < 6; i++) {
+        keep = keep && dot(u_FrustumPlanes[i].xyz, position) + u_FrustumPlanes[i].w > -radius;
+    }
+    
+    v_Instance = a_Instance;
+    v_Keep = keep ? 1.0 : 0.0;
+}
+
+#shader geometry
+#version 330 core
+
+layout(points) in;
+layout(points, max_vertices = 1) out;
+
+flat in uvec4 v_Instance[];
+in float v_Keep[];
+
+flat out uvec4 o_Instance;
+
+void main() {
+    // Only survivors reach the transform feedback buffer
+    if (v_Keep[0] > 0.5) {
+        o_Instance = v_Instance[0];
+        EmitVertex();
+    }
+}
@@ -0,0 +1,65 @@
+#shader vertex
+#version 330 core
+
+// Fullscreen triangle from the vertex index
+void main() {
+    vec2 corner = vec2(float((gl_VertexID << 1) & 2), float(gl_VertexID & 2));
+    gl_Position = vec4(corner * 2.0 - 1.0, 0.0, 1.0);
+}
+
+#shader fragment
+#version 330 core
+
+out vec4 FragColor;
+
+uniform sampler2D u_LeafColor;       // Half-res, premultiplied, alpha = coverage
+uniform sampler2D u_LeafDepth;       // Half-res
+uniform sampler2D u_HalfSceneDepth;  // Scene depth the half-res leaves were tested against
+uniform sampler2D u_SceneDepth;      // Full-res scene depth
+uniform vec2 u_ViewportOrigin;
+uniform vec2 u_DepthParams;          // projection[2][2], projection[3][2]
+
+float LinearDepth(float depth) {
+    return u_DepthParams.y / (depth * 2.0 - 1.0 + u_DepthParams.x);
+}
+
+void main() {
+    vec2 pixelPos = gl_FragCoord.xy - u_ViewportOrigin;
+    ivec2 halfSize = textureSize(u_LeafColor, 0);
+    float sceneDepth = LinearDepth(texelFetch(u_SceneDepth, ivec2(pixelPos), 0).r);
+
+    // Half-res texel j is centered on full-res pixel edge 2j + 1
+    vec2 halfPos = pixelPos * 0.5 - 0.5;
+    ivec2 base = ivec2(floor(halfPos));
+    vec2 f = halfPos - vec2(base);
+
+    vec4 color = vec4(0.0);
+    float totalWeight = 0.0;
+    float bestWeight = -1.0;
+    float depth = 1.0;
+    for (int i = 0; i < 4; i++) {
+        ivec2 offset = ivec2(i & 1, i >> 1);
+        ivec2 texel = clamp(base + offset, ivec2(0), halfSize - 1);
+        vec2 bilinear = mix(1.0 - f, f, vec2(offset));
+
+        // A texel that was tested against another surface than this pixel
+        // sees gets almost no say, so leaves stay on their side of an edge
+        float halfSceneDepth = LinearDepth(texelFetch(u_HalfSceneDepth, texel, 0).r);
+        float difference = abs(halfSceneDepth - sceneDepth) / sceneDepth;
+        float weight = (bilinear.x * bilinear.y + 1e-3) / (difference + 1e-3);
+
+        vec4 leaf = texelFetch(u_LeafColor, texel, 0);
+        color += leaf * weight;
+        totalWeight += weight;
+        if (leaf.a > 0.0 && weight > bestWeight) {
+            bestWeight = weight;
+            depth = texelFetch(u_LeafDepth, texel, 0).r;
+        }
+    }
+    color /= totalWeight;
+    if (color.a < 1.0 / 255.0) discard;
+
+    // Depth tested at full resolution against the scene, and kept for later passes
+    gl_FragDepth = depth;
+    FragColor = color;
+}
@@ -10,7 +10,8 @@ uniform float time;
 
 void main() {
     worldPos = position;
-    gl_Position = vec4(position, 1.0);
+    // On the far plane, the depth test leaves only pixels nothing was drawn on
+    gl_Position = vec4(position.xy, 1.0, 1.0);
     
     // Reconstruct world direction
     vec4 clip = vec4(position.xy, 1.0, 1.0);
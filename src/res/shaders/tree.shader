@@ -4,24 +4,107 @@
 layout(location = 0) in vec3 aPos;
 layout(location = 1) in vec3 aNormal;
 layout(location = 2) in vec3 aColor;
+layout(location = 3) in float aOcclusion;
+layout(location = 4) in uint aWindBranch;
+// Forest placements, one per instance, see ForestInstanceData
+layout(location = 5) in vec4 aPlacementPositionScale;
+layout(location = 6) in vec4 aPlacementTintYaw;
+layout(location = 7) in vec4 aPlacementLodFade;
 
 out vec3 v_FragPos;
 out vec3 v_Normal;
 out vec3 v_Color;
+out float v_Occlusion;
+flat out vec2 v_LodFade;
 
 uniform mat4 u_View;
 uniform mat4 u_Projection;
 
+uniform mat4 u_Model;           // Placement of a single tree
+uniform int u_ForestInstanced;  // Placements come from the instance attributes instead
+
+uniform samplerBuffer u_WindBranches;
+uniform vec3 u_WindDirection;
+uniform float u_WindStrength;
+uniform float u_WindFrequency;
+uniform float u_Time;
+
+vec3 RotateAxisAngle(vec3 v, vec3 axis, float angle) {
+    float c = cos(angle);
+    float s = sin(angle);
+    return v * c + cross(axis, v) * s + axis * dot(axis, v) * (1.0 - c);
+}
+
+// Walks from a branch up to the trunk (see WindBranch in Wind.h). Each level
+// rotates the point about its pivot, child first, so every pivot follows
+// the swing of the levels above it and joints stay closed. Runs in the
+// tree's local space.
+void ApplyWind(int branch, vec3 windDirection, float time, inout vec3 position, inout vec3 normal) {
+    if (u_WindStrength <= 0.0) return;
+    
+    vec3 bendAxis = normalize(cross(vec3(0.0, 1.0, 0.0), windDirection));
+    float gust = 0.6 + 0.4 * sin(time * 0.37) * sin(time * 0.23 + 1.3);
+    
+    for (int level = 0; level < 16 && branch >= 0; level++) {
+        vec4 node = texelFetch(u_WindBranches, branch * 2);      // pivot, stiffness
+        vec4 link = texelFetch(u_WindBranches, branch * 2 + 1);  // parent, depth, phase
+        
+        // Thin branches bend further and oscillate faster
+        float stiffness = node.w;
+        float amount = u_WindStrength * 0.012 / (stiffness + 0.08);
+        float t = time * u_WindFrequency * (1.0 + 1.5 * (1.0 - stiffness)) * 6.2831853 + link.z;
+        float bend = amount * gust * (0.5 + 0.6 * sin(t) + 0.25 * sin(t * 2.13 + 0.7));
+        float twist = amount * 0.4 * sin(t * 1.37 + 2.1);
+        
+        vec3 offset = RotateAxisAngle(position - node.xyz, bendAxis, bend);
+        position = node.xyz + RotateAxisAngle(offset, windDirection, twist);
+        normal = RotateAxisAngle(RotateAxisAngle(normal, bendAxis, bend), windDirection, twist);
+        
+        branch = int(link.x);
+    }
+}
+
+// Model matrix of a forest placement, with its tint and a wind time offset
+mat4 PlacementMatrix(vec4 positionScale, vec4 tintYaw, out vec3 tint, out float windPhase) {
+    float c = cos(tintYaw.w) * positionScale.w;
+    float s = sin(tintYaw.w) * positionScale.w;
+    tint = tintYaw.rgb;
+    
+    // Neighbouring trees sway out of step
+    windPhase = fract(sin(dot(positionScale.xz, vec2(12.9898, 78.233))) * 43758.5453) * 100.0;
+    return mat4(vec4(c, 0.0, -s, 0.0),
+                vec4(0.0, positionScale.w, 0.0, 0.0),
+                vec4(s, 0.0, c, 0.0),
+                vec4(positionScale.xyz, 1.0));
+}
+
 void main() {
-    // Direct vertex transformation (no instance matrix)
-    vec4 worldPos = vec4(aPos, 1.0);
+    mat4 model = u_Model;
+    vec3 tint = vec3(1.0);
+    float windPhase = 0.0;
+    v_LodFade = vec2(1.0, 0.0);
+    if (u_ForestInstanced != 0) {
+        model = PlacementMatrix(aPlacementPositionScale, aPlacementTintYaw, tint, windPhase);
+        // z is 1 when only the leaves cross-fade, see ForestInstanceData
+        v_LodFade = aPlacementLodFade.z > 0.5 ? vec2(1.0, 0.0) : aPlacementLodFade.xy;
+    }
+    
+    // Sway the local rest pose, then place it
+    vec3 position = aPos;
+    vec3 normal = aNormal;
+    vec3 windDirection = normalize(transpose(mat3(model)) * u_WindDirection);
+    ApplyWind(int(aWindBranch), windDirection, u_Time + windPhase, position, normal);
+    vec4 worldPos = model * vec4(position, 1.0);
     v_FragPos = worldPos.xyz;
     
-    // Direct normal (already in world space)
-    v_Normal = aNormal;
+    // Rotation and uniform scale only, so the normal needs no inverse transpose
+    v_Normal = normalize(mat3(model) * normal);
     
-    // Pass through vertex color
-    v_Color = aColor;
+    // Vertex color, tinted per placement
+    v_Color = aColor * tint;
+    
+    // Baked ambient occlusion
+    v_Occlusion = aOcclusion;
     
     gl_Position = u_Projection * u_View * worldPos;
 }
@@ -32,21 +115,38 @@ void main() {
 in vec3 v_FragPos;
 in vec3 v_Normal;
 in vec3 v_Color;
+in float v_Occlusion;
+flat in vec2 v_LodFade;
 
-out vec4 FragColor;
+layout(location = 0) out vec4 FragColor;
+// Second atlas of an impostor bake, see TreeImpostor.h
+layout(location = 1) out vec4 o_ImpostorSurface;
 
 uniform vec3 u_LightDir;
+uniform int u_ImpostorBake;
+
+#include "common/octahedral.glsl"
+#include "common/sun_shadow.glsl"
+#include "common/lod_dither.glsl"
 
 void main()
 {
+    if (LodDithered(v_LodFade)) discard;
     vec3 normal = normalize(v_Normal);
+
+    if (u_ImpostorBake != 0) {
+        // Unlit color, the impostor relights it with the stored normal
+        FragColor = vec4(v_Color, 1.0);
+        o_ImpostorSurface = vec4(OctEncode(normal) * 0.5 + 0.5, v_Occlusion, 1.0);
+        return;
+    }
     vec3 lightDir = normalize(u_LightDir);
 
-    // Diffuse lighting
-    float diff = max(dot(normal, lightDir), 0.0);
+    // Diffuse lighting, none where the tree shades itself
+    float diff = max(dot(normal, lightDir), 0.0) * SunVisibility(v_FragPos);
 
-    // Strong ambient so it never goes dark
-    float ambient = 0.6;
+    // Strong ambient so it never goes dark, darkened where the bake found occluders
+    float ambient = 0.6 * v_Occlusion;
 
     // Final brightness
     float lighting = ambient + diff * 0.6;
@@ -54,7 +154,7 @@ void main()
     vec3 color = v_Color * lighting;
 
     // Clamp to avoid dark collapse
-    color = max(color, v_Color * 0.7);
+    color = max(color, v_Color * 0.7 * v_Occlusion);
 
     FragColor = vec4(color, 1.0);
 }
\ No newline at end of file